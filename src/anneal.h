@@ -28,6 +28,7 @@
 
 #include <algorithm>
 #include <limits>
+#include <sstream>
 #include <vector>
 
 #ifdef _WIN32
@@ -39,11 +40,13 @@
 #include <vigra/diff2d.hxx>
 #include <vigra/iteratoradapter.hxx>
 
+#include "anneal_kernels.h"
 #include "masktypedefs.h"
 #include "muopt.h"
 #include "opencl.h"
 #include "opencl_anneal.h"
 #include "openmp_lock.h"
+#include "parameter.h"
 #include "timer.h"
 
 
@@ -57,6 +60,25 @@ namespace GPU
 
 namespace enblend {
 
+// Defined in enblend.cc.
+extern parameter::handle<bool> annealFastExp;
+extern parameter::handle<bool> timeStateProbabilities;
+extern parameter::handle<bool> timeAnnealSnake;
+#ifdef OPENCL
+extern parameter::handle<bool> gpuKernelAnneal;
+#endif
+
+// All snakes that are optimized concurrently write their
+// diagnostics under this one lock, so that the lines of different
+// snakes do not interleave.
+inline omp::lock&
+snakeOutputLock()
+{
+    static omp::lock lock;
+    return lock;
+}
+
+
 inline static vigra::Diff2D
 normal_vector(const vigra::Point2D& a_previous_point,
               const vigra::Point2D& a_current_point,
@@ -85,7 +107,7 @@ public:
     typedef typename vigra::NumericTraits<CostImagePixelType>::Promote CostImagePromoteType;
 
     GDAConfiguration(const CostImage* const d, Segment* v, VisualizeImage* const vi) :
-        costImage(d), visualizeStateSpaceImage(vi) {
+        costImage(d), visualizeStateSpaceImage(vi), cerrLock(snakeOutputLock()) {
         kMax = 1;
         distanceWeight = 1.0;
         mismatchWeight = 1.0;
@@ -103,11 +125,8 @@ public:
 
             mfEstimates.push_back(currentPoint);
 
-            std::vector<vigra::Point2D>* stateSpace = new std::vector<vigra::Point2D>();
-            pointStateSpaces.push_back(stateSpace);
-
-            std::vector<int>* stateDistances = new std::vector<int>();
-            pointStateDistances.push_back(stateDistances);
+            const size_t stateOffset = stateX.size();
+            stateOffsets.push_back(stateOffset);
 
             vigra::Diff2D normal = normal_vector(previousPoint, currentPoint, nextPoint);
             const double normal_magnitude = normal.magnitude();
@@ -133,9 +152,9 @@ public:
                     } else if ((*costImage)[*linePoint] == vigra::NumericTraits<CostImagePixelType>::max()) {
                         break;
                     } else if (i % spaceBetweenPoints == 0) {
-                        stateSpace->push_back(vigra::Point2D(*linePoint));
-                        stateDistances->push_back(std::max(std::abs(linePoint->x - currentPoint.x),
-                                                           std::abs(linePoint->y - currentPoint.y)) / 2);
+                        addState(vigra::Point2D(*linePoint),
+                                 std::max(std::abs(linePoint->x - currentPoint.x),
+                                          std::abs(linePoint->y - currentPoint.y)) / 2);
                         if (visualizeStateSpaceImage) {
                             (*visualizeStateSpaceImage)[*linePoint] = VISUALIZE_STATE_SPACE;
                         }
@@ -151,9 +170,9 @@ public:
                     } else if ((*costImage)[*linePoint] == vigra::NumericTraits<CostImagePixelType>::max()) {
                         break;
                     } else if (i % spaceBetweenPoints == 0) {
-                        stateSpace->push_back(vigra::Point2D(*linePoint));
-                        stateDistances->push_back(std::max(std::abs(linePoint->x - currentPoint.x),
-                                                           std::abs(linePoint->y - currentPoint.y)) / 2);
+                        addState(vigra::Point2D(*linePoint),
+                                 std::max(std::abs(linePoint->x - currentPoint.x),
+                                          std::abs(linePoint->y - currentPoint.y)) / 2);
                         if (visualizeStateSpaceImage) {
                             (*visualizeStateSpaceImage)[*linePoint] = VISUALIZE_STATE_SPACE;
                         }
@@ -161,15 +180,14 @@ public:
                 }
             }
 
-            if (stateSpace->size() == 0) {
-                stateSpace->push_back(currentPoint);
-                stateDistances->push_back(0);
+            if (stateX.size() == stateOffset) {
+                addState(currentPoint, 0);
                 if (visualizeStateSpaceImage && costImage->isInside(currentPoint)) {
                     (*visualizeStateSpaceImage)[currentPoint] = VISUALIZE_STATE_SPACE_INSIDE;
                 }
             }
 
-            const unsigned int localK = stateSpace->size();
+            const unsigned int localK = static_cast<unsigned int>(stateX.size() - stateOffset);
             if (localK > AnnealPara.kmax) {
                 std::cerr << command
                      << ": local k = " << localK << " > k_max = " << AnnealPara.kmax
@@ -179,7 +197,8 @@ public:
 
             kMax = std::max(kMax, localK);
 
-            pointStateProbabilities.push_back(new std::vector<double>(localK, 1.0 / localK));
+            stateCounts.push_back(localK);
+            stateProbabilities.insert(stateProbabilities.end(), localK, 1.0 / localK);
 
             convergedPoints.push_back(localK < 2);
 
@@ -199,14 +218,7 @@ public:
         }
     }
 
-    virtual ~GDAConfiguration() {
-        std::for_each(pointStateSpaces.begin(), pointStateSpaces.end(),
-                      [](std::vector<vigra::Point2D>* x) {delete x;});
-        std::for_each(pointStateProbabilities.begin(), pointStateProbabilities.end(),
-                      [](std::vector<double>* x) {delete x;});
-        std::for_each(pointStateDistances.begin(), pointStateDistances.end(),
-                      [](std::vector<int>* x) {delete x;});
-    }
+    virtual ~GDAConfiguration() {}
 
     void run() {
         int progressIndicator = 1;
@@ -223,15 +235,15 @@ public:
                                                / log(((kMax - 2.0) / (2.0 * kMax) * exp(-tCurrent / deltaEMax))
                                                      + 0.5)));
 
+            // Collect the line and write it in one go, for other
+            // snakes may be annealed concurrently.
+            std::ostringstream progress;
             if (Verbose >= VERBOSE_GDA_MESSAGES) {
-                const std::ios_base::fmtflags ioFlags(std::cerr.flags());
-                std::cerr << "\n"
+                progress << "\n"
                      << command
                      << ": info: t = " << std::scientific << std::setprecision(3) << tCurrent
                      << ", eta = " << std::setw(4) << eta
                      << ", k_max = " << std::setw(3) << kMax;
-                std::cerr.flush();
-                std::cerr.flags(ioFlags);
             }
 
             for (unsigned int i = 0; i < eta; i++) {
@@ -247,14 +259,18 @@ public:
                         numConvergedPoints++;
                     }
                 }
-                std::cerr << ", " << numConvergedPoints
+                progress << ", " << numConvergedPoints
                      << " of " << convergedPoints.size()
                      << " points converged";
-                std::cerr.flush();
             }
             else if (Verbose >= VERBOSE_MASK_MESSAGES && iterationCount % iterationsPerTick == 0) {
-                std::cerr << " " << progressIndicator << "/4";
+                progress << " " << progressIndicator << "/4";
                 progressIndicator++;
+            }
+
+            if (!progress.str().empty()) {
+                omp::scoped_lock<omp::lock> _(cerrLock);
+                std::cerr << progress.str();
                 std::cerr.flush();
             }
 
@@ -263,10 +279,9 @@ public:
 
         if (visualizeStateSpaceImage) {
             // Remaining unconverged state space points
-            for (unsigned int i = 0; i < pointStateSpaces.size(); ++i) {
-                std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[i];
-                for (unsigned int j = 0; j < stateSpace->size(); ++j) {
-                    vigra::Point2D point = (*stateSpace)[j];
+            for (unsigned int i = 0; i < stateCounts.size(); ++i) {
+                for (unsigned int j = 0; j < stateCounts[i]; ++j) {
+                    const vigra::Point2D point = statePoint(stateOffsets[i] + j);
                     if (visualizeStateSpaceImage->isInside(point)) {
                         (*visualizeStateSpaceImage)[point] = VISUALIZE_STATE_SPACE_UNCONVERGED;
                     }
@@ -275,19 +290,19 @@ public:
         }
 
         if (Verbose >= VERBOSE_GDA_MESSAGES) {
+            omp::scoped_lock<omp::lock> _(cerrLock);
             std::cerr << std::endl;
             for (unsigned int i = 0; i < convergedPoints.size(); i++) {
                 if (!convergedPoints[i]) {
                     std::cerr << command
                          << ": info: unconverged point: "
                          << std::endl;
-                    std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[i];
-                    std::vector<double>* stateProbabilities = pointStateProbabilities[i];
-                    const unsigned int localK = stateSpace->size();
+                    const size_t offset = stateOffsets[i];
+                    const unsigned int localK = stateCounts[i];
                     for (unsigned int state = 0; state < localK; ++state) {
                         std::cerr << command
-                             << ": info: state " << (*stateSpace)[state]
-                             << ", weight = " << (*stateProbabilities)[state]
+                             << ": info: state " << statePoint(offset + state)
+                             << ", weight = " << stateProbabilities[offset + state]
                              << std::endl;
                     }
                     std::cerr << command
@@ -318,6 +333,7 @@ public:
 protected:
     virtual void calculateStateProbabilities() {
         const int mf_size = static_cast<int>(mfEstimates.size());
+        const bool use_kernel = annealFastExp();
 
 #ifdef OPENMP
 #pragma omp parallel
@@ -325,23 +341,23 @@ protected:
         {
             double* E = new double[kMax];
             double* Pi = new double[kMax];
+            double* scratch = new double[kMax];
 
 #ifdef OPENMP
 #pragma omp for nowait schedule(guided)
 #endif
             for (int index = 0; index < mf_size; ++index) {
                 // Skip updating points that have already converged.
-                convergedPointsLock.set();
                 if (convergedPoints[index]) {
-                    convergedPointsLock.unset();
                     continue;
                 }
-                convergedPointsLock.unset();
 
-                const std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
-                std::vector<double>* stateProbabilities = pointStateProbabilities[index];
-                const std::vector<int>* stateDistances = pointStateDistances[index];
-                const unsigned int localK = stateSpace->size();
+                const size_t offset = stateOffsets[index];
+                const int* const x = &stateX[offset];
+                const int* const y = &stateY[offset];
+                const int* const distances = &stateDistances[offset];
+                double* const probabilities = &stateProbabilities[offset];
+                const unsigned int localK = stateCounts[index];
 
                 const int lastIndex = index == 0 ? mf_size - 1 : index - 1;
                 const unsigned int nextIndex = (index + 1) % mf_size;
@@ -352,8 +368,8 @@ protected:
 
                 // Calculate E values.
                 for (unsigned i = 0U; i < localK; ++i) {
-                    const vigra::Point2D currentPoint = (*stateSpace)[i];
-                    const int distanceCost = (*stateDistances)[i];
+                    const vigra::Point2D currentPoint(x[i], y[i]);
+                    const int distanceCost = distances[i];
                     int mismatchCost = 0;
                     if (lastPointInCostImage) {
                         mismatchCost += costImageCost(lastPointEstimate, currentPoint);
@@ -374,25 +390,40 @@ protected:
                 // Calculate new stateProbabilities
                 // An = 1 / (1 + exp((E[j] - E[i]) / tCurrent))
                 // pi[j]' = 1/K * sum_(0)_(k-1) An(i,j) * (pi[i] + pi[j])
-                for (unsigned j = 0U; j < localK; ++j) {
-                    const double piTj = (*stateProbabilities)[j];
-                    Pi[j] += piTj;
-                    const double ej = E[j];
-                    for (unsigned i = j + 1U; i < localK; ++i) {
-                        const double piT = (*stateProbabilities)[i] + piTj;
-                        double piTAn = piT / (1.0 + std::exp(ej - E[i]));
-                        if (EXPECT_RESULT(std::isnan(piTAn), false)) {
-                            // exp term is infinity or zero.
-                            piTAn = ej > E[i] ? 0.0 : piT;
+                if (use_kernel) {
+                    // Same as below, but with a vectorized
+                    // approximation of exp(), which perturbs the
+                    // probabilities and therefore is opt-in.
+                    for (unsigned j = 0U; j < localK; ++j) {
+                        const double piTj = probabilities[j];
+                        const unsigned i = j + 1U;
+                        Pi[j] += piTj +
+                            anneal::pairwise_state_update(E + i, probabilities + i, Pi + i, scratch,
+                                                          E[j], piTj, static_cast<int>(localK - i));
+                        probabilities[j] = Pi[j] / localK;
+                    }
+                } else {
+                    for (unsigned j = 0U; j < localK; ++j) {
+                        const double piTj = probabilities[j];
+                        Pi[j] += piTj;
+                        const double ej = E[j];
+                        for (unsigned i = j + 1U; i < localK; ++i) {
+                            const double piT = probabilities[i] + piTj;
+                            double piTAn = piT / (1.0 + std::exp(ej - E[i]));
+                            if (EXPECT_RESULT(std::isnan(piTAn), false)) {
+                                // exp term is infinity or zero.
+                                piTAn = ej > E[i] ? 0.0 : piT;
+                            }
+                            Pi[j] += piTAn;
+                            Pi[i] += piT - piTAn;
                         }
-                        Pi[j] += piTAn;
-                        Pi[i] += piT - piTAn;
+                        probabilities[j] = Pi[j] / localK;
                     }
-                    (*stateProbabilities)[j] = Pi[j] / localK;
                 }
                 wall_clock.stop();
-                if (parameter::as_boolean("time-state-probabilities", false))
+                if (timeStateProbabilities())
                 {
+                    omp::scoped_lock<omp::lock> output_lock(cerrLock);
                     ocl::StowFormatFlags _;
 
                     std::cerr <<
@@ -405,6 +436,7 @@ protected:
 
             delete [] E;
             delete [] Pi;
+            delete [] scratch;
         } // omp parallel
     }
 
@@ -421,18 +453,17 @@ protected:
 #ifdef OPENMP
 #pragma omp for nowait schedule(guided)
 #endif
-            for (int index = 0; index < static_cast<int>(pointStateSpaces.size()); ++index) {
-                convergedPointsLock.set();
+            for (int index = 0; index < static_cast<int>(stateCounts.size()); ++index) {
                 if (convergedPoints[index]) {
-                    convergedPointsLock.unset();
                     continue;
                 }
-                convergedPointsLock.unset();
 
-                std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
-                std::vector<double>* stateProbabilities = pointStateProbabilities[index];
-                std::vector<int>* stateDistances = pointStateDistances[index];
-                unsigned int localK = stateSpace->size();
+                const size_t offset = stateOffsets[index];
+                int* const x = &stateX[offset];
+                int* const y = &stateY[offset];
+                int* const distances = &stateDistances[offset];
+                double* const probabilities = &stateProbabilities[offset];
+                unsigned int localK = stateCounts[index];
                 double estimateX = 0.0;
                 double estimateY = 0.0;
 
@@ -440,14 +471,13 @@ protected:
                 double totalWeight = 0.0;
                 bool hasHighWeightState = false;
                 for (unsigned int k = 0; k < localK; ++k) {
-                    const double weight = (*stateProbabilities)[k];
+                    const double weight = probabilities[k];
                     totalWeight += weight;
                     if (weight > 0.99) {
                         hasHighWeightState = true;
                     }
-                    const vigra::Point2D state = (*stateSpace)[k];
-                    estimateX += weight * static_cast<double>(state.x);
-                    estimateY += weight * static_cast<double>(state.y);
+                    estimateX += weight * static_cast<double>(x[k]);
+                    estimateY += weight * static_cast<double>(y[k]);
                 }
                 estimateX /= totalWeight;
                 estimateY /= totalWeight;
@@ -463,9 +493,9 @@ protected:
                               << std::endl;
                     for (unsigned int state = 0; state < localK; ++state) {
                         std::cerr << command
-                                  << ": note: state " << (*stateSpace)[state]
+                                  << ": note: state " << vigra::Point2D(x[state], y[state])
                                   << " weight = "
-                                  << (*stateProbabilities)[state]
+                                  << probabilities[state]
                                   << std::endl;
                     }
                     std::cerr << command
@@ -474,9 +504,7 @@ protected:
                     cerrLock.unset();
 
                     // Skip this point from now on.
-                    convergedPointsLock.set();
                     convergedPoints[index] = true;
-                    convergedPointsLock.unset();
                     continue;
                 }
 
@@ -485,18 +513,16 @@ protected:
                 // Remove improbable solutions from the search space
                 double totalWeights = 0.0;
                 const double cutoffWeight = hasHighWeightState ? 0.50 : 0.00001;
-                for (unsigned int k = 0; k < stateSpace->size(); ) {
-                    const double weight = (*stateProbabilities)[k];
+                for (unsigned int k = 0; k < localK; ) {
+                    const double weight = probabilities[k];
                     if (weight < cutoffWeight) {
-                        // Replace this state with last state
-                        (*stateProbabilities)[k] = (*stateProbabilities)[stateProbabilities->size() - 1];
-                        (*stateSpace)[k] = (*stateSpace)[stateSpace->size() - 1];
-                        (*stateDistances)[k] = (*stateDistances)[stateDistances->size() - 1];
-
-                        // Delete last state
-                        stateProbabilities->pop_back();
-                        stateSpace->pop_back();
-                        stateDistances->pop_back();
+                        // Replace this state with last state and
+                        // delete last state
+                        --localK;
+                        probabilities[k] = probabilities[localK];
+                        x[k] = x[localK];
+                        y[k] = y[localK];
+                        distances[k] = distances[localK];
                     } else {
                         totalWeights += weight;
                         ++k;
@@ -504,18 +530,16 @@ protected:
                 }
 
                 // Renormalize
-                for (unsigned int k = 0; k < stateSpace->size(); ++k) {
-                    (*stateProbabilities)[k] /= totalWeights;
+                for (unsigned int k = 0; k < localK; ++k) {
+                    probabilities[k] /= totalWeights;
                 }
 
-                localK = stateSpace->size();
+                stateCounts[index] = localK;
                 if (localK < 2) {
-                    convergedPointsLock.set();
                     convergedPoints[index] = true;
-                    convergedPointsLock.unset();
                 }
 
-                kmax_local = std::max(kmax_local, stateProbabilities->size());
+                kmax_local = std::max(kmax_local, static_cast<size_t>(localK));
             }
 
             kMaxLock.set();
@@ -524,6 +548,16 @@ protected:
         } // omp parallel
     }
 
+    void addState(const vigra::Point2D& a_point, int a_distance) {
+        stateX.push_back(a_point.x);
+        stateY.push_back(a_point.y);
+        stateDistances.push_back(a_distance);
+    }
+
+    vigra::Point2D statePoint(size_t i) const {
+        return vigra::Point2D(stateX[i], stateY[i]);
+    }
+
     int costImageCost(const vigra::Point2D& start_point, const vigra::Point2D& end_point) const {
         typedef typename CostImage::ConstIterator CostIterator;
 
@@ -575,17 +609,23 @@ protected:
     // Mean-field estimates of current point locations
     std::vector<vigra::Point2D> mfEstimates;
 
-    // State spaces of each point
-    std::vector<std::vector<vigra::Point2D>*> pointStateSpaces;
-
-    // Probability vectors for each state space
-    std::vector<std::vector<double>*> pointStateProbabilities;
-
-    std::vector<std::vector<int>*> pointStateDistances;
-
-    // Flags indicate which points have converged
-    std::vector<bool> convergedPoints;
-    omp::lock convergedPointsLock;
+    // State spaces of all points in one arena, one array per
+    // component.  The states of point i occupy the index range
+    // [stateOffsets[i], stateOffsets[i] + stateCounts[i]).  Pruning
+    // shrinks stateCounts[i] and never moves the states of another
+    // point.
+    std::vector<size_t> stateOffsets;
+    std::vector<unsigned int> stateCounts;
+    std::vector<int> stateX;
+    std::vector<int> stateY;
+    std::vector<int> stateDistances;
+    std::vector<double> stateProbabilities;
+
+    // Flags indicate which points have converged.  Only the thread
+    // working on a point writes its flag.  Unlike the bits of a
+    // std::vector<bool> separate bytes can be written concurrently,
+    // so the flags need no lock.
+    std::vector<unsigned char> convergedPoints;
 
     // Initial Temperature
     double tInitial;
@@ -615,7 +655,7 @@ protected:
     double distanceWeight;;
     double mismatchWeight;
 
-    omp::lock cerrLock;
+    omp::lock& cerrLock;
 }; // class GDAConfiguration
 
 
@@ -640,10 +680,7 @@ protected:
         const int mf_size = static_cast<int>(super::mfEstimates.size());
 
         const size_t maximum_probability_vector_size =
-            (*std::max_element(super::pointStateProbabilities.begin(),
-                               super::pointStateProbabilities.end(),
-                               [] (const std::vector<double>* x, const std::vector<double>* y)
-        {return x->size() < y->size();}))->size();
+            *std::max_element(super::stateCounts.begin(), super::stateCounts.end());
 
         // Method GPU::StateProbabilities->setup() allocates space for
         // `E' and `Pi' for us.  In particular it will use the GPU's
@@ -660,10 +697,9 @@ protected:
                 continue;
             }
 
-            const std::vector<vigra::Point2D>* stateSpace = super::pointStateSpaces[index];
-            std::vector<double>* stateProbabilities = super::pointStateProbabilities[index];
-            const std::vector<int>* stateDistances = super::pointStateDistances[index];
-            const int localK = static_cast<int>(stateSpace->size());
+            const size_t offset = super::stateOffsets[index];
+            double* const probabilities = &super::stateProbabilities[offset];
+            const int localK = static_cast<int>(super::stateCounts[index]);
 
             const int lastIndex = (index == 0 ? mf_size : index) - 1;
             const int nextIndex = (index + 1) % mf_size;
@@ -675,8 +711,8 @@ protected:
             // Calculate E values.
             for (int i = 0; i < localK; ++i)
             {
-                const vigra::Point2D currentPoint = (*stateSpace)[i];
-                const int distanceCost = (*stateDistances)[i];
+                const vigra::Point2D currentPoint = super::statePoint(offset + i);
+                const int distanceCost = super::stateDistances[offset + i];
                 int mismatchCost = 0;
                 if (lastPointInCostImage)
                 {
@@ -696,10 +732,10 @@ protected:
 
             timer::WallClock wall_clock;
             wall_clock.start();
-            GPU::StateProbabilities->run(localK, stateProbabilities, super::kMax, E, Pi);
+            GPU::StateProbabilities->run(localK, probabilities, super::kMax, E, Pi);
             wall_clock.stop();
 
-            if (parameter::as_boolean("time-state-probabilities", false))
+            if (timeStateProbabilities())
             {
                 ocl::StowFormatFlags _;
 
@@ -729,7 +765,7 @@ void annealSnake(const CostImage* const ci,
     wall_clock.start();
 
 #ifdef OPENCL
-    const bool enable_kernel = parameter::as_boolean("gpu-kernel-anneal", true);
+    const bool enable_kernel = gpuKernelAnneal();
 
     std::unique_ptr<GDAConfiguration<CostImage, VisualizeImage> >
         cfg((GPUContext && enable_kernel) ?
@@ -757,8 +793,9 @@ void annealSnake(const CostImage* const ci,
     }
 
     wall_clock.stop();
-    if (parameter::as_boolean("time-anneal-snake", false))
+    if (timeAnnealSnake())
     {
+        omp::scoped_lock<omp::lock> output_lock(snakeOutputLock());
         ocl::StowFormatFlags _;
 
         std::cerr <<
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2009-2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "anneal_kernels.h"
+
+
+#ifndef RESTRICT
+#define RESTRICT
+#endif
+
+// Lower optimization levels, like GCC's -O2, let the vectorizer only
+// handle loops whose trip count is known to fit the vector length.
+// The kernels are worthless without vectorization, so we ask for it
+// whatever the global optimization level.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("tree-vectorize", "vect-cost-model=dynamic")
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ANNEAL_HAVE_AVX_KERNELS
+#define ANNEAL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define ANNEAL_TARGET_AVX512 __attribute__((target("avx512f,avx512dq")))
+#endif
+
+#ifdef __GNUC__
+#define ANNEAL_ALWAYS_INLINE __attribute__((always_inline))
+#else
+#define ANNEAL_ALWAYS_INLINE
+#endif
+
+
+namespace anneal
+{
+    // Beyond this magnitude the logistic function is 0 or 1 to
+    // within double precision relative to the probabilities it
+    // weights.
+    static const double maximum_exponent = 40.0;
+
+
+    // Approximate exp(x) for |x| <= maximum_exponent.  We split
+    // x / ln(2) into an integral part n and a fraction f in
+    // [-1/2, 1/2), evaluate 2^f = exp(f ln(2)) with a Taylor
+    // polynomial of degree 7, whose relative error is below 1e-8, and
+    // scale by 2^n via the exponent bits.  Integral truncation of a
+    // positive number replaces floor(), which does not vectorize with
+    // the baseline instruction set.
+    inline static double ANNEAL_ALWAYS_INLINE
+    fast_exp(double x)
+    {
+        const double y = x * 1.4426950408889634; // 1 / ln(2)
+        const int n = static_cast<int>(y + 64.5) - 64;
+        const double g = (y - static_cast<double>(n)) * 0.6931471805599453; // ln(2)
+
+        const double p =
+            1.0 + g * (1.0 + g * (1.0 / 2.0 + g * (1.0 / 6.0 + g * (1.0 / 24.0 + g * (1.0 / 120.0 +
+            g * (1.0 / 720.0 + g * (1.0 / 5040.0)))))));
+
+        const std::int64_t bits = (static_cast<std::int64_t>(n) + 1023) << 52;
+        double scale;
+        std::memcpy(&scale, &bits, sizeof(double));
+
+        return p * scale;
+    }
+
+
+    // Clamp x to [-maximum_exponent, maximum_exponent] with the
+    // identities min(a, b) = (a + b - |a - b|) / 2 and max(a, b) =
+    // (a + b + |a - b|) / 2.  Unlike conditionals on floating-point
+    // comparisons, which might trap, these vectorize without
+    // -fno-trapping-math.
+    inline static double ANNEAL_ALWAYS_INLINE
+    clamp_exponent(double x)
+    {
+        const double y = 0.5 * (x + maximum_exponent - std::fabs(x - maximum_exponent));
+        return 0.5 * (y - maximum_exponent + std::fabs(y + maximum_exponent));
+    }
+
+
+    // Generic loop body, instantiated once per instruction set.  It
+    // must be inlined into the target-specific wrappers, otherwise
+    // all of them would call the same baseline code.  The
+    // first loop is free of loop-carried dependencies; the reduction
+    // happens in a separate loop with four partial sums, so that it
+    // vectorizes even without -ffast-math.
+    inline static double ANNEAL_ALWAYS_INLINE
+    pairwise_state_update_body(const double* RESTRICT e, const double* RESTRICT pi,
+                               double* RESTRICT sum, double* RESTRICT scratch,
+                               double e_j, double pi_j, int n)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            const double x = clamp_exponent(e_j - e[i]);
+
+            const double pi_t = pi[i] + pi_j;
+            const double a = pi_t / (1.0 + fast_exp(x));
+            scratch[i] = a;
+            sum[i] += pi_t - a;
+        }
+
+        double s0 = 0.0;
+        double s1 = 0.0;
+        double s2 = 0.0;
+        double s3 = 0.0;
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            s0 += scratch[i];
+            s1 += scratch[i + 1];
+            s2 += scratch[i + 2];
+            s3 += scratch[i + 3];
+        }
+        for (; i < n; ++i)
+        {
+            s0 += scratch[i];
+        }
+
+        return (s0 + s1) + (s2 + s3);
+    }
+
+
+    struct KernelTable
+    {
+        double (*pairwise_state_update)(const double*, const double*, double*, double*,
+                                        double, double, int);
+        const char* name;
+    };
+
+
+#define ANNEAL_DEFINE_KERNELS(m_suffix, m_attribute)                    \
+    m_attribute static double                                           \
+    pairwise_state_update_##m_suffix(const double* e, const double* pi, double* sum, \
+                                     double* scratch, double e_j, double pi_j, int n) \
+    {                                                                   \
+        return pairwise_state_update_body(e, pi, sum, scratch, e_j, pi_j, n); \
+    }                                                                   \
+                                                                        \
+    static const KernelTable kernels_##m_suffix = {                     \
+        pairwise_state_update_##m_suffix,                               \
+        #m_suffix                                                       \
+    };
+
+
+    ANNEAL_DEFINE_KERNELS(generic, )
+
+#ifdef ANNEAL_HAVE_AVX_KERNELS
+    ANNEAL_DEFINE_KERNELS(avx2, ANNEAL_TARGET_AVX2)
+    ANNEAL_DEFINE_KERNELS(avx512, ANNEAL_TARGET_AVX512)
+#endif
+
+#undef ANNEAL_DEFINE_KERNELS
+
+
+    inline static const KernelTable*
+    select_kernels()
+    {
+#ifdef ANNEAL_HAVE_AVX_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        {
+            return &kernels_avx512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            return &kernels_avx2;
+        }
+#endif
+
+        return &kernels_generic;
+    }
+
+
+    inline static const KernelTable&
+    kernels()
+    {
+        static const KernelTable* const table = select_kernels();
+        return *table;
+    }
+
+
+    double
+    pairwise_state_update(const double* e, const double* pi, double* sum,
+                          double* scratch, double e_j, double pi_j, int n)
+    {
+        return kernels().pairwise_state_update(e, pi, sum, scratch, e_j, pi_j, n);
+    }
+
+
+    const char*
+    instruction_set()
+    {
+        return kernels().name;
+    }
+} // namespace anneal
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2009-2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef ANNEAL_KERNELS_H_INCLUDED
+#define ANNEAL_KERNELS_H_INCLUDED
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+// Row kernel for the pairwise update of the state probabilities in
+// GDAConfiguration::calculateStateProbabilities() (anneal.h).  The
+// kernel replaces std::exp() with a polynomial approximation that
+// the compiler can vectorize.  As in skipsm_kernels.cc we select an
+// AVX2 or AVX-512 variant at runtime if the CPU supports it.
+
+namespace anneal
+{
+    // Given the energy e_j and the probability pi_j of state j,
+    // update all n states i > j at once:
+    //     pi_t     = pi[i] + pi_j
+    //     a[i]     = pi_t / (1 + exp(e_j - e[i]))
+    //     sum[i]  += pi_t - a[i]
+    // and answer the sum of all a[i], which is the contribution of
+    // the n states to state j.  The caller provides scratch space for
+    // n doubles.
+    //
+    // The relative error of the approximated exponential is below
+    // 1e-8.  Exponents with a magnitude beyond 40 are clamped, which
+    // changes a[i] by less than 1e-17 * pi_t.
+    double pairwise_state_update(const double* e, const double* pi, double* sum,
+                                 double* scratch, double e_j, double pi_j, int n);
+
+    // Answer the name of the instruction set the kernel uses.
+    const char* instruction_set();
+} // namespace anneal
+
+
+#endif // ANNEAL_KERNELS_H_INCLUDED
+
+// Local Variables:
+// mode: c++
+// End:
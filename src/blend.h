@@ -25,12 +25,20 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <vigra/combineimages.hxx>
+#include <vigra/copyimage.hxx>
+#include <vigra/initimage.hxx>
 #include <vigra/numerictraits.hxx>
 
+#include "rect2d.hxx"
+
 #include "fixmath.h"
+#include "pyramid.h"
 
 
 namespace enblend {
@@ -120,6 +128,211 @@ blend(std::vector<MaskPyramidType*>* maskGP,
     }
 }
 
+
+/** Copy the collapsed rows of a strip back into the black image.
+ *  The copy mask is the union of the black and the white alpha
+ *  channels, which is what the black alpha channel becomes once the
+ *  whole ROI has been blended.
+ */
+template <typename ImageType, typename AlphaType, typename ImagePyramidType,
+          int ImagePyramidIntegerBits, int ImagePyramidFractionBits>
+void
+copyStripFromPyramid(const ImagePyramidType* strip, int stripOffset,
+                     const vigra::Rect2D& stripBB,
+                     const AlphaType* whiteAlpha,
+                     ImageType* blackImage, const AlphaType* blackAlpha)
+{
+    typedef typename AlphaType::value_type AlphaPixelType;
+
+    AlphaType unionAlpha(stripBB.size());
+    vigra::copyImage(vigra_ext::apply(stripBB, srcImageRange(*blackAlpha)), destImage(unionAlpha));
+    vigra::initImageIf(destImageRange(unionAlpha),
+                       vigra_ext::apply(stripBB, maskImage(*whiteAlpha)),
+                       vigra::NumericTraits<AlphaPixelType>::max());
+
+    const vigra::Diff2D stripBegin(0, stripOffset);
+    const vigra::Diff2D stripEnd(stripBB.width(), stripOffset + stripBB.height());
+    copyFromPyramidImageIf<ImagePyramidType, AlphaType, ImageType,
+                           ImagePyramidIntegerBits, ImagePyramidFractionBits>
+        (vigra::srcIterRange(strip->upperLeft() + stripBegin, strip->upperLeft() + stripEnd, strip->accessor()),
+         maskImage(unionAlpha),
+         vigra_ext::apply(stripBB, destImage(*blackImage)));
+}
+
+
+/** Answer the height of the strips and the height of the halos
+ *  above and below them that blendStrips() uses for numLevels
+ *  pyramid levels when asked for strips of stripHeight rows.
+ *
+ *  Every strip and every halo is a multiple of the coarsest level's
+ *  sampling distance.  A strip must be at least as tall as the halo,
+ *  so that at most one strip is waiting for write-back.
+ */
+inline std::pair<int, int>
+blendStripGeometry(unsigned int numLevels, unsigned int stripHeight)
+{
+    const int alignment = 1 << (numLevels - 1);
+    const int halo =
+        ((static_cast<int>(filterHalfWidth(numLevels)) + alignment - 1) / alignment) * alignment;
+    const int height =
+        std::max(std::max(alignment, halo),
+                 ((static_cast<int>(stripHeight) + alignment - 1) / alignment) * alignment);
+
+    return std::make_pair(height, halo);
+}
+
+
+/** Blend the white image into the black image inside roiBB one
+ *  horizontal strip at a time.
+ *
+ *  Rather than building the mask, white, and black pyramids over the
+ *  whole ROI, we build them over one strip plus a halo of
+ *  filterHalfWidth(numLevels) rows above and below it, blend,
+ *  collapse, and keep only the rows of the strip itself.  All strips
+ *  start at multiples of 2^(numLevels - 1) relative to the ROI, so
+ *  each pyramid level samples exactly the same rows as it does for
+ *  the whole ROI, and the halo covers the combined support of all
+ *  reduce and expand steps.  Thus, the result is identical to
+ *  blending the whole ROI at once, but the pyramids only ever hold
+ *  roiBB.width() * (stripHeight + 2 * halo) pixels per level 0.
+ *
+ *  The black pyramid of the next strip reads black rows that belong
+ *  to the current strip, so we delay writing back a strip until its
+ *  successor's black pyramid has been built.  For the same reason the
+ *  caller must leave blackAlpha alone until we return; the write-back
+ *  uses the union of both alpha channels.  mask covers uBB, all other
+ *  images cover the input union.
+ */
+template <typename ImageType, typename AlphaType, typename MaskType,
+          typename ImagePyramidType, typename MaskPyramidType,
+          int ImagePyramidIntegerBits, int ImagePyramidFractionBits,
+          int MaskPyramidIntegerBits, int MaskPyramidFractionBits,
+          typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType, typename SKIPSMMaskPixelType>
+void
+blendStrips(unsigned int numLevels, bool wraparound, unsigned int stripHeight,
+            const vigra::Rect2D& roiBB, const vigra::Rect2D& uBB,
+            const MaskType* mask,
+            const ImageType* whiteImage, const AlphaType* whiteAlpha,
+            ImageType* blackImage, const AlphaType* blackAlpha)
+{
+    typedef typename MaskType::value_type MaskPixelType;
+    typedef typename MaskPyramidType::value_type MaskPyramidPixelType;
+
+    const std::pair<int, int> geometry = blendStripGeometry(numLevels, stripHeight);
+    const int height = geometry.first;
+    const int halo = geometry.second;
+
+    ConvertScalarToPyramidFunctor<MaskPixelType, MaskPyramidPixelType,
+                                  MaskPyramidIntegerBits, MaskPyramidFractionBits> whiteMask;
+    const MaskPyramidPixelType maskPyramidWhiteValue =
+        whiteMask(vigra::NumericTraits<MaskPixelType>::max());
+
+    if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+        std::cerr << command << ": info: blending in strips of " << height
+                  << " rows with a halo of " << halo << " rows" << std::endl;
+    }
+
+    ImagePyramidType* pendingStrip = nullptr;
+    int pendingOffset = 0;
+    vigra::Rect2D pendingBB;
+#ifdef DEBUG_EXPORT_PYRAMID
+    unsigned int stripNumber = 0U;
+#endif
+
+    for (int top = roiBB.top(); top < roiBB.bottom(); top += height) {
+        const vigra::Rect2D stripBB(roiBB.left(), top,
+                                    roiBB.right(), std::min(top + height, roiBB.bottom()));
+        const vigra::Rect2D haloBB(roiBB.left(), std::max(roiBB.top(), stripBB.top() - halo),
+                                   roiBB.right(), std::min(roiBB.bottom(), stripBB.bottom() + halo));
+        vigra::Rect2D haloBB_uBB(haloBB);
+        haloBB_uBB.moveBy(-uBB.upperLeft());
+
+        if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+            std::cerr << command << ": info: blending strip " << stripBB << std::endl;
+        }
+
+        std::vector<MaskPyramidType*>* maskGP =
+            gaussianPyramid<MaskType, MaskPyramidType,
+                            MaskPyramidIntegerBits, MaskPyramidFractionBits,
+                            SKIPSMMaskPixelType>(numLevels, wraparound,
+                                                 vigra_ext::apply(haloBB_uBB, srcImageRange(*mask)));
+#ifdef DEBUG_EXPORT_PYRAMID
+        // Each strip exports pyramids of its own, which cover the
+        // strip and its halos.
+        const std::string stripSuffix("_strip" + std::to_string(stripNumber++) + "_");
+        exportPyramid<SKIPSMMaskPixelType, MaskPyramidType>(maskGP, ("mask" + stripSuffix).c_str());
+#endif
+
+        std::vector<ImagePyramidType*>* whiteLP =
+            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
+                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+            ("whiteGP",
+             numLevels, wraparound,
+             vigra_ext::apply(haloBB, srcImageRange(*whiteImage)),
+             vigra_ext::apply(haloBB, maskImage(*whiteAlpha)));
+
+        std::vector<ImagePyramidType*>* blackLP =
+            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
+                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+            ("blackGP",
+             numLevels, wraparound,
+             vigra_ext::apply(haloBB, srcImageRange(*blackImage)),
+             vigra_ext::apply(haloBB, maskImage(*blackAlpha)));
+#ifdef DEBUG_EXPORT_PYRAMID
+        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, ("enblend_black_lp" + stripSuffix).c_str());
+#endif
+
+        // The black halo of this strip has been read; it is now safe
+        // to overwrite the rows of the previous strip.
+        if (pendingStrip != nullptr) {
+            copyStripFromPyramid<ImageType, AlphaType, ImagePyramidType,
+                                 ImagePyramidIntegerBits, ImagePyramidFractionBits>
+                (pendingStrip, pendingOffset, pendingBB, whiteAlpha, blackImage, blackAlpha);
+            delete pendingStrip;
+        }
+
+        blend(maskGP, whiteLP, blackLP, maskPyramidWhiteValue);
+
+#ifdef DEBUG_EXPORT_PYRAMID
+        exportPyramid<SKIPSMMaskPixelType, MaskPyramidType>(maskGP, ("enblend_mask_gp" + stripSuffix).c_str());
+#endif
+        for (unsigned int i = 0; i < maskGP->size(); i++) {
+            delete (*maskGP)[i];
+        }
+        delete maskGP;
+#ifdef DEBUG_EXPORT_PYRAMID
+        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(whiteLP, ("enblend_white_lp" + stripSuffix).c_str());
+#endif
+        for (unsigned int i = 0; i < whiteLP->size(); i++) {
+            delete (*whiteLP)[i];
+        }
+        delete whiteLP;
+
+#ifdef DEBUG_EXPORT_PYRAMID
+        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, ("enblend_blend_lp" + stripSuffix).c_str());
+#endif
+
+        collapsePyramid<SKIPSMImagePixelType>(wraparound, blackLP);
+
+        pendingStrip = (*blackLP)[0];
+        pendingOffset = stripBB.top() - haloBB.top();
+        pendingBB = stripBB;
+        for (unsigned int i = 1; i < blackLP->size(); i++) {
+            delete (*blackLP)[i];
+        }
+        delete blackLP;
+    }
+
+    if (pendingStrip != nullptr) {
+        copyStripFromPyramid<ImageType, AlphaType, ImagePyramidType,
+                             ImagePyramidIntegerBits, ImagePyramidFractionBits>
+            (pendingStrip, pendingOffset, pendingBB, whiteAlpha, blackImage, blackAlpha);
+        delete pendingStrip;
+    }
+}
+
 } // namespace enblend
 
 #endif /* __BLEND_H__ */
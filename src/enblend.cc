@@ -213,6 +213,35 @@ namespace GPU {
 #endif
 
 
+// Parameter handles the headers declare, one instance per key.
+namespace enblend {
+    parameter::handle<bool> annealFastExp("anneal-fast-exp", false);
+    parameter::handle<bool> timeStateProbabilities("time-state-probabilities", false);
+    parameter::handle<bool> timeAnnealSnake("time-anneal-snake", false);
+#ifdef OPENCL
+    parameter::handle<bool> gpuKernelAnneal("gpu-kernel-anneal", true);
+#endif
+    parameter::handle<bool> debugPath("debug-path", false);
+    parameter::handle<bool> debugPathCompare("debug-path-compare", false);
+    parameter::handle<bool> markFreakyColorConversions("mark-freaky-color-conversions", false);
+    parameter::handle<bool> graphcutScanlineFill("graphcut-scanline-fill", false);
+    parameter::handle<bool> nativePeriodicDistanceTransform("periodic-distance-transform", true);
+}
+
+namespace vigra {
+    namespace omp {
+        parameter::handle<bool> tiledDistanceTransform("tiled-distance-transform", true);
+    }
+}
+
+#ifdef OPENCL
+namespace ocl {
+    parameter::handle<bool> forceOpenCLAnnealFloat("force-opencl-anneal-float", false);
+    parameter::handle<bool> profileStateProbabilities("profile-state-probabilities", false);
+}
+#endif
+
+
 difference_functor_t
 differenceFunctorOfString(const std::string& aDifferenceFunctorName)
 {
@@ -288,7 +317,9 @@ void dump_global_variables(const char* file, unsigned line,
         "+ }, arguments to option \"--mask-vectorize\"\n" <<
         "+ OutputCompression = <" << OutputCompression << ">, option \"--compression\"\n" <<
         "+ OutputPixelType = <" << OutputPixelType << ">, option \"--depth\"\n" <<
-        "+ end of global variable dump\n";
+        "+ parameter handles\n";
+    parameter::dump_handles(out);
+    out << "+ end of global variable dump\n";
 }
 
 
@@ -27,6 +27,7 @@
 
 #include <iostream>
 #include <list>
+#include <map>
 
 #include <vigra/impex.hxx>
 #include <vigra/initimage.hxx>
@@ -51,15 +52,26 @@
 
 namespace enblend {
 
-/** Enblend's main blending loop. Templatized to handle different image types.
+/** Blend the white image into the black image inside of the region
+ *  of interest roiBB, guided by mask, which covers uBB.
+ *
+ *  The function takes ownership of the mask and of the white image
+ *  and its alpha channel, and deletes them.  On return, the black
+ *  image holds the blended result and the black alpha channel is the
+ *  union of both alpha channels.
  */
 template <typename ImagePixelType>
-void enblendMain(const FileNameList& anInputFileNameList,
-                 const std::list<vigra::ImageImportInfo*>& anImageInfoList,
-                 vigra::ImageExportInfo& anOutputImageInfo,
-                 vigra::Rect2D& anInputUnion)
+void
+blendImagePair(const vigra::Rect2D& anInputUnion,
+               std::pair<typename EnblendNumericTraits<ImagePixelType>::ImageType*,
+                         typename EnblendNumericTraits<ImagePixelType>::AlphaType*>& blackPair,
+               std::pair<typename EnblendNumericTraits<ImagePixelType>::ImageType*,
+                         typename EnblendNumericTraits<ImagePixelType>::AlphaType*>& whitePair,
+               typename EnblendNumericTraits<ImagePixelType>::MaskType* mask,
+               const vigra::Rect2D& whiteBB, const vigra::Rect2D& uBB, const vigra::Rect2D& roiBB,
+               unsigned int numLevels, bool wraparoundForBlend,
+               unsigned int blendStripHeight)
 {
-    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType ImagePixelComponentType;
     typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
     typedef typename EnblendNumericTraits<ImagePixelType>::AlphaPixelType AlphaPixelType;
     typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
@@ -78,11 +90,504 @@ void enblendMain(const FileNameList& anInputFileNameList,
     typedef typename EnblendNumericTraits<ImagePixelType>::SKIPSMAlphaPixelType SKIPSMAlphaPixelType;
     typedef typename EnblendNumericTraits<ImagePixelType>::SKIPSMMaskPixelType SKIPSMMaskPixelType;
 
+    // Estimate memory requirements for this blend iteration
+    if (Verbose >= VERBOSE_MEMORY_ESTIMATION_MESSAGES) {
+        // Maximum utilization is when all three pyramids have been built
+        // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
+        //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
+        // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+        //      + (4/3)*roiBB*MaskPyramidType
+        //      + 2*(4/3)*roiBB*ImagePyramidType
+        // In strip mode the pyramids cover one strip plus its halos,
+        // but the mask and the collapsed previous strip stay alive.
+        long long pyramidArea = roiBB.area();
+        long long stripBytes = 0;
+        if (blendStripHeight != 0U) {
+            const std::pair<int, int> geometry = blendStripGeometry(numLevels, blendStripHeight);
+            pyramidArea = static_cast<long long>(roiBB.width()) *
+                std::min(roiBB.height(), geometry.first + 2 * geometry.second);
+            stripBytes =
+                uBB.area() * sizeof(MaskPixelType)
+                + pyramidArea * sizeof(ImagePyramidPixelType);
+        }
+        long long bytes =
+            anInputUnion.area() * (sizeof(ImagePixelType) + 2 * sizeof(AlphaPixelType))
+            + (4/3) * pyramidArea * (sizeof(MaskPyramidPixelType)
+                                     + 2 * sizeof(ImagePyramidPixelType))
+            + (4 * roiBB.width()) * (sizeof(SKIPSMImagePixelType)
+                                     + sizeof(SKIPSMAlphaPixelType))
+            + stripBytes;
+
+        std::cerr << command << ": info: estimated space required for this blend step: "
+                  << static_cast<int>(ceil(bytes / 1000000.0))
+                  << "MB" << std::endl;
+    }
+
+    if (blendStripHeight != 0U) {
+        blendStrips<ImageType, AlphaType, MaskType, ImagePyramidType, MaskPyramidType,
+                    ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                    MaskPyramidIntegerBits, MaskPyramidFractionBits,
+                    SKIPSMImagePixelType, SKIPSMAlphaPixelType, SKIPSMMaskPixelType>
+            (numLevels, wraparoundForBlend, blendStripHeight,
+             roiBB, uBB, mask,
+             whitePair.first, whitePair.second,
+             blackPair.first, blackPair.second);
+
+        // The ROI is done.  Copy pixels where the white image
+        // contributes outside of the ROI and merge the alpha
+        // channels just like the whole-ROI path below does.
+        vigra::Rect2D roiBB_uBB = roiBB;
+        roiBB_uBB.moveBy(-uBB.upperLeft());
+        vigra::initImage(vigra_ext::apply(roiBB_uBB, destImageRange(*mask)),
+                         vigra::NumericTraits<MaskPyramidPixelType>::zero());
+        vigra::copyImageIf(vigra_ext::apply(uBB, srcImageRange(*(whitePair.first))),
+                           maskImage(*mask),
+                           vigra_ext::apply(uBB, destImage(*(blackPair.first))));
+        vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
+                           vigra_ext::apply(whiteBB, maskImage(*(whitePair.second))),
+                           vigra::NumericTraits<AlphaPixelType>::max());
+
+        delete mask;
+        delete whitePair.first;
+        delete whitePair.second;
+
+        return;
+    }
+
+    // Create a version of roiBB relative to uBB upperleft corner.
+    // This is to access roi within images of size uBB.
+    // For example, the mask.
+    vigra::Rect2D roiBB_uBB = roiBB;
+    roiBB_uBB.moveBy(-uBB.upperLeft());
+
+    // Build Gaussian pyramid from mask.
+    std::vector<MaskPyramidType*> *maskGP =
+        gaussianPyramid<MaskType, MaskPyramidType,
+                        MaskPyramidIntegerBits, MaskPyramidFractionBits,
+                        SKIPSMMaskPixelType>(numLevels, wraparoundForBlend,
+                                             vigra_ext::apply(roiBB_uBB, srcImageRange(*mask)));
+#ifdef DEBUG_EXPORT_PYRAMID
+    exportPyramid<SKIPSMMaskPixelType, MaskPyramidType>(maskGP, "mask");
+#endif
+
+    // mem usage before = MaskType*ubb + 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+    // mem usage xsection = 3 * roiBB.width * MaskPyramidType
+    // mem usage after = MaskType*ubb + 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+    //                   + (4/3)*roiBB*MaskPyramidType
+
+    // Now it is safe to make changes to mask image.
+    // Black out the ROI in the mask.
+    // Make an roiBounds relative to uBB origin.
+    vigra::initImage(vigra_ext::apply(roiBB_uBB, destImageRange(*mask)),
+                     vigra::NumericTraits<MaskPyramidPixelType>::zero());
+
+    // Copy pixels inside whiteBB and inside white part of mask into black image.
+    // These are pixels where the white image contributes outside of the ROI.
+    // We cannot modify black image inside the ROI yet because we haven't built the
+    // black pyramid.
+    vigra::copyImageIf(vigra_ext::apply(uBB, srcImageRange(*(whitePair.first))),
+                       maskImage(*mask),
+                       vigra_ext::apply(uBB, destImage(*(blackPair.first))));
+
+    // We no longer need the mask.
+    delete mask;
+    // mem usage after = 2*anInputUnion*ImageValueType +
+    //                   2*anInputUnion*AlphaValueType +
+    //                   (4/3)*roiBB*MaskPyramidType
+
+    // Build Laplacian pyramid from white image.
+    std::vector<ImagePyramidType*>* whiteLP =
+        laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
+                         ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                         SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+        ("whiteGP",
+         numLevels, wraparoundForBlend,
+         vigra_ext::apply(roiBB, srcImageRange(*(whitePair.first))),
+         vigra_ext::apply(roiBB, maskImage(*(whitePair.second))));
+
+    // mem usage after = 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+    //                   + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
+    // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
+    //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
+
+    // We no longer need the white rgb data.
+    delete whitePair.first;
+    // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+    //                   + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
+
+    // Build Laplacian pyramid from black image.
+    std::vector<ImagePyramidType*>* blackLP =
+        laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
+                         ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                         SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+        ("blackGP",
+         numLevels, wraparoundForBlend,
+         vigra_ext::apply(roiBB, srcImageRange(*(blackPair.first))),
+         vigra_ext::apply(roiBB, maskImage(*(blackPair.second))));
+
+#ifdef DEBUG_EXPORT_PYRAMID
+    exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, "enblend_black_lp");
+#endif
+
+    // Peak memory xsection is here!
+    // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
+    //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
+    // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+    //      + (4/3)*roiBB*MaskPyramidType
+    //      + 2*(4/3)*roiBB*ImagePyramidType
+
+    // Make the black image alpha equal to the union of the
+    // white and black alpha channels.
+    vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
+                       vigra_ext::apply(whiteBB, maskImage(*(whitePair.second))),
+                       vigra::NumericTraits<AlphaPixelType>::max());
+
+    // We no longer need the white alpha data.
+    delete whitePair.second;
+
+    // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
+    //      + (4/3)*roiBB*MaskPyramidType + 2*(4/3)*roiBB*ImagePyramidType
+
+    // Blend pyramids
+    ConvertScalarToPyramidFunctor<MaskPixelType, MaskPyramidPixelType,
+                                  MaskPyramidIntegerBits, MaskPyramidFractionBits> whiteMask;
+    blend(maskGP, whiteLP, blackLP, whiteMask(vigra::NumericTraits<MaskPixelType>::max()));
+
+    // delete mask pyramid
+#ifdef DEBUG_EXPORT_PYRAMID
+    exportPyramid<SKIPSMMaskPixelType, MaskPyramidType>(maskGP, "enblend_mask_gp");
+#endif
+    for (unsigned int i = 0; i < maskGP->size(); i++) {
+        delete (*maskGP)[i];
+    }
+    delete maskGP;
+
+    // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType + 2*(4/3)*roiBB*ImagePyramidType
+
+    // delete white pyramid
+#ifdef DEBUG_EXPORT_PYRAMID
+    exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(whiteLP, "enblend_white_lp");
+#endif
+    for (unsigned int i = 0; i < whiteLP->size(); i++) {
+        delete (*whiteLP)[i];
+    }
+    delete whiteLP;
+
+    // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType + (4/3)*roiBB*ImagePyramidType
+
+#ifdef DEBUG_EXPORT_PYRAMID
+    exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, "enblend_blend_lp");
+#endif
+
+    // collapse black pyramid
+    collapsePyramid<SKIPSMImagePixelType>(wraparoundForBlend, blackLP);
+
+    // copy collapsed black pyramid into black image ROI, using black alpha mask.
+    copyFromPyramidImageIf<ImagePyramidType, MaskType, ImageType,
+                           ImagePyramidIntegerBits, ImagePyramidFractionBits>
+        (srcImageRange(*((*blackLP)[0])),
+         vigra_ext::apply(roiBB, maskImage(*(blackPair.second))),
+         vigra_ext::apply(roiBB, destImage(*(blackPair.first))));
+
+    // delete black pyramid
+    for (unsigned int i = 0; i < blackLP->size(); i++) {
+        delete (*blackLP)[i];
+    }
+    delete blackLP;
+
+    // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
+}
+
+
+/** A node of the merge tree of blendTree(): an image and its alpha
+ *  channel, both cropped to their bounding box bb, which we give in
+ *  the coordinates of the input union.  The index is the position
+ *  of the node's first input image among all inputs, no matter how
+ *  many images pre-assembly has put into the node.
+ */
+template <typename ImageType, typename AlphaType>
+struct BlendTreeNode
+{
+    ImageType* image;
+    AlphaType* alpha;
+    vigra::Rect2D bb;
+    unsigned index;
+};
+
+
+/** Blend the nodes black and white of the merge tree and answer the
+ *  new node.  Delete both input nodes.
+ *
+ *  We copy both nodes onto canvases that just cover their union and
+ *  run the same steps as the sequential loop of enblendMain() on them
+ *  in the canvases' coordinates.  As every pair owns its canvases,
+ *  pairs do not interfere with each other.
+ */
+template <typename ImagePixelType>
+BlendTreeNode<typename EnblendNumericTraits<ImagePixelType>::ImageType,
+              typename EnblendNumericTraits<ImagePixelType>::AlphaType>
+blendTreePair(const vigra::Rect2D& anInputUnion,
+              const BlendTreeNode<typename EnblendNumericTraits<ImagePixelType>::ImageType,
+                                  typename EnblendNumericTraits<ImagePixelType>::AlphaType>& black,
+              const BlendTreeNode<typename EnblendNumericTraits<ImagePixelType>::ImageType,
+                                  typename EnblendNumericTraits<ImagePixelType>::AlphaType>& white,
+              unsigned numberOfImages,
+              FileNameList::const_iterator inputFileNameIterator,
+              unsigned m,
+              unsigned int blendStripHeight)
+{
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType ImagePixelComponentType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::MaskType MaskType;
+    typedef BlendTreeNode<ImageType, AlphaType> Node;
+
+    const vigra::Rect2D uBB = black.bb | white.bb;
+    const vigra::Rect2D canvasBB(vigra::Point2D(0, 0), uBB.size());
+    vigra::Rect2D blackBB(black.bb);
+    blackBB.moveBy(-uBB.upperLeft());
+    vigra::Rect2D whiteBB(white.bb);
+    whiteBB.moveBy(-uBB.upperLeft());
+
+    std::pair<ImageType*, AlphaType*> blackPair(new ImageType(uBB.size()), new AlphaType(uBB.size()));
+    std::pair<ImageType*, AlphaType*> whitePair(new ImageType(uBB.size()), new AlphaType(uBB.size()));
+
+    vigra::copyImage(srcImageRange(*black.image), vigra_ext::apply(blackBB, destImage(*blackPair.first)));
+    vigra::copyImage(srcImageRange(*black.alpha), vigra_ext::apply(blackBB, destImage(*blackPair.second)));
+    vigra::copyImage(srcImageRange(*white.image), vigra_ext::apply(whiteBB, destImage(*whitePair.first)));
+    vigra::copyImage(srcImageRange(*white.alpha), vigra_ext::apply(whiteBB, destImage(*whitePair.second)));
+    delete black.image;
+    delete black.alpha;
+    delete white.image;
+    delete white.alpha;
+
+    const vigra::Rect2D iBB = blackBB & whiteBB;
+    const Overlap overlap = inspectOverlap(srcImageRange(*blackPair.second), srcImage(*whitePair.second));
+
+    if (overlap == CompleteOverlap) {
+        std::cerr << command << ": warning: some images are redundant and will not be blended" << std::endl;
+        delete whitePair.first;
+        delete whitePair.second;
+    } else if (overlap == NoOverlap && ExactLevels == 0) {
+        vigra::copyImageIf(srcImageRange(*whitePair.first), maskImage(*whitePair.second),
+                           destImage(*blackPair.first));
+        vigra::copyImageIf(srcImageRange(*whitePair.second), maskImage(*whitePair.second),
+                           destImage(*blackPair.second));
+        delete whitePair.first;
+        delete whitePair.second;
+    } else {
+        const bool wraparoundForMask =
+            WrapAround != OpenBoundaries &&
+            uBB.width() == anInputUnion.width();
+
+        MaskType* mask =
+            createMask<ImageType, AlphaType, MaskType>(whitePair.first, blackPair.first,
+                                                       whitePair.second, blackPair.second,
+                                                       canvasBB, iBB, wraparoundForMask,
+                                                       numberOfImages,
+                                                       inputFileNameIterator, m);
+
+        vigra::Rect2D mBB;
+        maskBounds(mask, canvasBB, mBB);
+
+        vigra::Rect2D roiBB;
+        const unsigned int numLevels =
+            roiBounds<ImagePixelComponentType>(anInputUnion,
+                                               iBB, mBB, canvasBB, roiBB,
+                                               wraparoundForMask);
+        const bool wraparoundForBlend =
+            WrapAround != OpenBoundaries &&
+            roiBB.width() == anInputUnion.width();
+
+        blendImagePair<ImagePixelType>(anInputUnion,
+                                       blackPair, whitePair, mask,
+                                       whiteBB, canvasBB, roiBB,
+                                       numLevels, wraparoundForBlend,
+                                       blendStripHeight);
+    }
+
+    Node result;
+    result.image = blackPair.first;
+    result.alpha = blackPair.second;
+    result.bb = uBB;
+    result.index = black.index;
+
+    return result;
+}
+
+
+/** Blend all images of imageInfoList along a balanced merge tree
+ *  instead of one after the other.
+ *
+ *  In each round we pair every node with the next unpaired node that
+ *  it overlaps and blend all pairs of the round concurrently.  Thus,
+ *  N images need about log2(N) dependent blend steps instead of
+ *  N - 1.  All images are in memory at the same time, though cropped
+ *  to their bounding boxes.  Answer the result on a canvas of the
+ *  size of the input union and its bounding box in resultBB.
+ *
+ *  Pairing only intersects the bounding boxes and ignores
+ *  wrap-around: two images that overlap only across the left and
+ *  right edges of a 360-degree panorama do not form a pair.  They
+ *  still get blended once later rounds have merged them into larger
+ *  nodes.
+ */
+template <typename ImagePixelType>
+std::pair<typename EnblendNumericTraits<ImagePixelType>::ImageType*,
+          typename EnblendNumericTraits<ImagePixelType>::AlphaType*>
+blendTree(const FileNameList& anInputFileNameList,
+          std::list<vigra::ImageImportInfo*>& imageInfoList,
+          const vigra::Rect2D& anInputUnion,
+          vigra::Rect2D& resultBB,
+          unsigned int blendStripHeight)
+{
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
+    typedef BlendTreeNode<ImageType, AlphaType> Node;
+
+    const unsigned numberOfImages = imageInfoList.size();
+    std::vector<Node> nodes;
+
+    // assemble() removes the images it uses from imageInfoList, so
+    // remember where each image stood.
+    std::map<const vigra::ImageImportInfo*, unsigned> inputPosition;
+    for (std::list<vigra::ImageImportInfo*>::const_iterator i = imageInfoList.begin(); i != imageInfoList.end(); ++i) {
+        inputPosition.insert(std::make_pair(*i, static_cast<unsigned>(inputPosition.size())));
+    }
+
+    while (!imageInfoList.empty()) {
+        Node node;
+        node.index = inputPosition[imageInfoList.front()];
+        std::pair<ImageType*, AlphaType*> canvas =
+            assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, node.bb);
+
+        node.image = new ImageType(node.bb.size());
+        node.alpha = new AlphaType(node.bb.size());
+        vigra::copyImage(vigra_ext::apply(node.bb, srcImageRange(*canvas.first)), destImage(*node.image));
+        vigra::copyImage(vigra_ext::apply(node.bb, srcImageRange(*canvas.second)), destImage(*node.alpha));
+        delete canvas.first;
+        delete canvas.second;
+
+        nodes.push_back(node);
+    }
+
+    while (nodes.size() > 1) {
+        std::vector<std::pair<size_t, size_t> > pairs;
+        std::vector<bool> paired(nodes.size(), false);
+
+        for (size_t i = 0; i != nodes.size(); ++i) {
+            for (size_t j = i + 1; !paired[i] && j != nodes.size(); ++j) {
+                if (!paired[j] && !(nodes[i].bb & nodes[j].bb).isEmpty()) {
+                    pairs.push_back(std::make_pair(i, j));
+                    paired[i] = paired[j] = true;
+                }
+            }
+        }
+        if (pairs.empty()) {
+            // No two nodes overlap; combine the first two without blending.
+            pairs.push_back(std::make_pair(size_t(0), size_t(1)));
+            paired[0] = paired[1] = true;
+        }
+
+        if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+            std::cerr << command << ": info: blend tree: blending " << pairs.size() << " pair" <<
+                (pairs.size() >= 2 ? "s" : "") << " of " << nodes.size() << " images" << std::endl;
+        }
+
+        std::vector<Node> merged(pairs.size());
+
+        bool concurrently = pairs.size() >= 2;
+#ifdef OPENCL
+        // createMask() uses the process-wide OpenCL kernels, which
+        // concurrent pairs must not share.
+        if (GPUContext) {
+            concurrently = false;
+        }
+#endif
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) if (concurrently)
+#endif
+        for (int k = 0; k < static_cast<int>(pairs.size()); ++k) {
+            const Node& black = nodes[pairs[k].first];
+            const Node& white = nodes[pairs[k].second];
+
+            // Name the masks just like the sequential loop without
+            // pre-assembly would when it blends in the first input of
+            // white.
+            FileNameList::const_iterator inputFileNameIterator(anInputFileNameList.begin());
+            std::advance(inputFileNameIterator, white.index - 1);
+
+            merged[k] = blendTreePair<ImagePixelType>(anInputUnion, black, white,
+                                                      numberOfImages, inputFileNameIterator, white.index - 1,
+                                                      blendStripHeight);
+        }
+
+        // Keep the merged nodes in the places of their black nodes,
+        // so that the input order carries through all rounds.
+        std::vector<Node> next;
+        size_t k = 0;
+        for (size_t i = 0; i != nodes.size(); ++i) {
+            if (k != pairs.size() && pairs[k].first == i) {
+                next.push_back(merged[k]);
+                ++k;
+            } else if (!paired[i]) {
+                next.push_back(nodes[i]);
+            }
+        }
+        nodes.swap(next);
+    }
+
+    const Node& root = nodes.front();
+    std::pair<ImageType*, AlphaType*> result(new ImageType(anInputUnion.size()),
+                                             new AlphaType(anInputUnion.size()));
+    vigra::copyImage(srcImageRange(*root.image), vigra_ext::apply(root.bb, destImage(*result.first)));
+    vigra::copyImage(srcImageRange(*root.alpha), vigra_ext::apply(root.bb, destImage(*result.second)));
+    delete root.image;
+    delete root.alpha;
+
+    resultBB = root.bb;
+
+    return result;
+}
+
+
+/** Enblend's main blending loop. Templatized to handle different image types.
+ */
+template <typename ImagePixelType>
+void enblendMain(const FileNameList& anInputFileNameList,
+                 const std::list<vigra::ImageImportInfo*>& anImageInfoList,
+                 vigra::ImageExportInfo& anOutputImageInfo,
+                 vigra::Rect2D& anInputUnion)
+{
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImagePixelComponentType ImagePixelComponentType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::ImageType ImageType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::AlphaPixelType AlphaPixelType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::AlphaType AlphaType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::MaskPixelType MaskPixelType;
+    typedef typename EnblendNumericTraits<ImagePixelType>::MaskType MaskType;
+
     std::list<vigra::ImageImportInfo*> imageInfoList(anImageInfoList);
 
-    // Create the initial black image.
+    // Zero means that we build all pyramids over the whole ROI.
+    const unsigned int blendStripHeight = parameter::as_unsigned("blend-strip-height", 0U);
+
+    // Loading and saving masks as well as stopping after mask
+    // generation rely on the sequential order of the blend steps.
+    const bool useBlendTree = parameter::as_boolean("blend-tree", false);
+    const bool sequentialOnly = LoadMasks || SaveMasks || StopAfterMaskGeneration;
+    if (useBlendTree && sequentialOnly) {
+        std::cerr << command << ": warning: cannot blend along a merge tree when loading or saving masks\n"
+                  << command << ": warning: or when stopping after mask generation;\n"
+                  << command << ": warning: blending images one after the other" << std::endl;
+    }
+
+    // Create the initial black image.  In merge-tree mode this already
+    // is the final result.
     vigra::Rect2D blackBB;
     std::pair<ImageType*, AlphaType*> blackPair =
+        useBlendTree && !sequentialOnly ?
+        blendTree<ImagePixelType>(anInputFileNameList, imageInfoList, anInputUnion, blackBB, blendStripHeight) :
         assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, blackBB);
 
     if (Checkpoint) {
@@ -354,168 +859,11 @@ void enblendMain(const FileNameList& anInputFileNameList,
             continue;
         }
 
-        // Estimate memory requirements for this blend iteration
-        if (Verbose >= VERBOSE_MEMORY_ESTIMATION_MESSAGES) {
-            // Maximum utilization is when all three pyramids have been built
-            // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
-            //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
-            // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-            //      + (4/3)*roiBB*MaskPyramidType
-            //      + 2*(4/3)*roiBB*ImagePyramidType
-            long long bytes =
-                anInputUnion.area() * (sizeof(ImagePixelType) + 2 * sizeof(AlphaPixelType))
-                + (4/3) * roiBB.area() * (sizeof(MaskPyramidPixelType)
-                                          + 2 * sizeof(ImagePyramidPixelType))
-                + (4 * roiBB.width()) * (sizeof(SKIPSMImagePixelType)
-                                         + sizeof(SKIPSMAlphaPixelType));
-
-            std::cerr << command << ": info: estimated space required for this blend step: "
-                      << static_cast<int>(ceil(bytes / 1000000.0))
-                      << "MB" << std::endl;
-        }
-
-        // Create a version of roiBB relative to uBB upperleft corner.
-        // This is to access roi within images of size uBB.
-        // For example, the mask.
-        vigra::Rect2D roiBB_uBB = roiBB;
-        roiBB_uBB.moveBy(-uBB.upperLeft());
-
-        // Build Gaussian pyramid from mask.
-        std::vector<MaskPyramidType*> *maskGP =
-            gaussianPyramid<MaskType, MaskPyramidType,
-                            MaskPyramidIntegerBits, MaskPyramidFractionBits,
-                            SKIPSMMaskPixelType>(numLevels, wraparoundForBlend,
-                                                 vigra_ext::apply(roiBB_uBB, srcImageRange(*mask)));
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMMaskPixelType, MaskPyramidType>(maskGP, "mask");
-#endif
-
-        // mem usage before = MaskType*ubb + 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        // mem usage xsection = 3 * roiBB.width * MaskPyramidType
-        // mem usage after = MaskType*ubb + 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //                   + (4/3)*roiBB*MaskPyramidType
-
-        // Now it is safe to make changes to mask image.
-        // Black out the ROI in the mask.
-        // Make an roiBounds relative to uBB origin.
-        vigra::initImage(vigra_ext::apply(roiBB_uBB, destImageRange(*mask)),
-                         vigra::NumericTraits<MaskPyramidPixelType>::zero());
-
-        // Copy pixels inside whiteBB and inside white part of mask into black image.
-        // These are pixels where the white image contributes outside of the ROI.
-        // We cannot modify black image inside the ROI yet because we haven't built the
-        // black pyramid.
-        vigra::copyImageIf(vigra_ext::apply(uBB, srcImageRange(*(whitePair.first))),
-                           maskImage(*mask),
-                           vigra_ext::apply(uBB, destImage(*(blackPair.first))));
-
-        // We no longer need the mask.
-        delete mask;
-        // mem usage after = 2*anInputUnion*ImageValueType +
-        //                   2*anInputUnion*AlphaValueType +
-        //                   (4/3)*roiBB*MaskPyramidType
-
-        // Build Laplacian pyramid from white image.
-        std::vector<ImagePyramidType*>* whiteLP =
-            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
-                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
-                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>
-            ("whiteGP",
-             numLevels, wraparoundForBlend,
-             vigra_ext::apply(roiBB, srcImageRange(*(whitePair.first))),
-             vigra_ext::apply(roiBB, maskImage(*(whitePair.second))));
-
-        // mem usage after = 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //                   + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
-        // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
-        //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
-
-        // We no longer need the white rgb data.
-        delete whitePair.first;
-        // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //                   + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
-
-        // Build Laplacian pyramid from black image.
-        std::vector<ImagePyramidType*>* blackLP =
-            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
-                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
-                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>
-            ("blackGP",
-             numLevels, wraparoundForBlend,
-             vigra_ext::apply(roiBB, srcImageRange(*(blackPair.first))),
-             vigra_ext::apply(roiBB, maskImage(*(blackPair.second))));
-
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, "enblend_black_lp");
-#endif
-
-        // Peak memory xsection is here!
-        // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
-        //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
-        // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //      + (4/3)*roiBB*MaskPyramidType
-        //      + 2*(4/3)*roiBB*ImagePyramidType
-
-        // Make the black image alpha equal to the union of the
-        // white and black alpha channels.
-        vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
-                           vigra_ext::apply(whiteBB, maskImage(*(whitePair.second))),
-                           vigra::NumericTraits<AlphaPixelType>::max());
-
-        // We no longer need the white alpha data.
-        delete whitePair.second;
-
-        // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
-        //      + (4/3)*roiBB*MaskPyramidType + 2*(4/3)*roiBB*ImagePyramidType
-
-        // Blend pyramids
-        ConvertScalarToPyramidFunctor<MaskPixelType, MaskPyramidPixelType,
-                                      MaskPyramidIntegerBits, MaskPyramidFractionBits> whiteMask;
-        blend(maskGP, whiteLP, blackLP, whiteMask(vigra::NumericTraits<MaskPixelType>::max()));
-
-        // delete mask pyramid
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMMaskPixelType, MaskPyramidType>(maskGP, "enblend_mask_gp");
-#endif
-        for (unsigned int i = 0; i < maskGP->size(); i++) {
-            delete (*maskGP)[i];
-        }
-        delete maskGP;
-
-        // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType + 2*(4/3)*roiBB*ImagePyramidType
-
-        // delete white pyramid
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(whiteLP, "enblend_white_lp");
-#endif
-        for (unsigned int i = 0; i < whiteLP->size(); i++) {
-            delete (*whiteLP)[i];
-        }
-        delete whiteLP;
-
-        // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType + (4/3)*roiBB*ImagePyramidType
-
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, "enblend_blend_lp");
-#endif
-
-        // collapse black pyramid
-        collapsePyramid<SKIPSMImagePixelType>(wraparoundForBlend, blackLP);
-
-        // copy collapsed black pyramid into black image ROI, using black alpha mask.
-        copyFromPyramidImageIf<ImagePyramidType, MaskType, ImageType,
-                               ImagePyramidIntegerBits, ImagePyramidFractionBits>
-            (srcImageRange(*((*blackLP)[0])),
-             vigra_ext::apply(roiBB, maskImage(*(blackPair.second))),
-             vigra_ext::apply(roiBB, destImage(*(blackPair.first))));
-
-        // delete black pyramid
-        for (unsigned int i = 0; i < blackLP->size(); i++) {
-            delete (*blackLP)[i];
-        }
-        delete blackLP;
-
-        // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
+        blendImagePair<ImagePixelType>(anInputUnion,
+                                       blackPair, whitePair, mask,
+                                       whiteBB, uBB, roiBB,
+                                       numLevels, wraparoundForBlend,
+                                       blendStripHeight);
 
         // Checkpoint results.
         if (Checkpoint) {
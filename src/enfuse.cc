@@ -196,6 +196,21 @@ LayerSelectionHost LayerSelection;
 #endif
 
 
+// Parameter handles the headers declare, one instance per key.
+namespace enblend {
+    parameter::handle<bool> markFreakyColorConversions("mark-freaky-color-conversions", false);
+    parameter::handle<bool> fusedWeights("fused-weights", true);
+    parameter::handle<bool> exposureWeightTable("exposure-weight-table", true);
+    parameter::handle<bool> hardMaskLabelsEnabled("hard-mask-labels", true);
+}
+
+namespace vigra {
+    namespace omp {
+        parameter::handle<bool> tiledDistanceTransform("tiled-distance-transform", true);
+    }
+}
+
+
 // Initialize data structures for precomputed entropy and logarithm.
 template <typename InputPixelType, typename ResultPixelType>
 size_t enblend::Histogram<InputPixelType, ResultPixelType>::precomputedSize = 0;
@@ -284,7 +299,9 @@ void dump_global_variables(const char* file, unsigned line,
         ">, second argument to option \"--save-masks\"\n" <<
         "+ OutputCompression = <" << OutputCompression << ">, option \"--compression\"\n" <<
         "+ OutputPixelType = <" << OutputPixelType << ">, option \"--depth\"\n" <<
-        "+ end of global variable dump\n";
+        "+ parameter handles\n";
+    parameter::dump_handles(out);
+    out << "+ end of global variable dump\n";
 }
 
 
@@ -26,9 +26,14 @@
 #endif
 
 #include <iostream>
+#include <algorithm>
 #include <iomanip>
 #include <list>
+#include <limits>
 #include <map>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include <vigra/flatmorphology.hxx>
 #include <vigra/functorexpression.hxx>
@@ -61,6 +66,12 @@ using vigra::functor::Param;
 
 
 namespace enblend {
+
+// Defined in enfuse.cc.
+extern parameter::handle<bool> fusedWeights;
+extern parameter::handle<bool> exposureWeightTable;
+extern parameter::handle<bool> hardMaskLabelsEnabled;
+
 // Keep sum and sum-of-squares together for improved CPU-cache locality.
 template <typename T>
 struct ScratchPad {
@@ -455,13 +466,191 @@ private:
 };
 
 
+/** Tell whether a histogram of KeyType fits into a flat array of
+ *  counts and if so, the number of bins.  Signed and wider integral
+ *  types as well as floating-point keys stay with the std::map-based
+ *  Histogram.
+ */
+template <typename KeyType>
+struct DenseHistogramTraits
+{
+    typedef vigra::VigraFalseType isDense;
+};
+
+template <>
+struct DenseHistogramTraits<vigra::UInt8>
+{
+    typedef vigra::VigraTrueType isDense;
+    enum {BINS = 256};
+};
+
+template <>
+struct DenseHistogramTraits<vigra::UInt16>
+{
+    typedef vigra::VigraTrueType isDense;
+    enum {BINS = 65536};
+};
+
+
+/** Histogram with one flat array of counts per channel for 8-bit and
+ *  16-bit keys.  Besides the counts we keep the number of occupied
+ *  bins and the sum of count * log(count) up to date with every
+ *  insertion and erasure, so that the entropy
+ *      (log(total) - sum(count * log(count)) / total) / log(bins)
+ *  is available in constant time.
+ *
+ *  The histogram cannot hold more than maximumCount pixels per
+ *  channel, which must be at least the size of the moving window.
+ *
+ *  The result is not bit-identical to the one of Histogram.
+ *  Histogram sums p * log(p) over the occupied bins in key order,
+ *  whereas we accumulate count * log(count) in the order the pixels
+ *  enter and leave the window, so the double-precision entropies may
+ *  differ in their last bits.  After the conversion to the integral
+ *  ResultType both agree except where the scaled entropy falls within
+ *  these rounding errors of a rounding boundary; then the results
+ *  differ by one unit.
+ */
+template <typename InputPixelType, typename ResultPixelType>
+class DenseHistogram
+{
+    enum {GRAY = 0, CHANNELS = 3};
+
+public:
+    typedef vigra::NumericTraits<InputPixelType> InputPixelTraits;
+    typedef typename InputPixelTraits::ValueType KeyType;
+    typedef typename InputPixelTraits::isScalar pixelIsScalar;
+    typedef DenseHistogramTraits<KeyType> KeyTraits;
+    typedef unsigned DataType;
+    typedef vigra::NumericTraits<ResultPixelType> ResultPixelTraits;
+    typedef typename ResultPixelTraits::ValueType ResultType;
+
+    explicit DenseHistogram(size_t maximumCount) :
+        count(CHANNELS * KeyTraits::BINS), xLogX(maximumCount + 1), logarithm(maximumCount + 1)
+    {
+        xLogX[0] = 0.0;
+        logarithm[0] = 0.0; // just to have a reliable value
+        for (size_t i = 1; i <= maximumCount; ++i)
+        {
+            logarithm[i] = log(static_cast<double>(i));
+            xLogX[i] = static_cast<double>(i) * logarithm[i];
+        }
+        clear();
+    }
+
+    void clear() {
+        std::fill(count.begin(), count.end(), DataType());
+        for (int channel = 0; channel < CHANNELS; ++channel) {
+            totalCount[channel] = DataType();
+            occupiedBins[channel] = DataType();
+            sumXLogX[channel] = 0.0;
+        }
+    }
+
+    void insert(const InputPixelType& x) {insertFun(x, pixelIsScalar());}
+
+    void erase(const InputPixelType& x) {eraseFun(x, pixelIsScalar());}
+
+    ResultPixelType entropy() const {return entropyFun(pixelIsScalar());}
+
+protected:
+    static size_t bin(int channel, KeyType key) {
+        return static_cast<size_t>(channel) * KeyTraits::BINS + static_cast<size_t>(key);
+    }
+
+    void insertInChannel(int channel, KeyType key) {
+        DataType& c = count[bin(channel, key)];
+        sumXLogX[channel] += xLogX[c + 1U] - xLogX[c];
+        if (c == DataType())
+        {
+            ++occupiedBins[channel];
+        }
+        ++c;
+        ++totalCount[channel];
+    }
+
+    void eraseInChannel(int channel, KeyType key) {
+        DataType& c = count[bin(channel, key)];
+        assert(c != DataType());
+        sumXLogX[channel] += xLogX[c - 1U] - xLogX[c];
+        --c;
+        if (c == DataType())
+        {
+            --occupiedBins[channel];
+        }
+        --totalCount[channel];
+        if (totalCount[channel] == DataType())
+        {
+            // Do not let rounding errors accumulate across empty states.
+            sumXLogX[channel] = 0.0;
+        }
+    }
+
+    double entropyOfChannel(int channel) const {
+        const DataType total = totalCount[channel];
+        const DataType actualBins = occupiedBins[channel];
+        if (total == 0 || actualBins <= 1)
+        {
+            return 0.0;
+        }
+        else
+        {
+            return (logarithm[total] - sumXLogX[channel] / static_cast<double>(total)) / logarithm[actualBins];
+        }
+    }
+
+    // Grayscale
+    void insertFun(const InputPixelType& x, vigra::VigraTrueType) {insertInChannel(GRAY, x);}
+
+    void eraseFun(const InputPixelType& x, vigra::VigraTrueType) {eraseInChannel(GRAY, x);}
+
+    ResultPixelType entropyFun(vigra::VigraTrueType) const {
+        const double max = static_cast<double>(vigra::NumericTraits<KeyType>::max());
+        return ResultPixelType(ResultPixelTraits::fromRealPromote(entropyOfChannel(GRAY) * max));
+    }
+
+    // RGB
+    void insertFun(const InputPixelType& x, vigra::VigraFalseType) {
+        for (int channel = 0; channel < CHANNELS; ++channel) {
+            insertInChannel(channel, x[channel]);
+        }
+    }
+
+    void eraseFun(const InputPixelType& x, vigra::VigraFalseType) {
+        for (int channel = 0; channel < CHANNELS; ++channel) {
+            eraseInChannel(channel, x[channel]);
+        }
+    }
+
+    ResultPixelType entropyFun(vigra::VigraFalseType) const {
+        const double max = static_cast<double>(vigra::NumericTraits<KeyType>::max());
+        return ResultPixelType(vigra::NumericTraits<ResultType>::fromRealPromote(entropyOfChannel(0) * max),
+                               vigra::NumericTraits<ResultType>::fromRealPromote(entropyOfChannel(1) * max),
+                               vigra::NumericTraits<ResultType>::fromRealPromote(entropyOfChannel(2) * max));
+    }
+
+private:
+    std::vector<DataType> count; // CHANNELS consecutive blocks of BINS counts
+    std::vector<double> xLogX;
+    std::vector<double> logarithm;
+    DataType totalCount[CHANNELS];
+    DataType occupiedBins[CHANNELS];
+    double sumXLogX[CHANNELS];
+};
+
+
+/** Compute the local entropy with the std::map-based Histogram.  We
+ *  cache the histogram of every row of the window and merge them into
+ *  the running histogram of the current column.
+ */
 template <class SrcIterator, class SrcAccessor,
           class MaskIterator, class MaskAccessor,
           class DestIterator, class DestAccessor>
 void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
                     MaskIterator mask_ul, MaskAccessor mask_acc,
                     DestIterator dest_ul, DestAccessor dest_acc,
-                    vigra::Size2D size)
+                    vigra::Size2D size,
+                    vigra::VigraFalseType)
 {
     typedef typename SrcIterator::PixelType SrcPixelType;
     typedef typename DestIterator::PixelType DestPixelType;
@@ -472,7 +661,6 @@ void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
                        "localEntropyIf(): window larger than image");
 
     const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
-    ScratchPadType* const scratchPad = new ScratchPadType[imageSize.y + 1];
 
     ScratchPadType::setPrecomputedEntropySize(size.x * size.y);
 
@@ -480,89 +668,260 @@ void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
     const vigra::Diff2D deltaX(size.x / 2, 0);
     const vigra::Diff2D deltaXp1(size.x / 2 + 1, 0);
     const vigra::Diff2D deltaY(0, size.y / 2);
+    const int numberOfColumns = imageSize.x - 2 * border.x;
 
-    // Fill scratch pad for the first time.
+    // Every thread works on its own band of consecutive columns.  It
+    // warms up a private scratch pad with the window of the first
+    // column of its band and then rolls it through the band.
+#ifdef OPENMP
+#pragma omp parallel
+#endif
     {
-        SrcIterator srcRow(src_ul + deltaX);
-        SrcIterator const srcEnd(src_lr - deltaX);
-        MaskIterator maskRow(mask_ul + deltaX);
-        ScratchPadType* spRow(scratchPad);
+        const int numberOfBands = omp_get_num_threads();
+        const int band = omp_get_thread_num();
+        const int firstColumn = border.x + band * numberOfColumns / numberOfBands;
+        const int lastColumn = border.x + (band + 1) * numberOfColumns / numberOfBands;
 
-        for (; srcRow.y < srcEnd.y; ++srcRow.y, ++maskRow.y, ++spRow)
+        if (firstColumn < lastColumn)
         {
-            SrcIterator srcCol(srcRow - deltaX);
-            SrcIterator srcColEnd(srcRow + deltaX);
-            MaskIterator maskCol(maskRow - deltaX);
+            ScratchPadType* const scratchPad = new ScratchPadType[imageSize.y + 1];
+
+            // Fill scratch pad for the first time.
+            {
+                SrcIterator srcRow(src_ul + vigra::Diff2D(firstColumn, 0));
+                SrcIterator const srcEnd(src_lr - deltaX);
+                MaskIterator maskRow(mask_ul + vigra::Diff2D(firstColumn, 0));
+                ScratchPadType* spRow(scratchPad);
+
+                for (; srcRow.y < srcEnd.y; ++srcRow.y, ++maskRow.y, ++spRow)
+                {
+                    SrcIterator srcCol(srcRow - deltaX);
+                    SrcIterator srcColEnd(srcRow + deltaX);
+                    MaskIterator maskCol(maskRow - deltaX);
+
+                    for (; srcCol.x <= srcColEnd.x; ++srcCol.x, ++maskCol.x)
+                    {
+                        if (mask_acc(maskCol))
+                        {
+                            spRow->insert(src_acc(srcCol));
+                        }
+                    }
+                }
+            }
 
-            for (; srcCol.x <= srcColEnd.x; ++srcCol.x, ++maskCol.x)
+            // Iterate through the band
             {
-                if (mask_acc(maskCol))
+                SrcIterator srcCol(src_ul + vigra::Diff2D(firstColumn, border.y));
+                SrcIterator const srcEnd(src_lr - border);
+                MaskIterator maskCol(mask_ul + vigra::Diff2D(firstColumn, border.y));
+                DestIterator destCol(dest_ul + vigra::Diff2D(firstColumn, border.y));
+
+                ScratchPadType hist;
+
+                // For each column in the band...
+                for (int column = firstColumn; column < lastColumn; ++column, ++srcCol.x, ++maskCol.x, ++destCol.x)
                 {
-                    spRow->insert(src_acc(srcCol));
+                    SrcIterator srcRow(srcCol);
+                    MaskIterator maskRow(maskCol);
+                    DestIterator destRow(destCol);
+                    ScratchPadType* spRow(scratchPad + border.y);
+
+                    // Initialize running histogram of this column
+                    hist.clear();
+                    for (ScratchPadType* s = spRow - border.y; s <= spRow + border.y; ++s)
+                    {
+                        hist.insert(s);
+                    }
+
+                    // Write one column of results
+                    for (; srcRow.y < srcEnd.y; ++srcRow.y, ++maskRow.y, ++destRow.y, ++spRow)
+                    {
+                        // Compute entropy
+                        if (mask_acc(maskRow))
+                        {
+                            dest_acc.set(hist.entropy(), destRow);
+                        }
+
+                        // Update running histogram to next row
+                        hist.erase(spRow - border.y); // remove oldest row
+                        hist.insert(spRow + border.y + 1); // add next row
+                    }
+
+                    if (column + 1 == lastColumn)
+                    {
+                        break;
+                    }
+
+                    // Update scratch pad to next column
+                    for (srcRow = srcCol - deltaY, maskRow = maskCol - deltaY, spRow = scratchPad;
+                         srcRow.y < src_lr.y;
+                         ++srcRow.y, ++maskRow.y, ++spRow)
+                    {
+                        if (mask_acc(maskRow - deltaX))
+                        {
+                            // remove oldest column
+                            spRow->erase(src_acc(srcRow - deltaX));
+                        }
+                        if (mask_acc(maskRow + deltaXp1))
+                        {
+                            // add next column
+                            spRow->insert(src_acc(srcRow + deltaXp1));
+                        }
+                    }
                 }
             }
+
+            delete [] scratchPad;
         }
     }
 
-    // Iterate through the image
-    {
-        SrcIterator srcCol(src_ul + border);
-        SrcIterator const srcEnd(src_lr - border);
-        MaskIterator maskCol(mask_ul + border);
-        DestIterator destCol(dest_ul + border);
+    ScratchPadType::setPrecomputedEntropySize(0);
+}
+
+
+/** Compute the local entropy with a DenseHistogram.
+ *
+ *  Instead of caching one histogram per row, which would be
+ *  prohibitively large for 16-bit keys, we slide a single window
+ *  histogram down each column and update it pixel by pixel, which is
+ *  cheap with a flat array of counts.
+ */
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          class DestIterator, class DestAccessor>
+void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
+                    MaskIterator mask_ul, MaskAccessor mask_acc,
+                    DestIterator dest_ul, DestAccessor dest_acc,
+                    vigra::Size2D size,
+                    vigra::VigraTrueType)
+{
+    typedef typename SrcIterator::PixelType SrcPixelType;
+    typedef typename DestIterator::PixelType DestPixelType;
+    typedef DenseHistogram<SrcPixelType, DestPixelType> HistogramType;
 
-        ScratchPadType hist;
+    vigra_precondition(src_lr.x - src_ul.x >= size.x &&
+                       src_lr.y - src_ul.y >= size.y,
+                       "localEntropyIf(): window larger than image");
+
+    const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
+    const vigra::Diff2D border(size.x / 2, size.y / 2);
+    const int windowWidth = 2 * border.x + 1;
+    const int windowHeight = 2 * border.y + 1;
+
+    // Columns are independent of each other, so every thread takes a
+    // band of consecutive columns and its own histogram.
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+    {
+        HistogramType hist(static_cast<size_t>(windowWidth) * static_cast<size_t>(windowHeight));
 
         // For each column in the source image...
-        for (; srcCol.x < srcEnd.x; ++srcCol.x, ++maskCol.x, ++destCol.x)
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int x = border.x; x < imageSize.x - border.x; ++x)
         {
-            SrcIterator srcRow(srcCol);
-            MaskIterator maskRow(maskCol);
-            DestIterator destRow(destCol);
-            ScratchPadType* spRow(scratchPad + border.y);
-
-            // Initialize running histogram of this column
-            hist.clear();
-            for (ScratchPadType* s = spRow - border.y; s <= spRow + border.y; ++s)
+            SrcIterator srcRow(src_ul + vigra::Diff2D(x - border.x, 0));
+            MaskIterator maskRow(mask_ul + vigra::Diff2D(x - border.x, 0));
+
+            // Rows [top, bottom) of the source image are in the histogram.
+            int top = 0;
+            int bottom = 0;
+
+            for (; bottom < std::min(windowHeight, imageSize.y); ++bottom)
             {
-                hist.insert(s);
+                SrcIterator s(srcRow + vigra::Diff2D(0, bottom));
+                MaskIterator m(maskRow + vigra::Diff2D(0, bottom));
+                for (int i = 0; i < windowWidth; ++i, ++s.x, ++m.x)
+                {
+                    if (mask_acc(m))
+                    {
+                        hist.insert(src_acc(s));
+                    }
+                }
             }
 
             // Write one column of results
-            for (; srcRow.y < srcEnd.y; ++srcRow.y, ++maskRow.y, ++destRow.y, ++spRow)
+            DestIterator destRow(dest_ul + vigra::Diff2D(x, border.y));
+            MaskIterator maskCenter(mask_ul + vigra::Diff2D(x, border.y));
+            for (int y = border.y; y < imageSize.y - border.y; ++y, ++destRow.y, ++maskCenter.y)
             {
                 // Compute entropy
-                if (mask_acc(maskRow))
+                if (mask_acc(maskCenter))
                 {
                     dest_acc.set(hist.entropy(), destRow);
                 }
 
                 // Update running histogram to next row
-                hist.erase(spRow - border.y); // remove oldest row
-                hist.insert(spRow + border.y + 1); // add next row
+                {
+                    SrcIterator s(srcRow + vigra::Diff2D(0, top));
+                    MaskIterator m(maskRow + vigra::Diff2D(0, top));
+                    for (int i = 0; i < windowWidth; ++i, ++s.x, ++m.x)
+                    {
+                        if (mask_acc(m))
+                        {
+                            hist.erase(src_acc(s)); // remove oldest row
+                        }
+                    }
+                    ++top;
+                }
+                if (bottom < imageSize.y)
+                {
+                    SrcIterator s(srcRow + vigra::Diff2D(0, bottom));
+                    MaskIterator m(maskRow + vigra::Diff2D(0, bottom));
+                    for (int i = 0; i < windowWidth; ++i, ++s.x, ++m.x)
+                    {
+                        if (mask_acc(m))
+                        {
+                            hist.insert(src_acc(s)); // add next row
+                        }
+                    }
+                    ++bottom;
+                }
             }
 
-            // Update scratch pad to next column
-            for (srcRow = srcCol - deltaY, maskRow = maskCol - deltaY, spRow = scratchPad;
-                 srcRow.y < src_lr.y;
-                 ++srcRow.y, ++maskRow.y, ++spRow)
+            // Empty the histogram for the next column.  Erasing the
+            // remaining rows is much cheaper than clearing all bins.
+            for (; top < bottom; ++top)
             {
-                if (mask_acc(maskRow - deltaX))
-                {
-                    // remove oldest column
-                    spRow->erase(src_acc(srcRow - deltaX));
-                }
-                if (mask_acc(maskRow + deltaXp1))
+                SrcIterator s(srcRow + vigra::Diff2D(0, top));
+                MaskIterator m(maskRow + vigra::Diff2D(0, top));
+                for (int i = 0; i < windowWidth; ++i, ++s.x, ++m.x)
                 {
-                    // add next column
-                    spRow->insert(src_acc(srcRow + deltaXp1));
+                    if (mask_acc(m))
+                    {
+                        hist.erase(src_acc(s));
+                    }
                 }
             }
         }
     }
+}
 
-    ScratchPadType::setPrecomputedEntropySize(0);
-    delete [] scratchPad;
+
+/** Compute the local entropy of the image in a window of the given
+ *  size for all pixels inside of the mask.  We select the histogram
+ *  engine at compile time: unsigned 8-bit and 16-bit channels use a
+ *  DenseHistogram, all other types the std::map-based Histogram.  See
+ *  DenseHistogram for how far the two engines can differ.
+ */
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          class DestIterator, class DestAccessor>
+inline void
+localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
+               MaskIterator mask_ul, MaskAccessor mask_acc,
+               DestIterator dest_ul, DestAccessor dest_acc,
+               vigra::Size2D size)
+{
+    typedef typename vigra::NumericTraits<typename SrcIterator::PixelType>::ValueType KeyType;
+
+    localEntropyIf(src_ul, src_lr, src_acc,
+                   mask_ul, mask_acc,
+                   dest_ul, dest_acc,
+                   size,
+                   typename DenseHistogramTraits<KeyType>::isDense());
 }
 
 
@@ -620,23 +979,105 @@ protected:
 };
 
 
+/** Tabulated exposure weights.  An unsigned integral scalar type of
+ *  at most 16 bits takes so few different values that we sample the
+ *  weight function once at every luminance
+ *          y[i] = i / max,    0 <= i <= max,
+ *  computed exactly as the exposure functors compute it, and look
+ *  up the weights of all pixels afterwards.  The primary template
+ *  covers all other scalar types; it never holds a table.
+ *
+ *  Each table belongs to the exposure functor that builds it, thus it
+ *  is sampled once per input image.  Copies of the functor share the
+ *  table, which never changes after construction and therefore needs
+ *  no locking.
+ */
+template <typename ScalarType,
+          bool tabulate = std::is_integral<ScalarType>::value &&
+                          std::is_unsigned<ScalarType>::value &&
+                          std::numeric_limits<ScalarType>::digits <= 16>
+class ExposureWeightTable {
+public:
+    explicit ExposureWeightTable(ExposureWeight*) {}
+
+    bool empty() const {return true;}
+    double operator[](const ScalarType&) const {return 0.0;}
+};
+
+
+template <typename ScalarType>
+class ExposureWeightTable<ScalarType, true> {
+public:
+    explicit ExposureWeightTable(ExposureWeight* weight_function) :
+        table_(exposureWeightTable() ? tabulate(weight_function) : nullptr) {}
+
+    bool empty() const {return !table_;}
+    double operator[](const ScalarType& a) const {return (*table_)[a];}
+
+private:
+    typedef std::shared_ptr<const std::vector<double> > table_pointer;
+
+    static table_pointer tabulate(ExposureWeight* weight_function) {
+        const size_t size = static_cast<size_t>(vigra::NumericTraits<ScalarType>::max()) + 1U;
+        std::vector<double> luminances(size);
+        std::shared_ptr<std::vector<double> > table(new std::vector<double>(size));
+
+        for (size_t i = 0U; i != size; ++i) {
+            luminances[i] =
+                vigra::NumericTraits<ScalarType>::toRealPromote(static_cast<ScalarType>(i)) /
+                vigra::NumericTraits<ScalarType>::max();
+        }
+        weight_function->weights(luminances.data(), table->data(), size);
+
+        return table;
+    }
+
+    table_pointer table_;
+};
+
+
 template <typename InputType, typename InputAccessor, typename ResultType>
 class ExposureFunctor : public std::unary_function<InputType, ResultType> {
 public:
     ExposureFunctor(double weight, ExposureWeight* weight_function, const InputAccessor& a) :
-        weight_(weight), weight_function_(weight_function), acc_(a) {}
+        weight_(weight), weight_function_(weight_function), acc_(a), table_(weight_function) {}
 
     ResultType operator()(const InputType& a) const {
         typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
         return f(a, srcIsScalar());
     }
 
+    bool is_tabulated() const {return !table_.empty();}
+
+    /** Answer the number of doubles of scratch space the batch
+     *  operator() needs for n pixels. */
+    static size_t scratch_size(size_t n) {return 2U * n;}
+
+    // Compute the weights of the n pixels at `a' with a single call of
+    // the weight function.  The caller provides scratch space of
+    // scratch_size(n) doubles, so that it can reuse it for all rows.
+    void operator()(const InputType* a, ResultType* result, size_t n, double* scratch) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        double* const luminances = scratch;
+        double* const weights = scratch + n;
+
+        for (size_t i = 0U; i != n; ++i) {
+            luminances[i] = luminance(a[i], srcIsScalar());
+        }
+        weight_function_->weights(luminances, weights, n);
+        for (size_t i = 0U; i != n; ++i) {
+            result[i] = vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * weights[i]);
+        }
+    }
+
 protected:
+    typedef typename InputAccessor::value_type ScalarType;
+
     // grayscale
     template <typename T>
     ResultType f(const T& a, vigra::VigraTrueType) const {
-        const double y = vigra::NumericTraits<T>::toRealPromote(a) / vigra::NumericTraits<T>::max();
-        return vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * weight_function_->weight(y));
+        const double w = table_.empty() ? weight_function_->weight(luminance(a, vigra::VigraTrueType())) : table_[a];
+        return vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * w);
     }
 
     // RGB
@@ -645,9 +1086,22 @@ protected:
         return f(acc_.operator()(a), vigra::VigraTrueType());
     }
 
+    // grayscale
+    template <typename T>
+    double luminance(const T& a, vigra::VigraTrueType) const {
+        return vigra::NumericTraits<T>::toRealPromote(a) / vigra::NumericTraits<T>::max();
+    }
+
+    // RGB
+    template <typename T>
+    double luminance(const T& a, vigra::VigraFalseType) const {
+        return luminance(acc_.operator()(a), vigra::VigraTrueType());
+    }
+
     const double weight_;
     ExposureWeight* weight_function_;
     InputAccessor acc_;
+    ExposureWeightTable<ScalarType> table_;
 };
 
 
@@ -660,7 +1114,7 @@ public:
         weight_(weight), weight_function_(weight_function), acc_(a),
         lower_cutoff_(lc.instantiate<typename InputAccessor::value_type>()),
         upper_cutoff_(uc.instantiate<typename InputAccessor::value_type>()),
-        lower_acc_(lca), upper_acc_(uca)
+        lower_acc_(lca), upper_acc_(uca), table_(weight_function)
     {
         typedef typename InputAccessor::value_type value_type;
 
@@ -690,15 +1144,51 @@ public:
         return f(a, srcIsScalar());
     }
 
+    bool is_tabulated() const {return !table_.empty();}
+
+    /** Answer the number of doubles of scratch space the batch
+     *  operator() needs for n pixels. */
+    static size_t scratch_size(size_t n) {return 2U * n;}
+
+    // Compute the weights of the n pixels at `a' with a single call of
+    // the weight function.  Only the pixels within the cutoffs enter
+    // the call.  The caller provides scratch space of scratch_size(n)
+    // doubles, so that it can reuse it for all rows.
+    void operator()(const InputType* a, ResultType* result, size_t n, double* scratch) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        double* const luminances = scratch;
+        double* const weights = scratch + n;
+        size_t m = 0U;
+
+        for (size_t i = 0U; i != n; ++i) {
+            double y;
+            if (luminance(a[i], y, srcIsScalar())) {
+                luminances[m++] = y;
+            }
+        }
+
+        weight_function_->weights(luminances, weights, m);
+        size_t k = 0U;
+        for (size_t i = 0U; i != n; ++i) {
+            double y;
+            result[i] =
+                luminance(a[i], y, srcIsScalar()) ?
+                vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * weights[k++]) :
+                ResultType();
+        }
+    }
+
 protected:
+    typedef typename InputAccessor::value_type ScalarType;
+
     // grayscale
     template <typename T>
     ResultType f(const T& a, vigra::VigraTrueType) const {
         typedef typename vigra::NumericTraits<T>::RealPromote RealType;
         const RealType ra = vigra::NumericTraits<T>::toRealPromote(a);
         if (ra >= lower_cutoff_ && ra <= upper_cutoff_) {
-            const double y = ra / vigra::NumericTraits<T>::max();
-            return vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * weight_function_->weight(y));
+            const double w = table_.empty() ? weight_function_->weight(ra / vigra::NumericTraits<T>::max()) : table_[a];
+            return vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * w);
         } else {
             return ResultType();
         }
@@ -709,17 +1199,44 @@ protected:
     ResultType f(const T& a, vigra::VigraFalseType) const {
         typedef typename T::value_type ValueType;
         typedef typename vigra::NumericTraits<ValueType>::RealPromote RealType;
-        const RealType ra = vigra::NumericTraits<ValueType>::toRealPromote(acc_.operator()(a));
+        const ScalarType gray = acc_.operator()(a);
+        const RealType ra = vigra::NumericTraits<ValueType>::toRealPromote(gray);
         const RealType lower_ra = vigra::NumericTraits<ValueType>::toRealPromote(lower_acc_.operator()(a));
         const RealType upper_ra = vigra::NumericTraits<ValueType>::toRealPromote(upper_acc_.operator()(a));
         if (lower_ra >= lower_cutoff_ && upper_ra <= upper_cutoff_) {
-            const double y = ra / vigra::NumericTraits<ValueType>::max();
-            return vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * weight_function_->weight(y));
+            const double w =
+                table_.empty() ?
+                weight_function_->weight(ra / vigra::NumericTraits<ValueType>::max()) :
+                table_[gray];
+            return vigra::NumericTraits<ResultType>::fromRealPromote(weight_ * w);
         } else {
             return ResultType();
         }
     }
 
+    // Store the luminance of grayscale pixel `a' in `y' and answer
+    // whether `a' lies within the cutoffs.
+    template <typename T>
+    bool luminance(const T& a, double& y, vigra::VigraTrueType) const {
+        typedef typename vigra::NumericTraits<T>::RealPromote RealType;
+        const RealType ra = vigra::NumericTraits<T>::toRealPromote(a);
+        y = ra / vigra::NumericTraits<T>::max();
+        return ra >= lower_cutoff_ && ra <= upper_cutoff_;
+    }
+
+    // Store the luminance of RGB pixel `a' in `y' and answer whether
+    // `a' lies within the cutoffs.
+    template <typename T>
+    bool luminance(const T& a, double& y, vigra::VigraFalseType) const {
+        typedef typename T::value_type ValueType;
+        typedef typename vigra::NumericTraits<ValueType>::RealPromote RealType;
+        const RealType ra = vigra::NumericTraits<ValueType>::toRealPromote(acc_.operator()(a));
+        const RealType lower_ra = vigra::NumericTraits<ValueType>::toRealPromote(lower_acc_.operator()(a));
+        const RealType upper_ra = vigra::NumericTraits<ValueType>::toRealPromote(upper_acc_.operator()(a));
+        y = ra / vigra::NumericTraits<ValueType>::max();
+        return lower_ra >= lower_cutoff_ && upper_ra <= upper_cutoff_;
+    }
+
     const double weight_;
     ExposureWeight* weight_function_;
     InputAccessor acc_;
@@ -727,6 +1244,7 @@ protected:
     const double upper_cutoff_;
     InputAccessor lower_acc_;
     InputAccessor upper_acc_;
+    ExposureWeightTable<ScalarType> table_;
 };
 
 
@@ -959,6 +1477,306 @@ private:
 };
 
 
+template <typename ScalarType>
+void
+checkEntropyCutoffs(ScalarType lowerCutoff, ScalarType upperCutoff)
+{
+    if (lowerCutoff < ScalarType())
+    {
+        std::cerr << command << ": negative lower entropy cutoff" << std::endl;
+        exit(1);
+    }
+    if (upperCutoff < ScalarType())
+    {
+        std::cerr << command << ": negative upper entropy cutoff" << std::endl;
+        exit(1);
+    }
+    if (lowerCutoff > upperCutoff)
+    {
+        const double max = static_cast<double>(vigra::NumericTraits<ScalarType>::max());
+        std::cerr << command <<
+            ": lower entropy cutoff (" << static_cast<double>(lowerCutoff) << "/" << max <<
+            " = " << 100.0 * lowerCutoff / max <<
+            "%) exceeds upper cutoff (" << static_cast<double>(upperCutoff) << "/" << max <<
+            " = " << 100.0 * upperCutoff / max <<
+            "%)" << std::endl;
+        exit(1);
+    }
+}
+
+
+/** Answer whether enfuseMaskInBands() can compute the weights of an
+ *  image of the given size.  It leaves three cases to the
+ *  whole-image passes of enfuseMask():
+ *  - Laplacian edge detection, whose Gaussian kernels reach far
+ *    beyond the contrast window,
+ *  - the std::map-based Histogram for local entropy, whose shared
+ *    look-up tables do not tolerate concurrent users, and
+ *  - images smaller than a window, where the passes report the
+ *    error.
+ */
+template <typename ScalarType>
+bool
+canComputeWeightsInBands(const vigra::Size2D& imageSize)
+{
+    typedef typename DenseHistogramTraits<ScalarType>::isDense EntropyHistogramIsDense;
+
+    if (!fusedWeights() || imageSize.x <= 0 || imageSize.y <= 0)
+    {
+        return false;
+    }
+    if (WContrast > 0.0 &&
+        (FilterConfig.edgeScale > 0.0 ||
+         imageSize.x < ContrastWindowSize || imageSize.y < ContrastWindowSize))
+    {
+        return false;
+    }
+    if (WEntropy > 0.0 &&
+        (!EntropyHistogramIsDense::asBool ||
+         imageSize.x < EntropyWindowSize || imageSize.y < EntropyWindowSize))
+    {
+        return false;
+    }
+
+    return WExposure > 0.0 || WContrast > 0.0 || WSaturation > 0.0 || WEntropy > 0.0;
+}
+
+
+// Number of bytes of all images that take part in the weight
+// computation of one band of rows; see enfuseMaskInBands().
+#define WEIGHT_BAND_BYTES (512U * 1024U)
+
+
+/** Compute the same weights as the whole-image passes of
+ *  enfuseMask(), but band by band.  A band is a stripe of image rows
+ *  small enough to remain in the cache while we evaluate all enabled
+ *  criteria for it and write the combined weight once.
+ *
+ *  The windowed criteria, local contrast and local entropy, see the
+ *  band extended by half a window above and below, which yields
+ *  exactly the values of the whole-image computation.  All
+ *  temporaries are band-sized and owned by one thread, which reuses
+ *  them for all its bands.
+ *
+ *  Pass a null exposureFunctor if the exposure weight is off.  Unless
+ *  the exposure functor looks up tabulated weights, we hand the
+ *  luminances of all pixels of a row to the weight function at once.
+ */
+template <typename ImageType, typename AlphaType, typename MaskType, typename ExposureFunctorType>
+void enfuseMaskInBands(vigra::triple<typename ImageType::const_traverser, typename ImageType::const_traverser, typename ImageType::ConstAccessor> src,
+                       vigra::pair<typename AlphaType::const_traverser, typename AlphaType::ConstAccessor> mask,
+                       vigra::pair<typename MaskType::traverser, typename MaskType::Accessor> result,
+                       const ExposureFunctorType* exposureFunctor) {
+    typedef typename ImageType::value_type ImageValueType;
+    typedef typename ImageType::PixelType PixelType;
+    typedef typename vigra::NumericTraits<PixelType>::ValueType ScalarType;
+    typedef typename vigra::NumericTraits<ScalarType>::Promote LongScalarType;
+    typedef typename MaskType::value_type MaskValueType;
+    typedef vigra::BasicImage<LongScalarType> GradImage;
+    typedef vigra::BasicImage<PixelType> EntropyImage;
+
+    const vigra::Size2D imageSize(src.second - src.first);
+    const int width = imageSize.x;
+    const int height = imageSize.y;
+
+    const bool doContrast = WContrast > 0.0;
+    const bool doSaturation = WSaturation > 0.0;
+    const bool doEntropy = WEntropy > 0.0;
+    const bool doTruncateEntropy =
+        doEntropy &&
+        (EntropyLowerCutoff.is_effective<ScalarType>() || EntropyUpperCutoff.is_effective<ScalarType>());
+
+    const bool batchExposure = exposureFunctor && !exposureFunctor->is_tabulated();
+    // localStdDevIf() reads every pixel once per row of its window, so
+    // we project RGB pixels only once into a grayscale band.
+    const bool projectContrast = doContrast && !vigra::NumericTraits<PixelType>::isScalar::asBool;
+
+    const int contrastHalo = doContrast ? ContrastWindowSize / 2 : 0;
+    const int entropyHalo = doEntropy ? EntropyWindowSize / 2 : 0;
+    const int halo = std::max(contrastHalo, entropyHalo);
+
+    MultiGrayscaleAccessor<PixelType, LongScalarType> ga(GrayscaleProjector);
+    ContrastFunctor<LongScalarType, ScalarType, MaskValueType> contrastFunctor(WContrast);
+    SaturationFunctor<ImageValueType, MaskValueType> saturationFunctor(WSaturation);
+    EntropyFunctor<PixelType, MaskValueType> entropyFunctor(WEntropy);
+
+    const ScalarType lowerCutoff = doTruncateEntropy ? EntropyLowerCutoff.instantiate<ScalarType>() : ScalarType();
+    const ScalarType upperCutoff = doTruncateEntropy ? EntropyUpperCutoff.instantiate<ScalarType>() : ScalarType();
+    if (doTruncateEntropy)
+    {
+        checkEntropyCutoffs(lowerCutoff, upperCutoff);
+    }
+    ClampingFunctor<PixelType, PixelType>
+        truncateFunctor((PixelType(lowerCutoff)),
+                        (PixelType(ScalarType())),
+                        (PixelType(upperCutoff)),
+                        (PixelType(vigra::NumericTraits<ScalarType>::max())));
+
+    // Choose the bands high enough to amortize the halos, and small
+    // enough to fit WEIGHT_BAND_BYTES and to give every thread a few
+    // bands.
+    const size_t bytesPerPixel =
+        sizeof(ImageValueType) + sizeof(typename AlphaType::value_type) + sizeof(MaskValueType) +
+        (doContrast ? (projectContrast ? 2U : 1U) * sizeof(LongScalarType) : 0U) +
+        (doEntropy ? (doTruncateEntropy ? 2U : 1U) * sizeof(PixelType) : 0U);
+    const int minimumBandHeight = 8 * (2 * halo + 1);
+    const int cacheBandHeight = static_cast<int>(WEIGHT_BAND_BYTES / (static_cast<size_t>(width) * bytesPerPixel));
+    const int balancedBandHeight = (height + 4 * omp_get_max_threads() - 1) / (4 * omp_get_max_threads());
+    const int bandHeight =
+        std::min(height, std::max(minimumBandHeight, std::min(cacheBandHeight, balancedBandHeight)));
+    const int numberOfBands = (height + bandHeight - 1) / bandHeight;
+
+#ifdef OPENMP
+    // localStdDevIf() and localEntropyIf() must run single-threaded
+    // inside of a band.
+    const omp::scoped_nested no_nesting(false);
+#endif
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+    {
+        GradImage grad(doContrast ? width : 0, doContrast ? bandHeight + 2 * contrastHalo : 0);
+        GradImage gray(projectContrast ? width : 0, projectContrast ? bandHeight + 2 * contrastHalo : 0);
+        EntropyImage entropy(doEntropy ? width : 0, doEntropy ? bandHeight + 2 * entropyHalo : 0);
+        EntropyImage trunc(doTruncateEntropy ? width : 0, doTruncateEntropy ? bandHeight + 2 * entropyHalo : 0);
+        std::vector<ImageValueType> exposurePixels(batchExposure ? width : 0);
+        std::vector<MaskValueType> exposureWeights(batchExposure ? width : 0);
+        std::vector<double> exposureScratch(batchExposure ?
+                                            ExposureFunctorType::scratch_size(static_cast<size_t>(width)) :
+                                            0U);
+
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int band = 0; band < numberOfBands; ++band)
+        {
+            const int firstRow = band * bandHeight;
+            const int lastRow = std::min(firstRow + bandHeight, height);
+
+            // Rows [contrastTop, contrastBottom) of the image are rows
+            // [0, contrastBottom - contrastTop) of `grad'.
+            const int contrastTop = std::max(0, firstRow - contrastHalo);
+            const int contrastBottom = std::min(height, lastRow + contrastHalo);
+            if (doContrast)
+            {
+                vigra::initImage(grad.upperLeft(), grad.upperLeft() + vigra::Diff2D(width, contrastBottom - contrastTop),
+                                 grad.accessor(), vigra::NumericTraits<LongScalarType>::zero());
+                if (contrastBottom - contrastTop >= ContrastWindowSize)
+                {
+                    if (projectContrast)
+                    {
+                        for (int y = contrastTop; y < contrastBottom; ++y)
+                        {
+                            ga(&*(src.first + vigra::Diff2D(0, y)), gray[y - contrastTop], width);
+                        }
+                        localStdDevIf(gray.upperLeft(), gray.upperLeft() + vigra::Diff2D(width, contrastBottom - contrastTop), gray.accessor(),
+                                      mask.first + vigra::Diff2D(0, contrastTop), mask.second,
+                                      grad.upperLeft(), grad.accessor(),
+                                      vigra::Size2D(ContrastWindowSize, ContrastWindowSize));
+                    }
+                    else
+                    {
+                        localStdDevIf(src.first + vigra::Diff2D(0, contrastTop), src.first + vigra::Diff2D(width, contrastBottom), ga,
+                                      mask.first + vigra::Diff2D(0, contrastTop), mask.second,
+                                      grad.upperLeft(), grad.accessor(),
+                                      vigra::Size2D(ContrastWindowSize, ContrastWindowSize));
+                    }
+                }
+            }
+
+            const int entropyTop = std::max(0, firstRow - entropyHalo);
+            const int entropyBottom = std::min(height, lastRow + entropyHalo);
+            if (doEntropy)
+            {
+                const vigra::Diff2D entropyBandSize(width, entropyBottom - entropyTop);
+
+                vigra::initImage(entropy.upperLeft(), entropy.upperLeft() + entropyBandSize,
+                                 entropy.accessor(), vigra::NumericTraits<PixelType>::zero());
+                if (entropyBandSize.y >= EntropyWindowSize)
+                {
+                    if (doTruncateEntropy)
+                    {
+                        vigra::transformImage(src.first + vigra::Diff2D(0, entropyTop), src.first + vigra::Diff2D(width, entropyBottom), src.third,
+                                              trunc.upperLeft(), trunc.accessor(),
+                                              truncateFunctor);
+                        localEntropyIf(trunc.upperLeft(), trunc.upperLeft() + entropyBandSize, trunc.accessor(),
+                                       mask.first + vigra::Diff2D(0, entropyTop), mask.second,
+                                       entropy.upperLeft(), entropy.accessor(),
+                                       vigra::Size2D(EntropyWindowSize, EntropyWindowSize));
+                    }
+                    else
+                    {
+                        localEntropyIf(src.first + vigra::Diff2D(0, entropyTop), src.first + vigra::Diff2D(width, entropyBottom), src.third,
+                                       mask.first + vigra::Diff2D(0, entropyTop), mask.second,
+                                       entropy.upperLeft(), entropy.accessor(),
+                                       vigra::Size2D(EntropyWindowSize, EntropyWindowSize));
+                    }
+                }
+            }
+
+            // Combine the criteria in the same order and with the same
+            // conversions as the whole-image passes do.
+            for (int y = firstRow; y < lastRow; ++y)
+            {
+                typename ImageType::const_traverser s(src.first + vigra::Diff2D(0, y));
+                typename AlphaType::const_traverser m(mask.first + vigra::Diff2D(0, y));
+                typename MaskType::traverser r(result.first + vigra::Diff2D(0, y));
+                const LongScalarType* const gradRow = doContrast ? grad[y - contrastTop] : nullptr;
+                const PixelType* const entropyRow = doEntropy ? entropy[y - entropyTop] : nullptr;
+
+                if (batchExposure)
+                {
+                    typename ImageType::const_traverser sx(s);
+                    typename AlphaType::const_traverser mx(m);
+                    size_t n = 0U;
+
+                    for (int x = 0; x < width; ++x, ++sx.x, ++mx.x)
+                    {
+                        if (mask.second(mx))
+                        {
+                            exposurePixels[n++] = src.third(sx);
+                        }
+                    }
+                    (*exposureFunctor)(exposurePixels.data(), exposureWeights.data(), n, exposureScratch.data());
+                }
+
+                size_t k = 0U;
+                for (int x = 0; x < width; ++x, ++s.x, ++m.x, ++r.x)
+                {
+                    if (!mask.second(m))
+                    {
+                        continue;
+                    }
+
+                    MaskValueType weight =
+                        batchExposure ?
+                        exposureWeights[k++] :
+                        (exposureFunctor ? (*exposureFunctor)(src.third(s)) : result.second(r));
+                    if (doContrast)
+                    {
+#if defined(__clang__)
+                        weight = contrastFunctor(gradRow[x]) + weight;
+#else
+                        weight = contrastFunctor(static_cast<ScalarType>(gradRow[x])) + weight;
+#endif
+                    }
+                    if (doSaturation)
+                    {
+                        weight = saturationFunctor(src.third(s)) + weight;
+                    }
+                    if (doEntropy)
+                    {
+                        weight = entropyFunctor(entropyRow[x]) + weight;
+                    }
+                    result.second.set(weight, r);
+                }
+            }
+        }
+    } // omp parallel
+}
+
+
 template <typename ImageType, typename AlphaType, typename MaskType>
 void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename ImageType::const_traverser, typename ImageType::ConstAccessor> src,
                 vigra::pair<typename AlphaType::const_traverser, typename AlphaType::ConstAccessor> mask,
@@ -968,11 +1786,14 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
     typedef typename vigra::NumericTraits<PixelType>::ValueType ScalarType;
     typedef typename MaskType::value_type MaskValueType;
 
+    typedef MultiGrayscaleAccessor<ImageValueType, ScalarType> MultiGrayAcc;
+    typedef ExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType> PlainExposureFunctor;
+
     const typename ImageType::difference_type imageSize = src.second - src.first;
+    const bool inBands = canComputeWeightsInBands<ScalarType>(imageSize);
 
     // Exposure
     if (WExposure > 0.0) {
-        typedef MultiGrayscaleAccessor<ImageValueType, ScalarType> MultiGrayAcc;
         MultiGrayAcc ga(GrayscaleProjector);
 
         if (ExposureLowerCutoff.is_effective<ScalarType>() ||
@@ -997,16 +1818,27 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
                 ", actual cutoff = " << static_cast<double>(ExposureUpperCutoff.instantiate<ScalarType>()) <<
                 "\n";
 #endif
+            if (inBands) {
+                enfuseMaskInBands<ImageType, AlphaType, MaskType>(src, mask, result, &cef);
+                return;
+            }
             vigra::omp::transformImageIf(src, mask, result, cef);
         } else {
-            ExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
-                ef(WExposure, ExposureWeightFunction, ga);
+            PlainExposureFunctor ef(WExposure, ExposureWeightFunction, ga);
 #ifdef DEBUG_EXPOSURE
             std::cout << "+ enfuseMask: plain - GrayscaleProjector = <" <<
                 GrayscaleProjector << ">\n";
 #endif
+            if (inBands) {
+                enfuseMaskInBands<ImageType, AlphaType, MaskType>(src, mask, result, &ef);
+                return;
+            }
             vigra::omp::transformImageIf(src, mask, result, ef);
         }
+    } else if (inBands) {
+        enfuseMaskInBands<ImageType, AlphaType, MaskType>(src, mask, result,
+                                                          static_cast<const PlainExposureFunctor*>(nullptr));
+        return;
     }
 
     // Contrast
@@ -1154,27 +1986,7 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
                 "upperCutoff = " << static_cast<double>(upperCutoff) << std::endl;
 #endif
 
-            if (lowerCutoff < ScalarType())
-            {
-                std::cerr << command << ": negative lower entropy cutoff" << std::endl;
-                exit(1);
-            }
-            if (upperCutoff < ScalarType())
-            {
-                std::cerr << command << ": negative upper entropy cutoff" << std::endl;
-                exit(1);
-            }
-            if (lowerCutoff > upperCutoff)
-            {
-                const double max = static_cast<double>(vigra::NumericTraits<ScalarType>::max());
-                std::cerr << command <<
-                    ": lower entropy cutoff (" << static_cast<double>(lowerCutoff) << "/" << max <<
-                    " = " << 100.0 * lowerCutoff / max <<
-                    "%) exceeds upper cutoff (" << static_cast<double>(upperCutoff) << "/" << max <<
-                    " = " << 100.0 * upperCutoff / max <<
-                    "%)" << std::endl;
-                exit(1);
-            }
+            checkEntropyCutoffs(lowerCutoff, upperCutoff);
 
             Image trunc(imageSize);
             ClampingFunctor<PixelType, PixelType>
@@ -1212,6 +2024,179 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
 };
 
 
+/** Labels of the hard masks.
+ *
+ *  A hard mask assigns each pixel to exactly one image, the one with
+ *  the largest weight.  Instead of a full-size mask per image we
+ *  keep a single label image that holds the index of the winning
+ *  image.  Pixels where no image has a positive weight carry the
+ *  label "unassigned" and later get equal shares of all images.
+ *  Depending on the number of images the labels are 8 or 16 bits
+ *  wide.
+ *
+ *  While the weights of the images come in one after the other,
+ *  add() tracks the largest weight so far in an additional image,
+ *  which finish() releases.  Afterwards extract() recreates the hard
+ *  mask of any image on demand.
+ */
+template <typename MaskType>
+class HardMaskLabels
+{
+public:
+    typedef typename MaskType::value_type MaskPixelType;
+
+    static bool is_applicable(unsigned aNumberOfImages) {
+        return aNumberOfImages < static_cast<unsigned>(vigra::NumericTraits<vigra::UInt16>::max());
+    }
+
+    HardMaskLabels(const vigra::Size2D& aSize, unsigned aNumberOfImages) :
+        size_(aSize), max_weight_(new MaskType(aSize))
+    {
+        assert(is_applicable(aNumberOfImages));
+        if (aNumberOfImages < static_cast<unsigned>(vigra::NumericTraits<vigra::UInt8>::max())) {
+            narrow_.reset(new vigra::BImage(aSize, vigra::NumericTraits<vigra::UInt8>::max()));
+        } else {
+            wide_.reset(new vigra::UInt16Image(aSize, vigra::NumericTraits<vigra::UInt16>::max()));
+        }
+    }
+
+    // Account for aWeight, the weights of the image with index aLabel.
+    void add(const MaskType& aWeight, unsigned aLabel) {
+        assert(max_weight_);
+        if (narrow_) {
+            add_to(*narrow_, aWeight, aLabel);
+        } else {
+            add_to(*wide_, aWeight, aLabel);
+        }
+    }
+
+    // Release the memory only add() needs.
+    void finish() {max_weight_.reset();}
+
+    // Fill aMask with the hard mask of the image with index aLabel:
+    // aMaximum where the image wins, aShare where no image wins, and
+    // zero everywhere else.
+    void extract(unsigned aLabel, MaskPixelType aMaximum, MaskPixelType aShare, MaskType* aMask) const {
+        if (narrow_) {
+            extract_from(*narrow_, aLabel, aMaximum, aShare, aMask);
+        } else {
+            extract_from(*wide_, aLabel, aMaximum, aShare, aMask);
+        }
+    }
+
+private:
+    template <typename LabelImageType>
+    void add_to(LabelImageType& labels, const MaskType& weight, unsigned label) {
+        typedef typename LabelImageType::value_type LabelType;
+        const LabelType l = static_cast<LabelType>(label);
+        MaskType& max_weight = *max_weight_;
+
+        // Like the loop over all masks of the general hard-mask path
+        // the first image with the strictly largest weight wins.
+#ifdef OPENMP
+#pragma omp parallel for schedule(guided)
+#endif
+        for (int y = 0; y < size_.y; ++y) {
+            const MaskPixelType* w = weight[y];
+            MaskPixelType* m = max_weight[y];
+            LabelType* r = labels[y];
+            for (int x = 0; x < size_.x; ++x) {
+                if (w[x] > m[x]) {
+                    m[x] = w[x];
+                    r[x] = l;
+                }
+            }
+        }
+    }
+
+    template <typename LabelImageType>
+    void extract_from(const LabelImageType& labels, unsigned label,
+                      MaskPixelType maximum, MaskPixelType share, MaskType* mask) const {
+        typedef typename LabelImageType::value_type LabelType;
+        const LabelType l = static_cast<LabelType>(label);
+        const LabelType unassigned = vigra::NumericTraits<LabelType>::max();
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(guided)
+#endif
+        for (int y = 0; y < size_.y; ++y) {
+            const LabelType* r = labels[y];
+            MaskPixelType* m = (*mask)[y];
+            for (int x = 0; x < size_.x; ++x) {
+                m[x] = r[x] == l ? maximum : (r[x] == unassigned ? share : MaskPixelType());
+            }
+        }
+    }
+
+    const vigra::Size2D size_;
+    std::unique_ptr<MaskType> max_weight_;
+    std::unique_ptr<vigra::BImage> narrow_;
+    std::unique_ptr<vigra::UInt16Image> wide_;
+};
+
+
+/** Fill mask with the weights of the image in imagePair.  Load them
+ *  from the mask file of the m-th input if the user requested so;
+ *  otherwise compute them with enfuseMask().
+ */
+template <typename ImageType, typename AlphaType, typename MaskType>
+void
+loadOrComputeMask(const std::pair<ImageType*, AlphaType*>& imagePair, MaskType* mask,
+                  const vigra::Rect2D& anInputUnion, unsigned numberOfImages,
+                  FileNameList::const_iterator inputFileNameIterator, unsigned m)
+{
+    if (LoadMasks) {
+        // IMPLEMENTATION NOTE: For simplicity of the code, here
+        // we also load in hard masks.  Computing the set of hard
+        // masks from a set of soft masks is done by maximum
+        // selection, which is an idempotent function.
+        const std::string maskFilename =
+            enblend::expandFilenameTemplate(UseHardMask ? HardMaskTemplate : SoftMaskTemplate,
+                                            numberOfImages,
+                                            *inputFileNameIterator,
+                                            OutputFileName,
+                                            m);
+        if (can_open_file(maskFilename)) {
+            vigra::ImageImportInfo maskInfo(maskFilename.c_str());
+            if (Verbose >= VERBOSE_MASK_MESSAGES) {
+                std::cerr << command
+                          << ": info: loading " << (UseHardMask ? "hard" : "soft")
+                          << "mask \"" << maskFilename << "\"" << std::endl;
+            }
+            if (!maskInfo.isGrayscale()) {
+                std::cerr << command
+                          << ": mask image \"" << maskFilename << "\" is not grayscale" << std::endl;
+                exit(1);
+            }
+            if (maskInfo.numExtraBands() != 0) {
+                std::cerr << command
+                          << ": mask image \"" << maskFilename << "\" must not have an alpha channel" << std::endl;
+                exit(1);
+            }
+            if (maskInfo.width() != anInputUnion.width() || maskInfo.height() != anInputUnion.height()) {
+                std::cerr << command
+                          << ": warning: mask in \"" << maskFilename << "\" has size "
+                          << "(" << maskInfo.width() << "x" << maskInfo.height() << "),\n"
+                          << command
+                          << ": warning: but image union has size " << anInputUnion.size() << ";\n"
+                          << command
+                          << ": note: make sure this is the right mask for the given images"
+                          << std::endl;
+            }
+            importImage(maskInfo, destImage(*mask));
+        } else {
+            // Cannot read mask file.  We already issued an error
+            // message through can_open_file().
+            exit(1);
+        }
+    } else {
+        enfuseMask<ImageType, AlphaType, MaskType>(srcImageRange(*(imagePair.first)),
+                                                   srcImage(*(imagePair.second)),
+                                                   destImage(*mask));
+    }
+}
+
+
 /** Enfuse's main blending loop. Templatized to handle different image types.
  */
 template <typename ImagePixelType>
@@ -1242,8 +2227,8 @@ void enfuseMain(const FileNameList& anInputFileNameList,
     typedef typename imageListType::iterator imageListIteratorType;
     imageListType imageList;
 
-    // Sum of all masks
-    MaskType *normImage = new MaskType(anInputUnion.size());
+    // Sum of all masks; hard masks do not need it.
+    MaskType *normImage = UseHardMask ? nullptr : new MaskType(anInputUnion.size());
 
     // Result image. Alpha will be union of all input alphas.
     std::pair<ImageType*, AlphaType*> outputPair(static_cast<ImageType*>(nullptr),
@@ -1254,6 +2239,23 @@ void enfuseMain(const FileNameList& anInputFileNameList,
     unsigned m = 0;
     FileNameList::const_iterator inputFileNameIterator(anInputFileNameList.begin());
 
+    // Hard masks live in a single label image instead of one mask
+    // per image unless the user switches it off.
+    std::unique_ptr<HardMaskLabels<MaskType> > hardMaskLabels;
+    if (UseHardMask &&
+        hardMaskLabelsEnabled() &&
+        HardMaskLabels<MaskType>::is_applicable(numberOfImages)) {
+        hardMaskLabels.reset(new HardMaskLabels<MaskType>(anInputUnion.size(), numberOfImages));
+    }
+
+    // In streaming mode we only accumulate the weights in the first
+    // pass and re-read every image in the second pass, where we add its
+    // pyramid to the result right away.  Thus, at most one input image
+    // is in memory at any time.  Hard masks need all weights at once,
+    // which only the label image provides without keeping every mask.
+    const bool streaming =
+        parameter::as_boolean("streaming-fusion", false) && (!UseHardMask || hardMaskLabels);
+
 #ifdef HAVE_EXIV2
     typedef allocate::array<Exiv2::Image::AutoPtr> metadata_array;
     metadata_array input_metadata(anInputFileNameList.size());
@@ -1285,55 +2287,8 @@ void enfuseMain(const FileNameList& anInputFileNameList,
 
         MaskType* mask = new MaskType(anInputUnion.size());
 
-        if (LoadMasks) {
-            // IMPLEMENTATION NOTE: For simplicity of the code, here
-            // we also load in hard masks.  Computing the set of hard
-            // masks from a set of soft masks is done by maximum
-            // selection, which is an idempotent function.
-            const std::string maskFilename =
-                enblend::expandFilenameTemplate(UseHardMask ? HardMaskTemplate : SoftMaskTemplate,
-                                                numberOfImages,
-                                                *inputFileNameIterator,
-                                                OutputFileName,
-                                                m);
-            if (can_open_file(maskFilename)) {
-                vigra::ImageImportInfo maskInfo(maskFilename.c_str());
-                if (Verbose >= VERBOSE_MASK_MESSAGES) {
-                    std::cerr << command
-                              << ": info: loading " << (UseHardMask ? "hard" : "soft")
-                              << "mask \"" << maskFilename << "\"" << std::endl;
-                }
-                if (!maskInfo.isGrayscale()) {
-                    std::cerr << command
-                              << ": mask image \"" << maskFilename << "\" is not grayscale" << std::endl;
-                    exit(1);
-                }
-                if (maskInfo.numExtraBands() != 0) {
-                    std::cerr << command
-                              << ": mask image \"" << maskFilename << "\" must not have an alpha channel" << std::endl;
-                    exit(1);
-                }
-                if (maskInfo.width() != anInputUnion.width() || maskInfo.height() != anInputUnion.height()) {
-                    std::cerr << command
-                              << ": warning: mask in \"" << maskFilename << "\" has size "
-                              << "(" << maskInfo.width() << "x" << maskInfo.height() << "),\n"
-                              << command
-                              << ": warning: but image union has size " << anInputUnion.size() << ";\n"
-                              << command
-                              << ": note: make sure this is the right mask for the given images"
-                              << std::endl;
-                }
-                importImage(maskInfo, destImage(*mask));
-            } else {
-                // Cannot read mask file.  We already issued an error
-                // message through can_open_file().
-                exit(1);
-            }
-        } else {
-            enfuseMask<ImageType, AlphaType, MaskType>(srcImageRange(*(imagePair.first)),
-                                                       srcImage(*(imagePair.second)),
-                                                       destImage(*mask));
-        }
+        loadOrComputeMask<ImageType, AlphaType, MaskType>(imagePair, mask, anInputUnion,
+                                                          numberOfImages, inputFileNameIterator, m);
 
         if (SaveMasks) {
             const std::string mask_pixel_type =
@@ -1378,13 +2333,25 @@ void enfuseMain(const FileNameList& anInputFileNameList,
                                 maskImage(*(imagePair.second)),
                                 destImage(*(outputPair.second)));
 
-        // Add the mask to the norm image.
-        vigra::omp::combineTwoImages(srcImageRange(*mask),
-                                     srcImage(*normImage),
-                                     destImage(*normImage),
-                                     Arg1() + Arg2());
+        if (hardMaskLabels) {
+            hardMaskLabels->add(*mask, m);
+            delete mask;
+            mask = nullptr;
+        } else if (!UseHardMask) {
+            // Add the mask to the norm image.
+            vigra::omp::combineTwoImages(srcImageRange(*mask),
+                                         srcImage(*normImage),
+                                         destImage(*normImage),
+                                         Arg1() + Arg2());
+        }
 
-        imageList.push_back(vigra::make_triple(imagePair.first, imagePair.second, mask));
+        if (streaming) {
+            delete imagePair.first;
+            delete imagePair.second;
+            delete mask;
+        } else {
+            imageList.push_back(vigra::make_triple(imagePair.first, imagePair.second, mask));
+        }
 
         ++m;
         ++inputFileNameIterator;
@@ -1394,63 +2361,83 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         exit(0);
     }
 
-    const int totalImages = imageList.size();
+    const int totalImages = static_cast<int>(m);
 
     typename EnblendNumericTraits<ImagePixelType>::MaskPixelType maxMaskPixelType =
         vigra::NumericTraits<typename EnblendNumericTraits<ImagePixelType>::MaskPixelType>::max();
 
+    // Mask values of a hard mask where the image wins and where no
+    // image wins.
+    const MaskPixelType hardMaskMaximum = static_cast<MaskPixelType>(maxMaskPixelType);
+    const MaskPixelType hardMaskShare = static_cast<MaskPixelType>(maxMaskPixelType) / totalImages;
+
     if (UseHardMask) {
         if (Verbose >= VERBOSE_MASK_MESSAGES) {
             std::cerr << command
                       << ": info: creating hard blend mask" << std::endl;
         }
-        const vigra::Size2D sz = normImage->size();
         imageListIteratorType imageIter;
+        if (hardMaskLabels) {
+            // add() has already selected the maximum weights.
+            hardMaskLabels->finish();
+        } else {
+            const vigra::Size2D sz = anInputUnion.size();
 #ifdef OPENMP
 #pragma omp parallel for private (imageIter)
 #endif
-        for (int y = 0; y < sz.y; ++y) {
-            for (int x = 0; x < sz.x; ++x) {
-                float max = 0.0f;
-                int maxi = 0;
-                int i = 0;
-                for (imageIter = imageList.begin();
-                     imageIter != imageList.end();
-                     ++imageIter) {
-                    const float w = static_cast<float>((*imageIter->third)(x, y));
-                    if (w > max) {
-                        max = w;
-                        maxi = i;
+            for (int y = 0; y < sz.y; ++y) {
+                for (int x = 0; x < sz.x; ++x) {
+                    float max = 0.0f;
+                    int maxi = 0;
+                    int i = 0;
+                    for (imageIter = imageList.begin();
+                         imageIter != imageList.end();
+                         ++imageIter) {
+                        const float w = static_cast<float>((*imageIter->third)(x, y));
+                        if (w > max) {
+                            max = w;
+                            maxi = i;
+                        }
+                        i++;
                     }
-                    i++;
-                }
-                i = 0;
-                for (imageIter = imageList.begin();
-                     imageIter != imageList.end();
-                     ++imageIter) {
-                    if (max == 0.0f) {
-                        (*imageIter->third)(x, y) =
-                            static_cast<MaskPixelType>(maxMaskPixelType) / totalImages;
-                    } else if (i == maxi) {
-                        (*imageIter->third)(x, y) = maxMaskPixelType;
-                    } else {
-                        (*imageIter->third)(x, y) = 0.0f;
+                    i = 0;
+                    for (imageIter = imageList.begin();
+                         imageIter != imageList.end();
+                         ++imageIter) {
+                        if (max == 0.0f) {
+                            (*imageIter->third)(x, y) =
+                                static_cast<MaskPixelType>(maxMaskPixelType) / totalImages;
+                        } else if (i == maxi) {
+                            (*imageIter->third)(x, y) = maxMaskPixelType;
+                        } else {
+                            (*imageIter->third)(x, y) = 0.0f;
+                        }
+                        i++;
                     }
-                    i++;
                 }
             }
         }
-        unsigned i = 0;
+
         if (SaveMasks) {
             const std::string mask_pixel_type =
                 to_upper_copy(parameter::as_string("mask-save-pixel-type", "float"));
+            std::unique_ptr<MaskType> labelMask(hardMaskLabels ? new MaskType(anInputUnion.size()) : nullptr);
+
+            imageIter = imageList.begin();
+            inputFileNameIterator = anInputFileNameList.begin();
+            for (int i = 0; i < totalImages; ++i, ++inputFileNameIterator) {
+                MaskType* hardMask;
+                if (hardMaskLabels) {
+                    hardMaskLabels->extract(i, hardMaskMaximum, hardMaskShare, labelMask.get());
+                    hardMask = labelMask.get();
+                } else {
+                    hardMask = imageIter->third;
+                    ++imageIter;
+                }
 
-            for (imageIter = imageList.begin(), inputFileNameIterator = anInputFileNameList.begin();
-                 imageIter != imageList.end();
-                 ++imageIter, ++inputFileNameIterator) {
                 const std::string maskFilename =
                     enblend::expandFilenameTemplate(HardMaskTemplate,
-                                                    imageList.size(),
+                                                    totalImages,
                                                     *inputFileNameIterator,
                                                     OutputFileName,
                                                     i);
@@ -1478,9 +2465,8 @@ void enfuseMain(const FileNameList& anInputFileNameList,
                     maskInfo.setYResolution(ImageResolution.y);
                     maskInfo.setCompression(MASK_COMPRESSION);
                     maskInfo.setPixelType(mask_pixel_type.c_str());
-                    exportImage(srcImageRange(*(imageIter->third)), maskInfo);
+                    exportImage(srcImageRange(*hardMask), maskInfo);
                 }
-                i++;
             }
         }
     }
@@ -1497,10 +2483,35 @@ void enfuseMain(const FileNameList& anInputFileNameList,
 
     std::vector<ImagePyramidType*> *resultLP = nullptr;
 
+    if (streaming && Verbose >= VERBOSE_MASK_MESSAGES) {
+        std::cerr << command
+                  << ": info: re-reading images to fuse them" << std::endl;
+    }
+
+    imageInfoList.assign(anImageInfoList.begin(), anImageInfoList.end());
+    inputFileNameIterator = anInputFileNameList.begin();
     m = 0;
-    while (!imageList.empty()) {
-        vigra::triple<ImageType*, AlphaType*, MaskType*> imageTriple = imageList.front();
-        imageList.erase(imageList.begin());
+    while (streaming ? !imageInfoList.empty() : !imageList.empty()) {
+        vigra::triple<ImageType*, AlphaType*, MaskType*> imageTriple;
+
+        if (streaming) {
+            // The images assemble into the same groups as in the
+            // first pass, because assemble() is deterministic.
+            vigra::Rect2D imageBB;
+            std::pair<ImageType*, AlphaType*> imagePair =
+                assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, imageBB);
+            MaskType* mask = nullptr;
+            if (!hardMaskLabels) {
+                mask = new MaskType(anInputUnion.size());
+                loadOrComputeMask<ImageType, AlphaType, MaskType>(imagePair, mask, anInputUnion,
+                                                                  numberOfImages, inputFileNameIterator, m);
+            }
+            imageTriple = vigra::make_triple(imagePair.first, imagePair.second, mask);
+            ++inputFileNameIterator;
+        } else {
+            imageTriple = imageList.front();
+            imageList.erase(imageList.begin());
+        }
 
         std::ostringstream oss0;
         oss0 << "imageGP" << m << "_";
@@ -1523,7 +2534,11 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         //oss1 << "imageLP" << m << "_";
         //exportPyramid<ImagePyramidType>(imageLP, oss1.str().c_str());
 
-        if (!UseHardMask) {
+        if (hardMaskLabels) {
+            // Recreate the hard mask of this image from the labels.
+            imageTriple.third = new MaskType(anInputUnion.size());
+            hardMaskLabels->extract(m, hardMaskMaximum, hardMaskShare, imageTriple.third);
+        } else if (!UseHardMask) {
             // Normalize the mask coefficients.
             // Scale to the range expected by the MaskPyramidPixelType.
             vigra::omp::combineTwoImages(srcImageRange(*(imageTriple.third)),
@@ -21,6 +21,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include "global.h"
 #include "openmp_def.h"         // omp::atomic_t
@@ -81,6 +82,8 @@ namespace exposure_weight
 
         double weight(double y) override {return function_->weight(y);}
 
+        void weights(const double* y, double* w, size_t n) override {function_->weights(y, w, n);}
+
     private:
         std::string library_;
         std::string symbol_;
@@ -239,10 +242,19 @@ namespace exposure_weight
         assert(n >= 2);
         int zero_count = 0;
 
+        // Check the weights that enfuse actually uses, i.e., those of
+        // the batch interface.
+        std::vector<double> ys(n);
+        std::vector<double> ws(n);
+        for (int i = 0; i < n; ++i)
+        {
+            ys[i] = static_cast<double>(i) / static_cast<double>(n - 1);
+        }
+        weight_function->weights(ys.data(), ws.data(), n);
+
         for (int i = 0; i < n; ++i)
         {
-            const double y = static_cast<double>(i) / static_cast<double>(n - 1);
-            const double w = weight_function->weight(y);
+            const double w = ws[i];
 
             if (w < 0.0)
             {
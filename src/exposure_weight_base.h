@@ -7,6 +7,7 @@
 #define EXPOSURE_WEIGHT_BASE_INCLUDED
 
 
+#include <cstddef>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -14,7 +15,7 @@
 
 
 // Version number of the interface-to-user-weight functions.
-#define EXPOSURE_WEIGHT_INTERFACE_VERSION 2
+#define EXPOSURE_WEIGHT_INTERFACE_VERSION 3
 
 
 // The full width at half of the maximum of the Gauss-curve we use for
@@ -70,6 +71,22 @@ public:
 
     virtual int interface_version() const {return EXPOSURE_WEIGHT_INTERFACE_VERSION;}
 
+    // Compute w[i] = weight(y[i]) for 0 <= i < n.  Enfuse evaluates
+    // the weights of floating-point images row by row with this
+    // function.  Override it if the weight function can process a
+    // whole batch faster than one luminance at a time.
+    //
+    // Implementation Note: We declare this function after all other
+    // virtual functions so that the preceding vtable slots stay where
+    // interface version 2 had them.
+    virtual void weights(const double* y, double* w, size_t n)
+    {
+        for (size_t i = 0U; i != n; ++i)
+        {
+            w[i] = weight(y[i]);
+        }
+    }
+
 private:
     void check_invariant() const
     {
@@ -26,7 +26,10 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <cmath>
+#include <memory>
+#include <vector>
 
 #include <time.h>
 
@@ -60,6 +63,9 @@
 namespace enblend
 {
 
+// Defined in enblend.cc and enfuse.cc.
+extern parameter::handle<bool> markFreakyColorConversions;
+
 static inline double
 wrap_cyclically(double x, double modulus)
 {
@@ -92,18 +98,50 @@ calculate_delta_e(const cmsCIELab* lab1, const cmsCIELab* lab2)
 
 
 static inline void
-jch_to_rgb(const cmsJCh* jch, double* rgb)
+jch_to_xyz(const cmsJCh* jch, double* xyz)
 {
     cmsCIEXYZ scaled_xyz;
     cmsCIECAM02Reverse(CIECAMTransform, jch, &scaled_xyz);
     // xyz values *approximately* in range [0, 100]
 
     // scale xyz values to range [0, 1]
-    const double xyz[] = {
-        scaled_xyz.X / XYZ_SCALE,
-        scaled_xyz.Y / XYZ_SCALE,
-        scaled_xyz.Z / XYZ_SCALE
-    };
+    xyz[0] = scaled_xyz.X / XYZ_SCALE;
+    xyz[1] = scaled_xyz.Y / XYZ_SCALE;
+    xyz[2] = scaled_xyz.Z / XYZ_SCALE;
+}
+
+
+static inline void
+xyz_to_jch(const double* xyz, cmsJCh* jch)
+{
+    const cmsCIEXYZ scaled_xyz = {XYZ_SCALE * xyz[0], XYZ_SCALE * xyz[1], XYZ_SCALE * xyz[2]};
+    cmsJCh jch_unlimited;
+    cmsCIECAM02Forward(CIECAMTransform, &scaled_xyz, &jch_unlimited);
+
+    jch->J = EXPECT_RESULT(std::isnan(jch_unlimited.J), false) ? 0.0 : jch_unlimited.J;
+    jch->C = EXPECT_RESULT(std::isnan(jch_unlimited.C), false) ? 0.0 : jch_unlimited.C;
+    jch->h = wrap_cyclically(jch_unlimited.h, 360.0);
+}
+
+
+// Replace the cyclic hue of jch with Cartesian chroma components:
+// jab = (J, C sin(h), C cos(h)).
+static inline void
+jch_to_jab(const cmsJCh* jch, double* jab)
+{
+    const double theta = jch->h * (M_PI / 180.0);
+
+    jab[0] = jch->J;
+    jab[1] = jch->C * sin(theta);
+    jab[2] = jch->C * cos(theta);
+}
+
+
+static inline void
+jch_to_rgb(const cmsJCh* jch, double* rgb)
+{
+    double xyz[3];
+    jch_to_xyz(jch, xyz);
 
     cmsDoTransform(XYZToInputTransform, xyz, rgb, 1U);
     // rgb values *approximately* in range [0, 1]
@@ -665,14 +703,48 @@ public:
 
     PyramidVectorType operator()(const SrcVectorType& v) const
     {
-        const double rgb[] = {
-            rgb_source_scale * SrcTraits::toRealPromote(v.red()),
-            rgb_source_scale * SrcTraits::toRealPromote(v.green()),
-            rgb_source_scale * SrcTraits::toRealPromote(v.blue())
-        };
+        double rgb[3];
         cmsCIELab lab;
 
+        rgb_of_source(v, rgb);
         cmsDoTransform(InputToLabTransform, rgb, &lab, 1U);
+
+        return pyramid_of_lab(lab);
+    }
+
+    // Convert a whole row with a single call to LittleCMS.
+    template <class SrcRowIterator, class SrcAccessor, class DestRowIterator, class DestAccessor>
+    void transform_row(SrcRowIterator src, SrcRowIterator src_end, SrcAccessor sa,
+                       DestRowIterator dest, DestAccessor da) const
+    {
+        const size_t n = src_end - src;
+        rgb_row.resize(3U * n);
+        lab_row.resize(n);
+
+        double* rgb = rgb_row.data();
+        for (; src != src_end; ++src, rgb += 3)
+        {
+            rgb_of_source(sa(src), rgb);
+        }
+
+        cmsDoTransform(InputToLabTransform, rgb_row.data(), lab_row.data(), static_cast<cmsUInt32Number>(n));
+
+        for (size_t i = 0U; i != n; ++i, ++dest)
+        {
+            da.set(pyramid_of_lab(lab_row[i]), dest);
+        }
+    }
+
+protected:
+    void rgb_of_source(const SrcVectorType& v, double* rgb) const
+    {
+        rgb[0] = rgb_source_scale * SrcTraits::toRealPromote(v.red());
+        rgb[1] = rgb_source_scale * SrcTraits::toRealPromote(v.green());
+        rgb[2] = rgb_source_scale * SrcTraits::toRealPromote(v.blue());
+    }
+
+    PyramidVectorType pyramid_of_lab(const cmsCIELab& lab) const
+    {
 #ifdef LOG_COLORSPACE_CONVERSION
         range.update(lab.L, lab.a, lab.b);
 #endif // LOG_COLORSPACE_CONVERSION
@@ -682,9 +754,10 @@ public:
                                  converter(Scale::scale_color_difference_for_pyramid(lab.b)));
     }
 
-protected:
     ConvertFunctorType converter;
     const double rgb_source_scale;
+    mutable std::vector<double> rgb_row;
+    mutable std::vector<cmsCIELab> lab_row;
 #ifdef LOG_COLORSPACE_CONVERSION
     mutable TriplePeakHold range;
 #endif // LOG_COLORSPACE_CONVERSION
@@ -895,7 +968,7 @@ public:
 
         if (EXPECT_RESULT(std::isnan(lab->a) || std::isnan(lab->b), false))
         {
-            if (parameter::as_boolean("mark-freaky-color-conversions", false))
+            if (markFreakyColorConversions())
             {
                 // magenta
                 rgb[0] = 1.0;
@@ -1017,7 +1090,7 @@ public:
                 ", final deltaE = " << calculate_delta_e(lab, &final_lab) << "\n" << std::endl;
 #endif // LOG_COLORSPACE_OPTIMIZATION
 
-            if (parameter::as_boolean("mark-freaky-color-conversions", false))
+            if (markFreakyColorConversions())
             {
                 // yellow
                 rgb[0] = 1.0;
@@ -1092,21 +1165,74 @@ public:
 #endif // LOG_COLORSPACE_CONVERSION
 
     DestVectorType operator()(const PyramidVectorType& v) const
+    {
+        const cmsCIELab lab = lab_of_pyramid(v);
+        double rgb[3];
+
+        cmsDoTransform(LabToInputTransform, &lab, rgb, 1U);
+
+        return dest_of_rgb(lab, rgb);
+    }
+
+    // Convert all pixels of a row that are inside of the mask with a
+    // single call to LittleCMS.
+    template <class SrcRowIterator, class SrcAccessor,
+              class MaskRowIterator, class MaskAccessor,
+              class DestRowIterator, class DestAccessor>
+    void transform_row_if(SrcRowIterator src, SrcRowIterator src_end, SrcAccessor sa,
+                          MaskRowIterator mask, MaskAccessor ma,
+                          DestRowIterator dest, DestAccessor da) const
+    {
+        lab_row.clear();
+        MaskRowIterator m(mask);
+        for (SrcRowIterator s = src; s != src_end; ++s, ++m)
+        {
+            if (ma(m))
+            {
+                lab_row.push_back(lab_of_pyramid(sa(s)));
+            }
+        }
+        if (lab_row.empty())
+        {
+            return;
+        }
+
+        rgb_row.resize(3U * lab_row.size());
+        cmsDoTransform(LabToInputTransform, lab_row.data(), rgb_row.data(),
+                       static_cast<cmsUInt32Number>(lab_row.size()));
+
+        const cmsCIELab* lab = lab_row.data();
+        double* rgb = rgb_row.data();
+        for (SrcRowIterator s = src; s != src_end; ++s, ++mask, ++dest)
+        {
+            if (ma(mask))
+            {
+                da.set(dest_of_rgb(*lab, rgb), dest);
+                ++lab;
+                rgb += 3;
+            }
+        }
+    }
+
+protected:
+    cmsCIELab lab_of_pyramid(const PyramidVectorType& v) const
     {
         const cmsCIELab lab = {
             Scale::scale_lightness_of_pyramid(converter(v.red())),
             Scale::scale_color_difference_of_pyramid(converter(v.green())),
             Scale::scale_color_difference_of_pyramid(converter(v.blue()))
         };
-        double rgb[3];
 
 #ifdef LOG_COLORSPACE_CONVERSION
         range.update(lab.L, lab.a, lab.b);
 #endif // LOG_COLORSPACE_CONVERSION
 
         assert(lab.L >= 0.0);
-        cmsDoTransform(LabToInputTransform, &lab, rgb, 1U);
+        return lab;
+    }
 
+    DestVectorType dest_of_rgb(const cmsCIELab& lab, double* rgb) const
+    {
         if (EXPECT_RESULT(is_below_threshold(rgb), false))
         {
             polish_rgb(&lab, rgb);
@@ -1117,9 +1243,10 @@ public:
                               DestTraits::fromRealPromote(rgb_dest_scale * rgb[2]));
     }
 
-protected:
     ConvertFunctorType converter;
     const double rgb_dest_scale;
+    mutable std::vector<cmsCIELab> lab_row;
+    mutable std::vector<double> rgb_row;
 #ifdef LOG_COLORSPACE_CONVERSION
     mutable TriplePeakHold range;
 #endif // LOG_COLORSPACE_CONVERSION
@@ -1178,14 +1305,51 @@ public:
 
     PyramidVectorType operator()(const SrcVectorType& v) const
     {
-        const double rgb[] = {
-            rgb_source_scale * SrcTraits::toRealPromote(v.red()),
-            rgb_source_scale * SrcTraits::toRealPromote(v.green()),
-            rgb_source_scale * SrcTraits::toRealPromote(v.blue())
-        };
+        double rgb[3];
         XYZ2LuvFunctor::argument_type xyz;
 
+        rgb_of_source(v, rgb);
         cmsDoTransform(InputToXYZTransform, rgb, &xyz[0], 1U);
+
+        return pyramid_of_xyz(xyz);
+    }
+
+    // Convert a whole row with a single call to LittleCMS.
+    template <class SrcRowIterator, class SrcAccessor, class DestRowIterator, class DestAccessor>
+    void transform_row(SrcRowIterator src, SrcRowIterator src_end, SrcAccessor sa,
+                       DestRowIterator dest, DestAccessor da) const
+    {
+        static_assert(sizeof(XYZ2LuvFunctor::argument_type) == 3U * sizeof(double),
+                      "XYZ vectors must be packed triples of doubles");
+
+        const size_t n = src_end - src;
+        rgb_row.resize(3U * n);
+        xyz_row.resize(n);
+
+        double* rgb = rgb_row.data();
+        for (; src != src_end; ++src, rgb += 3)
+        {
+            rgb_of_source(sa(src), rgb);
+        }
+
+        cmsDoTransform(InputToXYZTransform, rgb_row.data(), &xyz_row[0][0], static_cast<cmsUInt32Number>(n));
+
+        for (size_t i = 0U; i != n; ++i, ++dest)
+        {
+            da.set(pyramid_of_xyz(xyz_row[i]), dest);
+        }
+    }
+
+protected:
+    void rgb_of_source(const SrcVectorType& v, double* rgb) const
+    {
+        rgb[0] = rgb_source_scale * SrcTraits::toRealPromote(v.red());
+        rgb[1] = rgb_source_scale * SrcTraits::toRealPromote(v.green());
+        rgb[2] = rgb_source_scale * SrcTraits::toRealPromote(v.blue());
+    }
+
+    PyramidVectorType pyramid_of_xyz(const XYZ2LuvFunctor::argument_type& xyz) const
+    {
         const XYZ2LuvFunctor::result_type luv {xyz2luv(xyz)};
 #ifdef LOG_COLORSPACE_CONVERSION
         range.update(luv[0], luv[1], luv[2]);
@@ -1196,10 +1360,11 @@ public:
                                  converter(Scale::scale_color_difference_for_pyramid(luv[2])));
     }
 
-protected:
     XYZ2LuvFunctor xyz2luv;
     ConvertFunctorType converter;
     const double rgb_source_scale;
+    mutable std::vector<double> rgb_row;
+    mutable std::vector<XYZ2LuvFunctor::argument_type> xyz_row;
 #ifdef LOG_COLORSPACE_CONVERSION
     mutable TriplePeakHold range;
 #endif // LOG_COLORSPACE_CONVERSION
@@ -1259,6 +1424,60 @@ public:
 #endif // LOG_COLORSPACE_CONVERSION
 
     DestVectorType operator()(const PyramidVectorType& v) const
+    {
+        Luv2XYZFunctor::result_type xyz {xyz_of_pyramid(v)};
+        double rgb[3];
+
+        cmsDoTransform(XYZToInputTransform, &xyz[0], rgb, 1U);
+
+        return dest_of_xyz_and_rgb(xyz, rgb);
+    }
+
+    // Convert all pixels of a row that are inside of the mask with a
+    // single call to LittleCMS.
+    template <class SrcRowIterator, class SrcAccessor,
+              class MaskRowIterator, class MaskAccessor,
+              class DestRowIterator, class DestAccessor>
+    void transform_row_if(SrcRowIterator src, SrcRowIterator src_end, SrcAccessor sa,
+                          MaskRowIterator mask, MaskAccessor ma,
+                          DestRowIterator dest, DestAccessor da) const
+    {
+        static_assert(sizeof(Luv2XYZFunctor::result_type) == 3U * sizeof(double),
+                      "XYZ vectors must be packed triples of doubles");
+
+        xyz_row.clear();
+        MaskRowIterator m(mask);
+        for (SrcRowIterator s = src; s != src_end; ++s, ++m)
+        {
+            if (ma(m))
+            {
+                xyz_row.push_back(xyz_of_pyramid(sa(s)));
+            }
+        }
+        if (xyz_row.empty())
+        {
+            return;
+        }
+
+        rgb_row.resize(3U * xyz_row.size());
+        cmsDoTransform(XYZToInputTransform, &xyz_row[0][0], rgb_row.data(),
+                       static_cast<cmsUInt32Number>(xyz_row.size()));
+
+        typename std::vector<typename Luv2XYZFunctor::result_type>::iterator xyz = xyz_row.begin();
+        double* rgb = rgb_row.data();
+        for (SrcRowIterator s = src; s != src_end; ++s, ++mask, ++dest)
+        {
+            if (ma(mask))
+            {
+                da.set(dest_of_xyz_and_rgb(*xyz, rgb), dest);
+                ++xyz;
+                rgb += 3;
+            }
+        }
+    }
+
+protected:
+    Luv2XYZFunctor::result_type xyz_of_pyramid(const PyramidVectorType& v) const
     {
         const Luv2XYZFunctor::value_type luv {
             Scale::scale_lightness_of_pyramid(converter(v.red())),
@@ -1270,11 +1489,13 @@ public:
 #endif // LOG_COLORSPACE_CONVERSION
 
         assert(!std::isnan(luv[0]) && luv[0] >= 0.0);
-        Luv2XYZFunctor::result_type xyz {luv2xyz(luv)};
-        double rgb[3];
-
-        cmsDoTransform(XYZToInputTransform, &xyz[0], rgb, 1U);
+        return luv2xyz(luv);
+    }
 
+    // Answer the destination pixel given the XYZ coordinates and the
+    // RGB values LittleCMS derived from them.  Both may be modified.
+    DestVectorType dest_of_xyz_and_rgb(Luv2XYZFunctor::result_type& xyz, double* rgb) const
+    {
         if (EXPECT_RESULT(is_below_threshold(rgb), false))
         {
             XYZ2LabFunctor::result_type lab_vector {xyz2lab(xyz)};
@@ -1321,11 +1542,12 @@ public:
                               DestTraits::fromRealPromote(rgb_dest_scale * rgb[2]));
     }
 
-protected:
     Luv2XYZFunctor luv2xyz;
     XYZ2LabFunctor xyz2lab;
     ConvertFunctorType converter;
     const double rgb_dest_scale;
+    mutable std::vector<Luv2XYZFunctor::result_type> xyz_row;
+    mutable std::vector<double> rgb_row;
 #ifdef LOG_COLORSPACE_CONVERSION
     mutable TriplePeakHold range;
 #endif // LOG_COLORSPACE_CONVERSION
@@ -1375,6 +1597,11 @@ public:
         return a_chroma * cos(a_hue_angle) * pyramid_scale;
     }
 
+    double scale_chroma_component_for_pyramid(double a_chroma_component) const
+    {
+        return a_chroma_component * pyramid_scale;
+    }
+
     double scale_lightness_of_pyramid(double a_scaled_lightness) const
     {
         return a_scaled_lightness / pyramid_scale;
@@ -1398,6 +1625,289 @@ private:
 };
 
 
+// Cache of the forward CIECAM02 transform from input RGB to
+// (J, C sin(h), C cos(h)).  The cache samples the exact transform on
+// a regular grid over the RGB cube and interpolates tetrahedrally in
+// between.  Interpolating the Cartesian chroma components instead of
+// C and h sidesteps the wrap-around of the hue.
+//
+// When building the cache we compare the interpolated values with
+// the exact transform on a regular sub-grid of samples x samples x
+// samples points inside of each grid cell, which hits all six
+// tetrahedra.  Cells where any of J, C sin(h), or C cos(h) deviates
+// by more than the tolerance or that touch a degenerate color, i.e. a
+// node of non-positive lightness as we find it at the black point,
+// are flagged.  Colors in flagged cells and colors outside of the RGB
+// cube take the exact path.  The sampling does not bound the error
+// between the samples; max_error() answers the largest deviation
+// found at any sample of an unflagged cell.
+class CIECAMForwardLUT
+{
+public:
+    CIECAMForwardLUT(unsigned a_size, double a_tolerance, unsigned a_samples) :
+        size(std::max(a_size, 2U)),
+        cells(size - 1U),
+        node(3U * static_cast<size_t>(size) * size * size),
+        exact_cell(static_cast<size_t>(cells) * cells * cells, false),
+        exact_cell_count(0U),
+        max_error_(0.0)
+    {
+        sample();
+        validate(a_tolerance, std::max(a_samples, 1U));
+    }
+
+    // Answer whether the cache covers rgb and, if so, store the
+    // interpolated result in jab.
+    bool lookup(const double* rgb, double* jab) const
+    {
+        unsigned index[3];
+        double fraction[3];
+
+        for (int i = 0; i < 3; ++i)
+        {
+            if (!(rgb[i] >= 0.0 && rgb[i] <= 1.0))
+            {
+                return false;
+            }
+
+            const double t = rgb[i] * cells;
+            index[i] = std::min(static_cast<unsigned>(t), cells - 1U);
+            fraction[i] = t - index[i];
+        }
+
+        if (exact_cell[cell_index(index)])
+        {
+            return false;
+        }
+
+        interpolate(index, fraction, jab);
+
+        return true;
+    }
+
+    unsigned grid_size() const {return size;}
+    size_t number_of_cells() const {return exact_cell.size();}
+    size_t number_of_exact_cells() const {return exact_cell_count;}
+    double max_error() const {return max_error_;}
+
+private:
+    size_t node_index(const unsigned* index) const
+    {
+        return (static_cast<size_t>(index[0]) * size + index[1]) * size + index[2];
+    }
+
+    size_t cell_index(const unsigned* index) const
+    {
+        return (static_cast<size_t>(index[0]) * cells + index[1]) * cells + index[2];
+    }
+
+    // Exact transform of n colors.
+    static void exact_jab(const std::vector<double>& rgb, std::vector<double>& jab, size_t n)
+    {
+        std::vector<double> xyz(3U * n);
+        cmsDoTransform(InputToXYZTransform, rgb.data(), xyz.data(), static_cast<cmsUInt32Number>(n));
+
+        for (size_t i = 0U; i != n; ++i)
+        {
+            cmsJCh jch;
+            xyz_to_jch(&xyz[3U * i], &jch);
+            jch_to_jab(&jch, &jab[3U * i]);
+        }
+    }
+
+    void sample()
+    {
+        const size_t n = node.size() / 3U;
+        std::vector<double> rgb(3U * n);
+        const double step = 1.0 / cells;
+        unsigned index[3];
+
+        for (index[0] = 0U; index[0] != size; ++index[0])
+        {
+            for (index[1] = 0U; index[1] != size; ++index[1])
+            {
+                for (index[2] = 0U; index[2] != size; ++index[2])
+                {
+                    double* p = &rgb[3U * node_index(index)];
+                    p[0] = index[0] * step;
+                    p[1] = index[1] * step;
+                    p[2] = index[2] * step;
+                }
+            }
+        }
+
+        exact_jab(rgb, node, n);
+    }
+
+    // Walk from the lower corner of the cell to the upper one along
+    // the axes in order of decreasing fraction.  The four corners
+    // visited span the tetrahedron that contains the point.
+    void interpolate(const unsigned* index, const double* fraction, double* jab) const
+    {
+        int order[3] = {0, 1, 2};
+        if (fraction[order[0]] < fraction[order[1]]) {std::swap(order[0], order[1]);}
+        if (fraction[order[1]] < fraction[order[2]]) {std::swap(order[1], order[2]);}
+        if (fraction[order[0]] < fraction[order[1]]) {std::swap(order[0], order[1]);}
+
+        unsigned corner[3] = {index[0], index[1], index[2]};
+        const double* p = &node[3U * node_index(corner)];
+        const double w0 = 1.0 - fraction[order[0]];
+
+        jab[0] = w0 * p[0];
+        jab[1] = w0 * p[1];
+        jab[2] = w0 * p[2];
+
+        for (int k = 0; k < 3; ++k)
+        {
+            ++corner[order[k]];
+            p = &node[3U * node_index(corner)];
+            const double w = fraction[order[k]] - (k < 2 ? fraction[order[k + 1]] : 0.0);
+
+            jab[0] += w * p[0];
+            jab[1] += w * p[1];
+            jab[2] += w * p[2];
+        }
+    }
+
+    bool has_degenerate_corner(const unsigned* index) const
+    {
+        for (unsigned corner = 0U; corner != 8U; ++corner)
+        {
+            const unsigned c[3] = {index[0] + (corner & 1U), index[1] + ((corner >> 1) & 1U), index[2] + (corner >> 2)};
+            const double lightness = node[3U * node_index(c)];
+
+            if (!(lightness > 0.0))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Check one slab of cells at a time to bound the size of the
+    // scratch buffers.
+    void validate(double a_tolerance, unsigned a_samples)
+    {
+        const unsigned points_per_cell = a_samples * a_samples * a_samples;
+        std::vector<double> offset(3U * points_per_cell);
+        for (unsigned t = 0U; t != points_per_cell; ++t)
+        {
+            offset[3U * t] = (t % a_samples + 0.5) / a_samples;
+            offset[3U * t + 1U] = (t / a_samples % a_samples + 0.5) / a_samples;
+            offset[3U * t + 2U] = (t / (a_samples * a_samples) + 0.5) / a_samples;
+        }
+
+        const size_t points_per_slab = static_cast<size_t>(points_per_cell) * cells * cells;
+        std::vector<double> rgb(3U * points_per_slab);
+        std::vector<double> jab(3U * points_per_slab);
+        const double step = 1.0 / cells;
+        unsigned index[3];
+
+        for (index[0] = 0U; index[0] != cells; ++index[0])
+        {
+            size_t k = 0U;
+            for (index[1] = 0U; index[1] != cells; ++index[1])
+            {
+                for (index[2] = 0U; index[2] != cells; ++index[2])
+                {
+                    for (unsigned t = 0U; t != points_per_cell; ++t, ++k)
+                    {
+                        for (int i = 0; i < 3; ++i)
+                        {
+                            rgb[3U * k + i] = (index[i] + offset[3U * t + i]) * step;
+                        }
+                    }
+                }
+            }
+
+            exact_jab(rgb, jab, points_per_slab);
+
+            k = 0U;
+            for (index[1] = 0U; index[1] != cells; ++index[1])
+            {
+                for (index[2] = 0U; index[2] != cells; ++index[2])
+                {
+                    bool exact = has_degenerate_corner(index);
+                    double cell_error = 0.0;
+
+                    for (unsigned t = 0U; t != points_per_cell; ++t, ++k)
+                    {
+                        double interpolated[3];
+                        interpolate(index, &offset[3U * t], interpolated);
+
+                        for (int i = 0; i < 3; ++i)
+                        {
+                            const double error = std::abs(interpolated[i] - jab[3U * k + i]);
+                            if (!(error <= a_tolerance))
+                            {
+                                exact = true;
+                            }
+                            cell_error = std::max(cell_error, error);
+                        }
+                    }
+
+                    if (exact)
+                    {
+                        exact_cell[cell_index(index)] = true;
+                        ++exact_cell_count;
+                    }
+                    else
+                    {
+                        max_error_ = std::max(max_error_, cell_error);
+                    }
+                }
+            }
+        }
+    }
+
+    const unsigned size;
+    const unsigned cells;
+    std::vector<double> node;
+    std::vector<bool> exact_cell;
+    size_t exact_cell_count;
+    double max_error_;
+};
+
+
+inline CIECAMForwardLUT*
+make_ciecam_forward_lut()
+{
+    if (!parameter::as_boolean("ciecam-lut", false))
+    {
+        return nullptr;
+    }
+
+    CIECAMForwardLUT* lut =
+        new CIECAMForwardLUT(parameter::as_unsigned("ciecam-lut-size", 33U),
+                             parameter::as_double("ciecam-lut-tolerance", 0.05),
+                             parameter::as_unsigned("ciecam-lut-samples", 3U));
+
+    if (Verbose >= VERBOSE_COLOR_CONVERSION_MESSAGES)
+    {
+        std::cerr << command << ": info: CIECAM02 lookup table of " << lut->grid_size() <<
+            "^3 nodes; " << lut->number_of_exact_cells() << " of " << lut->number_of_cells() <<
+            " cells use exact transform\n" <<
+            command << ": info: largest interpolation error at validation samples " <<
+            lut->max_error() << std::endl;
+    }
+
+    return lut;
+}
+
+
+// Answer the forward CIECAM02 cache or nullptr if the user has not
+// enabled it.  The ICC profile and the viewing conditions do not
+// change during a run, so we build the cache once on first use.
+inline const CIECAMForwardLUT*
+ciecam_forward_lut()
+{
+    static const std::unique_ptr<const CIECAMForwardLUT> lut {make_ciecam_forward_lut()};
+
+    return lut.get();
+}
+
+
 //
 // Fixed point converter that uses ICC profile transformation and JCh color space
 //
@@ -1416,50 +1926,108 @@ class ConvertVectorToJCHPyramidFunctor :
 public:
     ConvertVectorToJCHPyramidFunctor() :
         converter(),
-        rgb_source_scale(1.0 / SrcTraits::toRealPromote(SrcTraits::max()))
+        rgb_source_scale(1.0 / SrcTraits::toRealPromote(SrcTraits::max())),
+        lut(ciecam_forward_lut())
     {}
 
     PyramidVectorType operator()(const SrcVectorType& v) const
     {
-        // rgb values must be in range [0, 1]
-        const double rgb[] = {
-            rgb_source_scale * SrcTraits::toRealPromote(v.red()),
-            rgb_source_scale * SrcTraits::toRealPromote(v.green()),
-            rgb_source_scale * SrcTraits::toRealPromote(v.blue())
-        };
-        cmsJCh jch;
+        double rgb[3];
+        double jab[3];
 
-        rgb_to_jch(rgb, &jch);
+        rgb_of_source(v, rgb);
+        if (!(lut && lut->lookup(rgb, jab)))
+        {
+            double xyz[3];
+            cmsDoTransform(InputToXYZTransform, rgb, xyz, 1U);
+            jab_of_xyz(xyz, jab);
+        }
+
+        return pyramid_of_jab(jab);
+    }
+
+    // Convert a whole row with a single call to LittleCMS.  If the
+    // cache is enabled, only the colors it cannot answer go through
+    // LittleCMS.
+    template <class SrcRowIterator, class SrcAccessor, class DestRowIterator, class DestAccessor>
+    void transform_row(SrcRowIterator src, SrcRowIterator src_end, SrcAccessor sa,
+                       DestRowIterator dest, DestAccessor da) const
+    {
+        const size_t n = src_end - src;
+        rgb_row.resize(3U * n);
+        xyz_row.resize(3U * n);
+        jab_row.resize(3U * n);
+        miss_row.clear();
 
-        const double theta = radian_of_degree(jch.h);
+        // Gather the colors that need the exact transform at the
+        // front of rgb_row.
+        for (size_t i = 0U; src != src_end; ++src, ++i)
+        {
+            double* rgb = &rgb_row[3U * i];
+            rgb_of_source(sa(src), rgb);
 
-        return PyramidVectorType(converter(Scale::scale_lightness_for_pyramid(jch.J)),
-                                 converter(Scale::scale_chroma_hue_x_for_pyramid(jch.C, theta)),
-                                 converter(Scale::scale_chroma_hue_y_for_pyramid(jch.C, theta)));
+            if (!(lut && lut->lookup(rgb, &jab_row[3U * i])))
+            {
+                // The target never lies behind rgb; until the first
+                // hit it is rgb itself and copying would overlap.
+                double* const miss_rgb = &rgb_row[3U * miss_row.size()];
+                if (miss_rgb != rgb)
+                {
+                    std::copy(rgb, rgb + 3, miss_rgb);
+                }
+                miss_row.push_back(i);
+            }
+        }
+
+        if (!miss_row.empty())
+        {
+            cmsDoTransform(InputToXYZTransform, rgb_row.data(), xyz_row.data(),
+                           static_cast<cmsUInt32Number>(miss_row.size()));
+
+            for (size_t k = 0U; k != miss_row.size(); ++k)
+            {
+                jab_of_xyz(&xyz_row[3U * k], &jab_row[3U * miss_row[k]]);
+            }
+        }
+
+        const double* jab = jab_row.data();
+        for (size_t i = 0U; i != n; ++i, ++dest, jab += 3)
+        {
+            da.set(pyramid_of_jab(jab), dest);
+        }
     }
 
 protected:
-    double radian_of_degree(double x) const
+    // rgb values must be in range [0, 1]
+    void rgb_of_source(const SrcVectorType& v, double* rgb) const
     {
-        return x * (M_PI / 180.0);
+        rgb[0] = rgb_source_scale * SrcTraits::toRealPromote(v.red());
+        rgb[1] = rgb_source_scale * SrcTraits::toRealPromote(v.green());
+        rgb[2] = rgb_source_scale * SrcTraits::toRealPromote(v.blue());
     }
 
-    void rgb_to_jch(const double* rgb, cmsJCh* jch) const
+    void jab_of_xyz(const double* xyz, double* jab) const
     {
-        double xyz[3];
-        cmsDoTransform(InputToXYZTransform, rgb, xyz, 1U);
+        cmsJCh jch;
 
-        const cmsCIEXYZ scaled_xyz = {XYZ_SCALE * xyz[0], XYZ_SCALE * xyz[1], XYZ_SCALE * xyz[2]};
-        cmsJCh jch_unlimited;
-        cmsCIECAM02Forward(CIECAMTransform, &scaled_xyz, &jch_unlimited);
+        xyz_to_jch(xyz, &jch);
+        jch_to_jab(&jch, jab);
+    }
 
-        jch->J = EXPECT_RESULT(std::isnan(jch_unlimited.J), false) ? 0.0 : jch_unlimited.J;
-        jch->C = EXPECT_RESULT(std::isnan(jch_unlimited.C), false) ? 0.0 : jch_unlimited.C;
-        jch->h = wrap_cyclically(jch_unlimited.h, Scale::MAXIMUM_HUE);
+    PyramidVectorType pyramid_of_jab(const double* jab) const
+    {
+        return PyramidVectorType(converter(Scale::scale_lightness_for_pyramid(jab[0])),
+                                 converter(Scale::scale_chroma_component_for_pyramid(jab[1])),
+                                 converter(Scale::scale_chroma_component_for_pyramid(jab[2])));
     }
 
     ConvertFunctorType converter;
     const double rgb_source_scale;
+    mutable std::vector<double> rgb_row;
+    mutable std::vector<double> xyz_row;
+    mutable std::vector<double> jab_row;
+    mutable std::vector<size_t> miss_row;
+    const CIECAMForwardLUT* lut;
 };
 
 
@@ -1852,6 +2420,75 @@ public:
     }
 
     DestVectorType operator()(const PyramidVectorType& v) const
+    {
+        const cmsJCh jch = jch_of_pyramid(v);
+
+        if (EXPECT_RESULT(jch.J <= 0.0, false))
+        {
+            return dest_of_nonpositive_lightness();
+        }
+
+        double rgb[3];
+        jch_to_rgb(&jch, rgb);
+
+        return dest_of_jch_and_rgb(jch, rgb);
+    }
+
+    // Convert all pixels of a row that are inside of the mask with a
+    // single call to LittleCMS for the XYZ-to-RGB step.  The CIECAM02
+    // model and the optimizers still work pixel by pixel.
+    template <class SrcRowIterator, class SrcAccessor,
+              class MaskRowIterator, class MaskAccessor,
+              class DestRowIterator, class DestAccessor>
+    void transform_row_if(SrcRowIterator src, SrcRowIterator src_end, SrcAccessor sa,
+                          MaskRowIterator mask, MaskAccessor ma,
+                          DestRowIterator dest, DestAccessor da) const
+    {
+        jch_row.clear();
+        xyz_row.clear();
+        MaskRowIterator m(mask);
+        for (SrcRowIterator s = src; s != src_end; ++s, ++m)
+        {
+            if (ma(m))
+            {
+                const cmsJCh jch = jch_of_pyramid(sa(s));
+                double xyz[3] = {0.0, 0.0, 0.0};
+
+                if (EXPECT_RESULT(jch.J > 0.0, true))
+                {
+                    jch_to_xyz(&jch, xyz);
+                }
+                jch_row.push_back(jch);
+                xyz_row.insert(xyz_row.end(), xyz, xyz + 3);
+            }
+        }
+        if (jch_row.empty())
+        {
+            return;
+        }
+
+        rgb_row.resize(xyz_row.size());
+        cmsDoTransform(XYZToInputTransform, xyz_row.data(), rgb_row.data(),
+                       static_cast<cmsUInt32Number>(jch_row.size()));
+
+        const cmsJCh* jch = jch_row.data();
+        double* rgb = rgb_row.data();
+        for (SrcRowIterator s = src; s != src_end; ++s, ++mask, ++dest)
+        {
+            if (ma(mask))
+            {
+                da.set(EXPECT_RESULT(jch->J <= 0.0, false) ?
+                       dest_of_nonpositive_lightness() :
+                       dest_of_jch_and_rgb(*jch, rgb),
+                       dest);
+                ++jch;
+                rgb += 3;
+            }
+        }
+    }
+
+protected:
+    cmsJCh jch_of_pyramid(const PyramidVectorType& v) const
     {
         const double j = converter(v.red());
         const double ch_x = converter(v.green());
@@ -1862,18 +2499,22 @@ public:
             Scale::scale_hue_of_pyramid(ch_x, ch_y)
         };
 
-        if (EXPECT_RESULT(jch.J <= 0.0, false))
-        {
-            // Lasciate ogne speranza, voi ch'intrate.
-            return
-                parameter::as_boolean("mark-freaky-color-conversions", false) ?
-                DestVectorType(DestTraits::max(), DestTraits::max(), 0) : // yellow
-                DestVectorType(0, 0, 0);
-        }
+        return jch;
+    }
 
-        double rgb[3];
-        jch_to_rgb(&jch, rgb);
+    DestVectorType dest_of_nonpositive_lightness() const
+    {
+        // Lasciate ogne speranza, voi ch'intrate.
+        return
+            markFreakyColorConversions() ?
+            DestVectorType(DestTraits::max(), DestTraits::max(), 0) : // yellow
+            DestVectorType(0, 0, 0);
+    }
 
+    // Answer the destination pixel given the color appearance jch
+    // and the RGB values LittleCMS derived from it.  We may modify rgb.
+    DestVectorType dest_of_jch_and_rgb(const cmsJCh& jch, double* rgb) const
+    {
         // Implementation Notes
         //
         //         New LittleCMS versions use "open color space" arithmetics, which means color
@@ -1941,7 +2582,7 @@ public:
                 std::cout << "\n";
                 ciecam_detail::show_jch_rgb("+ stubborn highlight:", &jch);
             }
-            if (parameter::as_boolean("mark-freaky-color-conversions", false))
+            if (markFreakyColorConversions())
             {
                 // navy blue
                 rgb[0] = 0.0;
@@ -1959,7 +2600,7 @@ public:
                 std::cout << "\n";
                 ciecam_detail::show_jch_rgb("+ stubborn shadow:", &jch);
             }
-            if (parameter::as_boolean("mark-freaky-color-conversions", false))
+            if (markFreakyColorConversions())
             {
                 // yellow
                 rgb[0] = 1.0;
@@ -1976,9 +2617,11 @@ public:
                               DestTraits::fromRealPromote(rgb_dest_scale * rgb[2]));
     }
 
-protected:
     ConvertFunctorType converter;
     const double rgb_dest_scale;
+    mutable std::vector<cmsJCh> jch_row;
+    mutable std::vector<double> xyz_row;
+    mutable std::vector<double> rgb_row;
 
     const double highlight_lightness_guess_1d_factor;
     const double highlight_lightness_guess_1d_offset;
@@ -2076,9 +2719,9 @@ copyToPyramidImage(typename SrcImageType::const_traverser src_upperleft,
             }
             std::cerr << "\n";
         }
-        vigra::omp::transformImage(src_upperleft, src_lowerright, sa,
-                                   dest_upperleft, da,
-                                   ConverterLab());
+        vigra::omp::transformImageRows(src_upperleft, src_lowerright, sa,
+                                       dest_upperleft, da,
+                                       ConverterLab());
         break;
 
     case CIELUV:
@@ -2091,9 +2734,9 @@ copyToPyramidImage(typename SrcImageType::const_traverser src_upperleft,
             }
             std::cerr << "\n";
         }
-        vigra::omp::transformImage(src_upperleft, src_lowerright, sa,
-                                   dest_upperleft, da,
-                                   ConverterLuv());
+        vigra::omp::transformImageRows(src_upperleft, src_lowerright, sa,
+                                       dest_upperleft, da,
+                                       ConverterLuv());
         break;
 
     case CIECAM:
@@ -2106,9 +2749,9 @@ copyToPyramidImage(typename SrcImageType::const_traverser src_upperleft,
             }
             std::cerr << "\n";
         }
-        vigra::omp::transformImage(src_upperleft, src_lowerright, sa,
-                                   dest_upperleft, da,
-                                   ConverterJCH());
+        vigra::omp::transformImageRows(src_upperleft, src_lowerright, sa,
+                                       dest_upperleft, da,
+                                       ConverterJCH());
         break;
 
     default:
@@ -2221,10 +2864,10 @@ copyFromPyramidImageIf(typename PyramidImageType::const_traverser src_upperleft,
         {
             std::cerr << command << ": info: CIELAB color conversion" << std::endl;
         }
-        vigra::omp::transformImageIf(src_upperleft, src_lowerright, sa,
-                                     mask_upperleft, ma,
-                                     dest_upperleft, da,
-                                     ConverterLab());
+        vigra::omp::transformImageRowsIf(src_upperleft, src_lowerright, sa,
+                                         mask_upperleft, ma,
+                                         dest_upperleft, da,
+                                         ConverterLab());
         break;
 
     case CIELUV:
@@ -2232,10 +2875,10 @@ copyFromPyramidImageIf(typename PyramidImageType::const_traverser src_upperleft,
         {
             std::cerr << command << ": info: CIELUV color conversion" << std::endl;
         }
-        vigra::omp::transformImageIf(src_upperleft, src_lowerright, sa,
-                                     mask_upperleft, ma,
-                                     dest_upperleft, da,
-                                     ConverterLuv());
+        vigra::omp::transformImageRowsIf(src_upperleft, src_lowerright, sa,
+                                         mask_upperleft, ma,
+                                         dest_upperleft, da,
+                                         ConverterLuv());
         break;
 
     case CIECAM:
@@ -2243,10 +2886,10 @@ copyFromPyramidImageIf(typename PyramidImageType::const_traverser src_upperleft,
         {
             std::cerr << command << ": info: CIECAM02 color conversion" << std::endl;
         }
-        vigra::omp::transformImageIf(src_upperleft, src_lowerright, sa,
-                                     mask_upperleft, ma,
-                                     dest_upperleft, da,
-                                     ConverterJCH());
+        vigra::omp::transformImageRowsIf(src_upperleft, src_lowerright, sa,
+                                         mask_upperleft, ma,
+                                         dest_upperleft, da,
+                                         ConverterJCH());
         break;
 
     default:
@@ -30,9 +30,13 @@
 #endif
 
 #include <stdlib.h>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
 #include <utility>
 #include <queue>
 #include <unordered_set>
+#include <vector>
 
 #include <vigra/functorexpression.hxx>
 #include <vigra/inspectimage.hxx>
@@ -54,6 +58,8 @@
 #include "maskcommon.h"
 #include "masktypedefs.h"
 #include "nearest.h"
+#include "openmp_def.h"
+#include "parameter.h"
 
 
 using namespace vigra::functor;
@@ -68,17 +74,24 @@ using namespace vigra::functor;
 #define LABEL_LEFT 1
 #define LABEL_RIGHT 2
 
+// Default budget in MB for the A* workspaces of concurrently solved
+// sub-cuts; see A_star_subcuts().
+#define SUBCUT_WORKSPACE_BUDGET_MB 256U
+
 
 //#define DEBUG_GRAPHCUT
 
 
 namespace enblend
 {
-    template <class T>
-    inline void hash_combine(std::size_t & seed, const T & value)
-    {
-        std::hash<T> hasher;
-        seed ^= hasher(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    // Defined in enblend.cc.
+    extern parameter::handle<bool> graphcutScanlineFill;
+
+    template <class T>
+    inline void hash_combine(std::size_t & seed, const T & value)
+    {
+        std::hash<T> hasher;
+        seed ^= hasher(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     }
 
     struct pointHash
@@ -717,6 +730,328 @@ namespace enblend
     }
 
 
+    // State of the flat-array A* engine.  Nodes of the dual graph sit
+    // at odd coordinates of the graph image, so we index them by
+    // halving their coordinates.  The workspace outlives a single
+    // sub-cut: it carries the paths of the earlier sub-cuts in
+    // NODE_VISITED and resets only the nodes the last search touched.
+    template <typename ScoreType>
+    class AStarWorkspace
+    {
+    public:
+        enum {
+            NODE_DIRECTION = BIT_MASK_DIR, // direction towards the predecessor, encoded as in tracePath()
+            NODE_OPEN = 0x04,              // discovered in the current search
+            NODE_SOURCE = 0x08,            // neighbour of the virtual source, i.e. a top checkpoint
+            NODE_SINK = 0x10,              // neighbour of the virtual sink, i.e. a bottom checkpoint
+            NODE_VISITED = 0x20            // on the path of an earlier sub-cut
+        };
+
+        typedef std::pair<ScoreType, size_t> QueueEntry;
+
+        explicit AStarWorkspace(vigra::Diff2D a_graph_size) :
+            width(a_graph_size.x / 2), height(a_graph_size.y / 2),
+            state(static_cast<size_t>(width) * height, 0U),
+            score(static_cast<size_t>(width) * height)
+        {}
+
+        // Answer the number of bytes of the fixed-size arrays of a
+        // workspace for a graph of the given size.
+        static size_t bytes(vigra::Diff2D a_graph_size)
+        {
+            return static_cast<size_t>(a_graph_size.x / 2) * static_cast<size_t>(a_graph_size.y / 2) *
+                (sizeof(unsigned char) + sizeof(ScoreType));
+        }
+
+        bool contains(const vigra::Point2D& p) const
+        {
+            return p.x >= 0 && p.y >= 0 && p.x / 2 < width && p.y / 2 < height;
+        }
+
+        size_t index(const vigra::Point2D& p) const
+        {
+            return static_cast<size_t>(p.y / 2) * width + p.x / 2;
+        }
+
+        vigra::Point2D point(size_t i) const
+        {
+            return vigra::Point2D(2 * static_cast<int>(i % width) + 1, 2 * static_cast<int>(i / width) + 1);
+        }
+
+        template <class Iterator>
+        void markVisited(Iterator begin, Iterator end)
+        {
+            for (Iterator p = begin; p != end; ++p) {
+                if (contains(*p)) {
+                    state[index(*p)] |= NODE_VISITED;
+                }
+            }
+        }
+
+        // Forget everything but the paths of earlier sub-cuts.
+        void reset()
+        {
+            for (std::vector<size_t>::const_iterator i = touched.begin(); i != touched.end(); ++i) {
+                state[*i] &= NODE_VISITED;
+            }
+            touched.clear();
+            queue.clear();
+        }
+
+        void mark(size_t i, unsigned char flags)
+        {
+            if ((state[i] & ~NODE_VISITED) == 0U) {
+                touched.push_back(i);
+            }
+            state[i] |= flags;
+        }
+
+        // Open node i with a score and its direction towards the
+        // predecessor and put it on the queue.
+        void open(size_t i, ScoreType a_score, unsigned char direction)
+        {
+            mark(i, NODE_OPEN | direction);
+            score[i] = a_score;
+            queue.push_back(QueueEntry(a_score, i));
+            std::push_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+        }
+
+        QueueEntry pop()
+        {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+            const QueueEntry top = queue.back();
+            queue.pop_back();
+            return top;
+        }
+
+        const int width;
+        const int height;
+        std::vector<unsigned char> state;
+        std::vector<ScoreType> score;
+        std::vector<size_t> touched;
+        std::vector<QueueEntry> queue; // binary min-heap; ties go to the lower index
+    };
+
+
+    // Flat-array variant of A_star().  It finds the same kind of path,
+    // but keeps the node state in a workspace instead of the graph
+    // image and hash sets, and queues the scores along with the node
+    // indices, so that no comparison looks up the graph image.  The
+    // virtual source and sink are explicit: the source opens all top
+    // checkpoints with score zero; the sink keeps the best score of
+    // any bottom checkpoint that reaches it.  Nodes of equal score may
+    // be expanded in a different order than with A_star().
+    template <class ImageType, class GradientImageType>
+    std::vector<vigra::Point2D>*
+    A_star_flat(ImageType* img, GradientImageType* gradientX, GradientImageType* gradientY,
+                vigra::Diff2D bounds, CheckpointPixels* srcDestPoints,
+                AStarWorkspace<typename ImageType::value_type>* workspace)
+    {
+        typedef typename ImageType::value_type ScoreType;
+        typedef AStarWorkspace<ScoreType> Workspace;
+        typedef typename Workspace::QueueEntry QueueEntry;
+
+        const vigra::Diff2D step[4] = {vigra::Diff2D(0, -2), vigra::Diff2D(2, 0),
+                                       vigra::Diff2D(0, 2), vigra::Diff2D(-2, 0)};
+        long iterCount = 0;
+        long totalScore = 0;
+        bool destOpen = false;
+        size_t destNeighbour = 0;
+
+        workspace->reset();
+
+        for (std::unordered_set<vigra::Point2D, pointHash>::const_iterator x = srcDestPoints->bottom.begin();
+             x != srcDestPoints->bottom.end();
+             ++x) {
+            if (workspace->contains(*x)) {
+                workspace->mark(workspace->index(*x), Workspace::NODE_SINK);
+            }
+        }
+
+        // expand the virtual source
+        for (std::unordered_set<vigra::Point2D, pointHash>::const_iterator x = srcDestPoints->top.begin();
+             x != srcDestPoints->top.end();
+             ++x) {
+            if (workspace->contains(*x)) {
+                const size_t i = workspace->index(*x);
+                if ((workspace->state[i] & Workspace::NODE_OPEN) == 0U) {
+                    workspace->open(i, ScoreType(0), 0U);
+                }
+                workspace->mark(i, Workspace::NODE_SOURCE);
+            }
+        }
+
+        while (!workspace->queue.empty()) {
+            // the virtual sink is next in line
+            if (destOpen && workspace->queue.front().first >= totalScore) {
+                break;
+            }
+
+            const QueueEntry entry = workspace->pop();
+            const vigra::Point2D current = workspace->point(entry.second);
+            iterCount++;
+
+            if (workspace->state[entry.second] & Workspace::NODE_SINK) {
+                const long score = entry.first + getEdgeWeight(0, current, img, true, bounds);
+                if (!destOpen || score < totalScore) {
+                    destOpen = true;
+                    totalScore = score;
+                    destNeighbour = entry.second;
+                }
+                continue;
+            }
+
+            for (int i = 0; i < 4; i++) {
+                const vigra::Point2D neighbour = current + step[i];
+
+                if (neighbour.x < 1 || neighbour.x > bounds.x - 1 ||
+                    neighbour.y < 1 || neighbour.y > bounds.y - 1) {
+                    continue;
+                }
+
+                const size_t n = workspace->index(neighbour);
+                if (workspace->state[n] & (Workspace::NODE_OPEN | Workspace::NODE_VISITED)) {
+                    continue;
+                }
+
+                int gradientA;
+                int gradientB;
+                if (i % 2 == 0) {
+                    gradientA = std::abs((*gradientY)[current / 2]);
+                    gradientB = std::abs((*gradientY)[neighbour / 2]);
+                } else {
+                    gradientA = std::abs((*gradientX)[current / 2]);
+                    gradientB = std::abs((*gradientX)[neighbour / 2]);
+                }
+
+                long score = entry.first;
+                if (gradientA + gradientB > 0) {
+                    score += getEdgeWeight(i, current, img, false, bounds) * (gradientA + gradientB);
+                } else {
+                    score += getEdgeWeight(i, current, img, false, bounds);
+                }
+
+                workspace->open(n, ScoreType(score), static_cast<unsigned char>(i ^ BIT_MASK_OPDIR));
+            }
+        }
+
+        if (!destOpen) {
+#ifdef DEBUG_GRAPHCUT
+            std::cout << "Graphcut failed after visiting " << iterCount << " nodes" << std::endl;
+#endif
+            return new std::vector<vigra::Point2D>();
+        }
+
+#ifdef DEBUG_GRAPHCUT
+        std::cout << "Graphcut completed after visiting " << iterCount << " nodes" << std::endl;
+#endif
+
+        // trace back from the sink to the source
+        std::vector<vigra::Point2D>* path = new std::vector<vigra::Point2D>;
+        size_t current = destNeighbour;
+        path->push_back(workspace->point(current));
+        do {
+            const vigra::Point2D next =
+                workspace->point(current) + step[workspace->state[current] & Workspace::NODE_DIRECTION];
+            path->push_back(next);
+            if (!workspace->contains(next)) {
+                break;
+            }
+            current = workspace->index(next);
+        } while ((workspace->state[current] & Workspace::NODE_SOURCE) == 0U);
+
+        return path;
+    }
+
+
+    // Solve the sub-cuts between consecutive checkpoints concurrently.
+    // Each sub-cut first runs on its own, ignoring the paths of all
+    // other sub-cuts.  Afterwards we reconcile the paths in order: a
+    // path that does not cross any path accepted before it (apart from
+    // the checkpoint it shares with its predecessor) stands; any other
+    // one we solve again with the accepted paths as obstacles, just
+    // like the serial loop does.  Sub-cuts in disjoint parts of the
+    // overlap thus never wait for each other.  The result does not
+    // depend on the number of threads.
+    //
+    // Every thread needs a workspace that spans the whole graph, so we
+    // run at most as many threads as there are sub-cuts and as fit
+    // into the memory budget "graphcut-subcut-memory" (in MB).  Each
+    // thread reuses its workspace for all of its sub-cuts.
+    template <class ImageType, class GradientImageType>
+    std::vector<std::vector<vigra::Point2D>*>
+    A_star_subcuts(const std::vector<vigra::Point2D>& checkpoints, ImageType* img,
+                   GradientImageType* gradientX, GradientImageType* gradientY,
+                   vigra::Diff2D graphsize)
+    {
+        typedef typename ImageType::value_type ScoreType;
+        typedef AStarWorkspace<ScoreType> Workspace;
+
+        const vigra::Diff2D bounds = graphsize - vigra::Diff2D(1, 1);
+        const int numberOfSubCuts = std::max(static_cast<int>(checkpoints.size()) - 1, 0);
+        std::vector<std::vector<vigra::Point2D>*> paths(numberOfSubCuts, nullptr);
+
+        const size_t budget =
+            static_cast<size_t>(parameter::as_unsigned("graphcut-subcut-memory", SUBCUT_WORKSPACE_BUDGET_MB)) << 20;
+        const size_t workspaceBytes = std::max(Workspace::bytes(graphsize), static_cast<size_t>(1));
+        const int numberOfThreads =
+            static_cast<int>(std::max(static_cast<size_t>(1),
+                                      std::min(std::min(static_cast<size_t>(numberOfSubCuts),
+                                                        static_cast<size_t>(omp_get_max_threads())),
+                                               budget / workspaceBytes)));
+
+#ifdef OPENMP
+#pragma omp parallel num_threads(numberOfThreads) if (numberOfThreads >= 2)
+#endif
+        {
+            Workspace workspace(graphsize);
+
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+            for (int k = 0; k < numberOfSubCuts; ++k) {
+                CheckpointPixels srcDestPoints;
+                srcDestPoints.top.insert(checkpoints[k]);
+                srcDestPoints.bottom.insert(checkpoints[k + 1]);
+
+                paths[k] = A_star_flat<ImageType, GradientImageType>
+                    (img, gradientX, gradientY, bounds, &srcDestPoints, &workspace);
+            }
+        } // omp parallel
+
+        Workspace accepted(graphsize);
+        for (int k = 0; k < numberOfSubCuts; ++k) {
+            std::vector<vigra::Point2D>* path = paths[k];
+            bool crossing = false;
+
+            // the last point of a path is the checkpoint shared with the previous sub-cut
+            for (std::vector<vigra::Point2D>::const_iterator p = path->begin();
+                 !path->empty() && p != path->end() - 1 && !crossing;
+                 ++p) {
+                crossing = accepted.contains(*p) && (accepted.state[accepted.index(*p)] & Workspace::NODE_VISITED);
+            }
+
+            if (crossing) {
+#ifdef DEBUG_GRAPHCUT
+                std::cout << "Re-running graph-cut " << k << " after crossing" << std::endl;
+#endif
+                CheckpointPixels srcDestPoints;
+                srcDestPoints.top.insert(checkpoints[k]);
+                srcDestPoints.bottom.insert(checkpoints[k + 1]);
+
+                delete path;
+                path = A_star_flat<ImageType, GradientImageType>
+                    (img, gradientX, gradientY, bounds, &srcDestPoints, &accepted);
+                paths[k] = path;
+            }
+
+            accepted.markVisited(path->begin(), path->end());
+        }
+
+        return paths;
+    }
+
+
     vigra::Point2D convertFromDual(const vigra::Point2D& dualPixel)
     {
         const int stride = 2;
@@ -724,9 +1059,43 @@ namespace enblend
     }
 
 
+    // Collect the pixels of the cut in a label image instead of a set.
+    // The label image has a one-pixel border, so pixel (x, y) of the
+    // cut goes to (x + 1, y + 1); pixels outside the image are
+    // dropped.  As in OutputLabelingFunctor, left wins if a pixel lies
+    // on both sides of the cut.
+    template <class LabelImageType>
+    class CutSideMarker
+    {
+    public:
+        typedef typename LabelImageType::value_type LabelType;
+
+        CutSideMarker(LabelImageType* a_label_image, LabelType a_label) :
+            image(a_label_image), label(a_label) {}
+
+        void insert(const vigra::Point2D& p)
+        {
+            const vigra::Point2D q(p + vigra::Diff2D(1, 1));
+
+            if (q.x >= 0 && q.y >= 0 && q.x < image->width() && q.y < image->height()) {
+                LabelType& current = (*image)[q];
+                if (label == LABEL_LEFT || current != LABEL_LEFT) {
+                    current = label;
+                }
+            }
+        }
+
+    protected:
+        LabelImageType* image;
+        const LabelType label;
+    };
+
+
+    // PixelSetType is either a set of points or a CutSideMarker.
+    template <class PixelSetType>
     void dividePath(std::vector<vigra::Point2D>* cut,
-                    std::unordered_set<vigra::Point2D, pointHash>* left,
-                    std::unordered_set<vigra::Point2D, pointHash>* right,
+                    PixelSetType* left,
+                    PixelSetType* right,
                     const vigra::Rect2D& iBB)
     {
         vigra::Point2D previous;
@@ -1205,6 +1574,90 @@ namespace enblend
     }
 
 
+    // Fill each run of unlabeled pixels along a line of labels from
+    // its labeled ends; a run with two labeled ends is split in the
+    // middle.  Answer the number of pixels filled.
+    template <typename LabelType>
+    inline int
+    fillCutLabelRuns(LabelType* line, int length, std::ptrdiff_t stride)
+    {
+        int changes = 0;
+        int i = 0;
+
+        while (i < length) {
+            if (line[i * stride] != LABEL_NONE) {
+                ++i;
+                continue;
+            }
+
+            const int begin = i;
+            while (i < length && line[i * stride] == LABEL_NONE) {
+                ++i;
+            }
+
+            const LabelType before = begin > 0 ? line[(begin - 1) * stride] : LabelType(LABEL_NONE);
+            const LabelType after = i < length ? line[i * stride] : LabelType(LABEL_NONE);
+            if (before == LABEL_NONE && after == LABEL_NONE) {
+                continue;
+            }
+
+            const int middle =
+                before == LABEL_NONE ? begin : (after == LABEL_NONE ? i : begin + (i - begin + 1) / 2);
+            for (int j = begin; j < middle; ++j) {
+                line[j * stride] = before;
+            }
+            for (int j = middle; j < i; ++j) {
+                line[j * stride] = after;
+            }
+            changes += i - begin;
+        }
+
+        return changes;
+    }
+
+
+    // Grow the left and right labels of the cut into the unlabeled
+    // pixels with scanline fills, first of all rows in parallel, then
+    // of all columns in parallel, until nothing changes.  This is not
+    // seeded region growing: a 4-connected region bordered by one
+    // label only gets that label, but in a region bordered by both
+    // labels, as behind a cut that does not close, each gap is split
+    // between its ends in the order of the sweeps, not by the distance
+    // to the seeds.  Pixels no label reaches stay unlabeled.
+    template <class LabelImageType>
+    void
+    fillCutLabels(LabelImageType& labels)
+    {
+        typedef typename LabelImageType::value_type LabelType;
+
+        const int width = labels.width();
+        const int height = labels.height();
+        if (width == 0 || height == 0) {
+            return;
+        }
+        const std::ptrdiff_t rowStride = height >= 2 ? labels[1] - labels[0] : 0;
+        int changes;
+
+        do {
+            changes = 0;
+
+#ifdef OPENMP
+#pragma omp parallel for reduction(+: changes) schedule(static)
+#endif
+            for (int y = 0; y < height; ++y) {
+                changes += fillCutLabelRuns<LabelType>(labels[y], width, 1);
+            }
+
+#ifdef OPENMP
+#pragma omp parallel for reduction(+: changes) schedule(static)
+#endif
+            for (int x = 0; x < width; ++x) {
+                changes += fillCutLabelRuns<LabelType>(labels[0] + x, height, rowStride);
+            }
+        } while (changes != 0);
+    }
+
+
     template <class DestImageIterator, class DestAccessor,
               class MaskImageIterator, class MaskAccessor, class MaskPixelType>
     void
@@ -1223,27 +1676,38 @@ namespace enblend
         typedef vigra::NumericTraits<BasePixelType> BasePixelTraits;
         typedef vigra::NumericTraits<MaskPixelType> MaskPixelTraits;
 
-        std::unordered_set<vigra::Point2D, pointHash> pixelsLeftOfCut;
-        std::unordered_set<vigra::Point2D, pointHash> pixelsRightOfCut;
+        if (graphcutScanlineFill()) {
+            // tempImg starts out as all LABEL_NONE
+            CutSideMarker<IMAGETYPE<MaskPixelType> > pixelsLeftOfCut(&tempImg, LABEL_LEFT);
+            CutSideMarker<IMAGETYPE<MaskPixelType> > pixelsRightOfCut(&tempImg, LABEL_RIGHT);
+
+            dividePath(&totalDualPath, &pixelsLeftOfCut, &pixelsRightOfCut, iBB);
 
-        dividePath(&totalDualPath, &pixelsLeftOfCut, &pixelsRightOfCut, iBB);
+            vigra::copyImage(srcImageRange(tempImg), destImage(finalmask));
+            fillCutLabels(finalmask);
+        } else {
+            std::unordered_set<vigra::Point2D, pointHash> pixelsLeftOfCut;
+            std::unordered_set<vigra::Point2D, pointHash> pixelsRightOfCut;
+
+            dividePath(&totalDualPath, &pixelsLeftOfCut, &pixelsRightOfCut, iBB);
 
 #ifdef DEBUG_GRAPHCUT
-        vigra::omp::combineTwoImages(srcIterRange(Diff2D(), size),
-                                     vigra::srcIter(finalmask.upperLeft()),
-                                     vigra::destIter(tempImg.upperLeft()),
-                                     CutPixelsFunctor<MaskPixelType>(&pixelsLeftOfCut, &pixelsRightOfCut));
-        exportImage(srcImageRange(tempImg), ImageExportInfo("./debug/process_cut_1_seam_pixels.tif").setPixelType("UINT8"));
+            vigra::omp::combineTwoImages(srcIterRange(Diff2D(), size),
+                                         vigra::srcIter(finalmask.upperLeft()),
+                                         vigra::destIter(tempImg.upperLeft()),
+                                         CutPixelsFunctor<MaskPixelType>(&pixelsLeftOfCut, &pixelsRightOfCut));
+            exportImage(srcImageRange(tempImg), ImageExportInfo("./debug/process_cut_1_seam_pixels.tif").setPixelType("UINT8"));
 #endif
 
-        vigra::transformImage(srcIterRange(vigra::Diff2D(), size), vigra::destIter(tempImg.upperLeft()),
-                                OutputLabelingFunctor<MaskPixelType>(&pixelsLeftOfCut, &pixelsRightOfCut, iBB.upperLeft()));
+            vigra::transformImage(srcIterRange(vigra::Diff2D(), size), vigra::destIter(tempImg.upperLeft()),
+                                  OutputLabelingFunctor<MaskPixelType>(&pixelsLeftOfCut, &pixelsRightOfCut, iBB.upperLeft()));
 
-        // labels areas that belong to left/right images
-        // adds a 1-pixel border to catch any area that is cut off by the seam
-        vigra::ArrayOfRegionStatistics<vigra::SeedRgDirectValueFunctor<float> > stats(3);
+            // labels areas that belong to left/right images
+            // adds a 1-pixel border to catch any area that is cut off by the seam
+            vigra::ArrayOfRegionStatistics<vigra::SeedRgDirectValueFunctor<float> > stats(3);
 
-        vigra::seededRegionGrowing(srcImageRange(tempImg), srcImage(tempImg), destImage(finalmask), stats);
+            vigra::seededRegionGrowing(srcImageRange(tempImg), srcImage(tempImg), destImage(finalmask), stats);
+        }
 
         const vigra::triple<typename IMAGETYPE<MaskPixelType>::Iterator, typename IMAGETYPE<MaskPixelType>::Iterator,
                             typename IMAGETYPE<MaskPixelType>::Accessor> finalmaskSrcRange =
@@ -1383,18 +1847,18 @@ namespace enblend
         switch (PixelDifferenceFunctor)
         {
         case HueLuminanceMaxDifference:
-            vigra::omp::combineTwoImages(src1_upperleft, src1_lowerright, sa1,
-                                         src2_upperleft, sa2,
-                                         intermediateImg.upperLeft(), intermediateImg.accessor(),
-                                         MaxHueLuminanceDifferenceFunctor<SrcPixelType, BasePixelType>
-                                         (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+            differenceImage(src1_upperleft, src1_lowerright, sa1,
+                            src2_upperleft, sa2,
+                            intermediateImg.upperLeft(), intermediateImg.accessor(),
+                            MaxHueLuminanceDifferenceFunctor<SrcPixelType, BasePixelType>
+                            (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
             break;
         case DeltaEDifference:
-            vigra::omp::combineTwoImages(src1_upperleft, src1_lowerright, sa1,
-                                         src2_upperleft, sa2,
-                                         intermediateImg.upperLeft(), intermediateImg.accessor(),
-                                         DeltaEPixelDifferenceFunctor<SrcPixelType, BasePixelType>
-                                         (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+            differenceImage(src1_upperleft, src1_lowerright, sa1,
+                            src2_upperleft, sa2,
+                            intermediateImg.upperLeft(), intermediateImg.accessor(),
+                            DeltaEPixelDifferenceFunctor<SrcPixelType, BasePixelType>
+                            (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
             break;
         default:
             NEVER_REACHED("switch control expression \"PixelDifferenceFunctor\" out of range");
@@ -1443,6 +1907,17 @@ namespace enblend
         // a set of points to keep visited points for subsequent graph-cut runs
         std::unordered_set<vigra::Point2D, pointHash> visited;
 
+        // the flat-array engine keeps the visited points in its workspace
+        const bool flatAStar = parameter::as_boolean("graphcut-flat-astar", true);
+        const bool concurrentSubCuts = flatAStar && parameter::as_boolean("graphcut-parallel-subcuts", false);
+        AStarWorkspace<GraphPixelType> workspace(flatAStar && !concurrentSubCuts ? graphsize : vigra::Diff2D(0, 0));
+
+        std::vector<std::vector<vigra::Point2D>*> subCutPaths;
+        if (concurrentSubCuts) {
+            subCutPaths = A_star_subcuts<IMAGETYPE<GraphPixelType>, IMAGETYPE<GradientPixelType> >
+                (*intermediatePointList, &intermediateGraphImg, &gradientX, &gradientY, graphsize);
+        }
+
         // find optimal cuts in dual graph
         for (std::vector<vigra::Point2D>::iterator i = intermediatePointList->begin();
              i != intermediatePointList->end();
@@ -1460,11 +1935,22 @@ namespace enblend
             std::cout << "Running graph-cut: " << intermediatePoint << ":" << *i << std::endl;
 #endif
 
-            dualPath = A_star<IMAGETYPE<GraphPixelType>, IMAGETYPE<GradientPixelType>, BasePixelType>
-                (vigra::Point2D(-10, -10), vigra::Point2D(-20, -20), &intermediateGraphImg, &gradientX,
-                 &gradientY, graphsize - vigra::Diff2D(1, 1), &srcDestPoints, &visited);
+            delete dualPath;
+            if (concurrentSubCuts) {
+                dualPath = subCutPaths[i - intermediatePointList->begin() - 1];
+            } else if (flatAStar) {
+                dualPath = A_star_flat<IMAGETYPE<GraphPixelType>, IMAGETYPE<GradientPixelType> >
+                    (&intermediateGraphImg, &gradientX, &gradientY,
+                     graphsize - vigra::Diff2D(1, 1), &srcDestPoints, &workspace);
 
-            visited.insert(dualPath->begin(), dualPath->end());
+                workspace.markVisited(dualPath->begin(), dualPath->end());
+            } else {
+                dualPath = A_star<IMAGETYPE<GraphPixelType>, IMAGETYPE<GradientPixelType>, BasePixelType>
+                    (vigra::Point2D(-10, -10), vigra::Point2D(-20, -20), &intermediateGraphImg, &gradientX,
+                     &gradientY, graphsize - vigra::Diff2D(1, 1), &srcDestPoints, &visited);
+
+                visited.insert(dualPath->begin(), dualPath->end());
+            }
 
             for (std::vector<vigra::Point2D>::reverse_iterator j = dualPath->rbegin(); j < dualPath->rend(); j++) {
                 if ((j == dualPath->rbegin() && totalDualPath.empty()) || j != dualPath->rbegin()) {
@@ -1472,7 +1958,10 @@ namespace enblend
                 }
             }
 
-            vigra::copyImage(srcImageRange(graphImg), destImage(intermediateGraphImg));
+            if (!flatAStar) {
+                // A_star() leaves its marks in the graph image
+                vigra::copyImage(srcImageRange(graphImg), destImage(intermediateGraphImg));
+            }
             intermediatePoint = *i;
         }
 
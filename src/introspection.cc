@@ -41,6 +41,10 @@
 #include "dynamic_loader.h"    // HAVE_DYNAMICLOADER_IMPL
 #include "openmp_def.h"        // OPENMP
 #include "opencl.h"            // OPENCL
+#include "skipsm_kernels.h"    // skipsm::instruction_set()
+#ifdef ENBLEND_SOURCE
+#include "anneal_kernels.h"    // anneal::instruction_set()
+#endif
 
 #include "introspection.h"
 
@@ -91,6 +95,11 @@ namespace introspection
             std::cout << "Extra feature: OpenMP: no\n";
 #endif
 
+            std::cout << "Extra feature: vectorized SKIPSM kernels: " << skipsm::instruction_set() << "\n";
+#ifdef ENBLEND_SOURCE
+            std::cout << "Extra feature: vectorized annealing kernel: " << anneal::instruction_set() << "\n";
+#endif
+
 #ifdef OPENCL
             std::cout << "Extra feature: OpenCL: yes\n";
 #ifdef _MSC_VER
@@ -1298,18 +1298,18 @@ createMask(const ImageType* const white,
     switch (PixelDifferenceFunctor)
     {
     case HueLuminanceMaxDifference:
-        vigra::omp::combineTwoImages(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
-                                     vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
-                                     vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
-                                     MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
-                                     (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+        differenceImage(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
+                        vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
+                        vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
+                        MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                        (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
         break;
     case DeltaEDifference:
-        vigra::omp::combineTwoImages(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
-                                     vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
-                                     vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
-                                     DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
-                                     (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+        differenceImage(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
+                        vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
+                        vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
+                        DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                        (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
         break;
     default:
         NEVER_REACHED("switch control expression \"PixelDifferenceFunctor\" out of range");
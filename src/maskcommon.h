@@ -20,14 +20,123 @@
 #ifndef MASKCOMMON_H
 #define MASKCOMMON_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
 #include <vigra/colorconversions.hxx>
 
 namespace enblend {
 
-    template <typename PixelType, typename ResultType>
+    /** Convert a row of n RGB pixels to planar L*a*b* coordinates.
+     *
+     *  This evaluates the formulae of
+     *  vigra::RGB2LabFunctor<double>(aMaximum) in the same order, but
+     *  as two loops over contiguous arrays instead of one call per
+     *  pixel.  The three calls of std::pow() per pixel dominate the
+     *  cost and do not vectorize, thus the loops save only some 10%
+     *  of the time.  The caller provides the three output planes,
+     *  each holding at least n elements.
+     *
+     *  We use the exact CIE constants kappa = 24389/27 and epsilon =
+     *  216/24389 like current versions of vigra.  Older versions
+     *  round them to 903.3 and 0.008856, so callers must check with
+     *  rgbRowToLabMatchesVigra() that the vigra at hand agrees. */
+    template <typename ComponentType>
+    void
+    rgbRowToLab(const vigra::RGBValue<ComponentType>* rgb, size_t n, double aMaximum,
+                double* lStar, double* aStar, double* bStar)
+    {
+        // Linear RGB to XYZ, see vigra::RGB2XYZFunctor.
+        for (size_t i = 0; i < n; ++i) {
+            const double red = static_cast<double>(rgb[i][0]) / aMaximum;
+            const double green = static_cast<double>(rgb[i][1]) / aMaximum;
+            const double blue = static_cast<double>(rgb[i][2]) / aMaximum;
+
+            lStar[i] = 0.412453 * red + 0.357580 * green + 0.180423 * blue;
+            aStar[i] = 0.212671 * red + 0.715160 * green + 0.072169 * blue;
+            bStar[i] = 0.019334 * red + 0.119193 * green + 0.950227 * blue;
+        }
+
+        // XYZ to L*a*b*, see vigra::XYZ2LabFunctor.
+        const double gamma = 1.0 / 3.0;
+        const double kappa = 24389.0 / 27.0;
+        const double epsilon = 216.0 / 24389.0;
+
+        for (size_t i = 0; i < n; ++i) {
+            const double x = lStar[i];
+            const double y = aStar[i];
+            const double z = bStar[i];
+            const double xgamma = std::pow(x / 0.950456, gamma);
+            const double ygamma = std::pow(y, gamma);
+            const double zgamma = std::pow(z / 1.088754, gamma);
+
+            lStar[i] = y < epsilon ? kappa * y : 116.0 * ygamma - 16.0;
+            aStar[i] = 500.0 * (xgamma - ygamma);
+            bStar[i] = 200.0 * (ygamma - zgamma);
+        }
+    }
+
+
+    /** Answer whether rgbRowToLab() yields bit for bit the results
+     *  of the vigra::RGB2LabFunctor we are compiled against.  We
+     *  compare both on grays and primaries of the whole range of
+     *  ComponentType, including the linear segment of L* near
+     *  black.  A compiler that contracts the two versions' arithmetic
+     *  differently, e.g. into fused multiply-adds, fails the check,
+     *  and the callers fall back to the functor. */
+    template <typename ComponentType>
+    bool
+    rgbRowToLabMatchesVigra()
+    {
+        static const bool matches = [] {
+            const double maximum = vigra::NumericTraits<ComponentType>::max();
+            const int steps = 256;
+            std::vector<vigra::RGBValue<ComponentType> > probes;
+            for (int i = 0; i <= steps; ++i) {
+                const ComponentType v =
+                    vigra::NumericTraits<ComponentType>::fromRealPromote(maximum * i / steps);
+                const ComponentType zero = ComponentType();
+                probes.push_back(vigra::RGBValue<ComponentType>(v, v, v));
+                probes.push_back(vigra::RGBValue<ComponentType>(v, zero, zero));
+                probes.push_back(vigra::RGBValue<ComponentType>(zero, v, zero));
+                probes.push_back(vigra::RGBValue<ComponentType>(zero, zero, v));
+            }
+
+            const size_t n = probes.size();
+            std::vector<double> lab(3 * n);
+            rgbRowToLab(probes.data(), n, maximum, lab.data(), lab.data() + n, lab.data() + 2 * n);
+
+            const vigra::RGB2LabFunctor<double> rgb_to_lab(maximum);
+            for (size_t i = 0; i < n; ++i) {
+                const typename vigra::RGB2LabFunctor<double>::result_type reference(rgb_to_lab(probes[i]));
+                for (size_t j = 0; j < 3; ++j) {
+                    if (lab[j * n + i] != reference[j]) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }();
+
+        return matches;
+    }
+
+
+    /** Base of all pixel-difference functors.
+     *
+     *  The derived class Derived supplies the difference of two RGB
+     *  pixels in rgb_difference() and optionally a version for whole
+     *  rows in rgb_row_difference().  Dispatch happens at compile
+     *  time, so that the per-pixel calls can be inlined. */
+    template <typename Derived, typename PixelType, typename ResultType>
     class DifferenceFunctor
     {
     public:
+        typedef PixelType first_argument_type;
+        typedef PixelType second_argument_type;
+        typedef ResultType result_type;
         typedef typename EnblendNumericTraits<PixelType>::ImagePixelComponentType PixelComponentType;
         typedef typename EnblendNumericTraits<ResultType>::ImagePixelComponentType ResultPixelComponentType;
         typedef vigra::LinearIntensityTransform<ResultType> RangeMapper;
@@ -38,17 +147,33 @@ namespace enblend {
                                              ResultType(vigra::NumericTraits<ResultPixelComponentType>::min()),
                                              ResultType(vigra::NumericTraits<ResultPixelComponentType>::max()))) {}
 
-        virtual ~DifferenceFunctor() {}
-
         ResultType operator()(const PixelType& a, const PixelType& b) const {
             typedef typename vigra::NumericTraits<PixelType>::isScalar src_is_scalar;
             return difference(a, b, src_is_scalar());
         }
 
+        /** Answer the number of doubles of scratch space the row
+         *  interface needs for rows of n pixels. */
+        static size_t scratch_size(size_t) {return 0U;}
+
+        /** Compute the differences of the n pixel pairs (a[i], b[i])
+         *  and store them in result[i].  The caller provides the
+         *  scratch space of scratch_size(n) doubles, so that it can
+         *  reuse it for many rows. */
+        void operator()(const PixelType* a, const PixelType* b, ResultType* result, size_t n,
+                        double* scratch) const {
+            typedef typename vigra::NumericTraits<PixelType>::isScalar src_is_scalar;
+            row_difference(a, b, result, n, scratch, src_is_scalar());
+        }
+
     protected:
-        virtual ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
-                                      const vigra::RGBValue<PixelComponentType>& b,
-                                      vigra::VigraFalseType) const = 0;
+        const Derived& derived() const {return static_cast<const Derived&>(*this);}
+
+        ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
+                              const vigra::RGBValue<PixelComponentType>& b,
+                              vigra::VigraFalseType) const {
+            return derived().rgb_difference(a, b);
+        }
 
         ResultType difference(PixelType a, PixelType b, vigra::VigraTrueType) const {
             typedef typename vigra::NumericTraits<PixelType>::isSigned src_is_signed;
@@ -65,6 +190,27 @@ namespace enblend {
             return scale_(std::abs(static_cast<int>(a) - static_cast<int>(b)));
         }
 
+        void row_difference(const PixelType* a, const PixelType* b, ResultType* result, size_t n,
+                            double* scratch, vigra::VigraFalseType) const {
+            derived().rgb_row_difference(a, b, result, n, scratch);
+        }
+
+        void row_difference(const PixelType* a, const PixelType* b, ResultType* result, size_t n,
+                            double*, vigra::VigraTrueType) const {
+            for (size_t i = 0; i < n; ++i) {
+                result[i] = difference(a[i], b[i], vigra::VigraTrueType());
+            }
+        }
+
+        // Default row version for derived classes that do not
+        // provide a faster one.
+        void rgb_row_difference(const PixelType* a, const PixelType* b, ResultType* result, size_t n,
+                                double*) const {
+            for (size_t i = 0; i < n; ++i) {
+                result[i] = derived().rgb_difference(a[i], b[i]);
+            }
+        }
+
         RangeMapper scale_;
     };
 
@@ -104,9 +250,11 @@ namespace enblend {
 
 
     template <typename PixelType, typename ResultType>
-    class MaxHueLuminanceDifferenceFunctor : public DifferenceFunctor<PixelType, ResultType>
+    class MaxHueLuminanceDifferenceFunctor :
+        public DifferenceFunctor<MaxHueLuminanceDifferenceFunctor<PixelType, ResultType>, PixelType, ResultType>
     {
-        typedef DifferenceFunctor<PixelType, ResultType> super;
+        typedef DifferenceFunctor<MaxHueLuminanceDifferenceFunctor<PixelType, ResultType>, PixelType, ResultType> super;
+        friend super;
 
     public:
         typedef typename super::PixelComponentType PixelComponentType;
@@ -121,9 +269,8 @@ namespace enblend {
         }
 
     protected:
-        ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
-                              const vigra::RGBValue<PixelComponentType>& b,
-                              vigra::VigraFalseType) const {
+        ResultType rgb_difference(const vigra::RGBValue<PixelComponentType>& a,
+                                  const vigra::RGBValue<PixelComponentType>& b) const {
             const PixelComponentType aLum = a.luminance();
             const PixelComponentType bLum = b.luminance();
             const PixelComponentType aHue = hue(a);
@@ -145,9 +292,11 @@ namespace enblend {
 
 
     template <typename PixelType, typename ResultType>
-    class DeltaEPixelDifferenceFunctor : public DifferenceFunctor<PixelType, ResultType>
+    class DeltaEPixelDifferenceFunctor :
+        public DifferenceFunctor<DeltaEPixelDifferenceFunctor<PixelType, ResultType>, PixelType, ResultType>
     {
-        typedef DifferenceFunctor<PixelType, ResultType> super;
+        typedef DifferenceFunctor<DeltaEPixelDifferenceFunctor<PixelType, ResultType>, PixelType, ResultType> super;
+        friend super;
 
     public:
         typedef typename super::PixelComponentType PixelComponentType;
@@ -155,7 +304,8 @@ namespace enblend {
         DeltaEPixelDifferenceFunctor() = delete;
 
         DeltaEPixelDifferenceFunctor(double aLuminanceWeight, double aChrominanceWeight) :
-            rgb_to_lab_(vigra::RGB2LabFunctor<double>(vigra::NumericTraits<PixelComponentType>::max())) {
+            rgb_to_lab_(vigra::RGB2LabFunctor<double>(vigra::NumericTraits<PixelComponentType>::max())),
+            row_lab_(rgbRowToLabMatchesVigra<PixelComponentType>()) {
             const double total = aLuminanceWeight + 2.0 * aChrominanceWeight;
             assert(total != 0.0);
             luma_ = aLuminanceWeight / total;
@@ -163,18 +313,51 @@ namespace enblend {
         }
 
     protected:
-        ResultType difference(const vigra::RGBValue<PixelComponentType>& a,
-                              const vigra::RGBValue<PixelComponentType>& b,
-                              vigra::VigraFalseType) const {
+        ResultType rgb_difference(const vigra::RGBValue<PixelComponentType>& a,
+                                  const vigra::RGBValue<PixelComponentType>& b) const {
             typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
 
             const LABResultType lab_a = rgb_to_lab_(a);
             const LABResultType lab_b = rgb_to_lab_(b);
+
+            return lab_difference(lab_a[0], lab_a[1], lab_a[2], lab_b[0], lab_b[1], lab_b[2]);
+        }
+
+    public:
+        static size_t scratch_size(size_t n) {return 6U * n;}
+
+    protected:
+        // Convert both rows to planar L*a*b* first, then combine the
+        // planes pixel by pixel.
+        void rgb_row_difference(const PixelType* a, const PixelType* b, ResultType* result, size_t n,
+                                double* scratch) const {
+            if (!row_lab_) {
+                super::rgb_row_difference(a, b, result, n, scratch);
+                return;
+            }
+
+            double* const l_a = scratch;
+            double* const a_a = l_a + n;
+            double* const b_a = a_a + n;
+            double* const l_b = b_a + n;
+            double* const a_b = l_b + n;
+            double* const b_b = a_b + n;
+            const double maximum = vigra::NumericTraits<PixelComponentType>::max();
+
+            rgbRowToLab(a, n, maximum, l_a, a_a, b_a);
+            rgbRowToLab(b, n, maximum, l_b, a_b, b_b);
+
+            for (size_t i = 0; i < n; ++i) {
+                result[i] = lab_difference(l_a[i], a_a[i], b_a[i], l_b[i], a_b[i], b_b[i]);
+            }
+        }
+
+        ResultType lab_difference(double l_a, double a_a, double b_a, double l_b, double a_b, double b_b) const {
             // See, e.g. http://en.wikipedia.org/wiki/Color_difference
             // or http://www.colorwiki.com/wiki/Delta_E:_The_Color_Difference
-            const double delta_e = sqrt(luma_ * square(lab_a[0] - lab_b[0]) +
-                                        chroma_ * square(lab_a[1] - lab_b[1]) +
-                                        chroma_ * square(lab_a[2] - lab_b[2]));
+            const double delta_e = sqrt(luma_ * square(l_a - l_b) +
+                                        chroma_ * square(a_a - a_b) +
+                                        chroma_ * square(b_a - b_b));
 
             // Vigra documentation: 0 <= L* <= 100.0, -86.1813 <= a* <= 98.2352, -107.862 <= b* <= 94.4758
             // => Maximum delta_e = 291.4619.  Real differences are much smaller and fromRealPromote()
@@ -188,9 +371,84 @@ namespace enblend {
         double luma_;
         double chroma_;
         vigra::RGB2LabFunctor<double> rgb_to_lab_;
+        bool row_lab_;
     };
 
 
+    /** Combine the images src1 and src2 with the pixel-difference
+     *  functor f row by row and write the result to dest.
+     *
+     *  In contrast to vigra::omp::combineTwoImages() this gathers
+     *  each row of both images into contiguous buffers and hands the
+     *  whole row to the row interface of f, which lets f process the
+     *  row in tight loops.  Works with any 2D iterators, in particular
+     *  with the strided ones of stride.hxx. */
+    template <class SrcImageIterator1, class SrcAccessor1,
+              class SrcImageIterator2, class SrcAccessor2,
+              class DestImageIterator, class DestAccessor,
+              class Functor>
+    void
+    differenceImage(SrcImageIterator1 src1_upperleft, SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
+                    SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
+                    DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                    const Functor& f)
+    {
+        typedef typename Functor::first_argument_type PixelType;
+        typedef typename Functor::result_type ResultType;
+
+        const vigra::Diff2D size(src1_lowerright - src1_upperleft);
+        if (size.x <= 0 || size.y <= 0) {
+            return;
+        }
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+        {
+            std::vector<PixelType> a(size.x);
+            std::vector<PixelType> b(size.x);
+            std::vector<ResultType> result(size.x);
+            std::vector<double> scratch(Functor::scratch_size(static_cast<size_t>(size.x)));
+
+#ifdef OPENMP
+#pragma omp for schedule(guided) nowait
+#endif
+            for (int y = 0; y < size.y; ++y) {
+                SrcImageIterator1 s1(src1_upperleft + vigra::Diff2D(0, y));
+                SrcImageIterator2 s2(src2_upperleft + vigra::Diff2D(0, y));
+                for (int x = 0; x < size.x; ++x, ++s1.x, ++s2.x) {
+                    a[x] = src1_acc(s1);
+                    b[x] = src2_acc(s2);
+                }
+
+                f(a.data(), b.data(), result.data(), static_cast<size_t>(size.x), scratch.data());
+
+                DestImageIterator d(dest_upperleft + vigra::Diff2D(0, y));
+                for (int x = 0; x < size.x; ++x, ++d.x) {
+                    dest_acc.set(result[x], d);
+                }
+            }
+        } // omp parallel
+    }
+
+
+    template <class SrcImageIterator1, class SrcAccessor1,
+              class SrcImageIterator2, class SrcAccessor2,
+              class DestImageIterator, class DestAccessor,
+              class Functor>
+    inline void
+    differenceImage(vigra::triple<SrcImageIterator1, SrcImageIterator1, SrcAccessor1> src1,
+                    vigra::pair<SrcImageIterator2, SrcAccessor2> src2,
+                    vigra::pair<DestImageIterator, DestAccessor> dest,
+                    const Functor& f)
+    {
+        differenceImage(src1.first, src1.second, src1.third,
+                        src2.first, src2.second,
+                        dest.first, dest.second,
+                        f);
+    }
+
+
     template <typename PixelType, typename ResultType>
     class PixelSumFunctor
     {
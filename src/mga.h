@@ -26,14 +26,111 @@
 
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include <vigra/colorconversions.hxx>
 
 #include "common.h"
+#include "parameter.h"
+
+
+// Number of intervals of the tabulated L*(Y)-curve; see LStarTable.
+#define LSTAR_TABLE_INTERVALS 65536
 
 
 namespace enblend {
 
+/** L* of RGB pixels whose channels are unsigned integers of at most
+ *  16 bits.
+ *
+ *  L* only depends on the luminance Y, which is the sum of one
+ *  contribution per channel.  We tabulate the contributions of all
+ *  channel values, which we add in the same order as the color
+ *  conversion does, and L*(Y) at LSTAR_TABLE_INTERVALS + 1
+ *  equidistant luminances, between which we interpolate linearly.
+ *  Both tables come from vigra's own color conversions.  The
+ *  interpolation error stays below 10^-5 in units of L*, which still
+ *  flips the rounding of a few 16-bit results by one unit.
+ *  Therefore, the table is an option that the parameter "lstar-table"
+ *  switches on.
+ */
+template <typename ValueType>
+class LStarTable
+{
+public:
+    enum {is_applicable =
+          std::is_integral<ValueType>::value &&
+          std::is_unsigned<ValueType>::value &&
+          std::numeric_limits<ValueType>::digits <= 16};
+
+    template <class RGBToXYZFunctor>
+    explicit LStarTable(const RGBToXYZFunctor& rgb_to_xyz) :
+        red_(static_cast<size_t>(vigra::NumericTraits<ValueType>::max()) + 1U),
+        green_(red_.size()), blue_(red_.size()),
+        lstar_(LSTAR_TABLE_INTERVALS + 1)
+    {
+        typedef vigra::TinyVector<double, 3> Vector;
+
+        for (size_t i = 0U; i != red_.size(); ++i)
+        {
+            const double v = static_cast<double>(i);
+            red_[i] = rgb_to_xyz(Vector(v, 0.0, 0.0))[1];
+            green_[i] = rgb_to_xyz(Vector(0.0, v, 0.0))[1];
+            blue_[i] = rgb_to_xyz(Vector(0.0, 0.0, v))[1];
+        }
+
+        const vigra::XYZ2LabFunctor<double> xyz_to_lab;
+        for (int i = 0; i <= LSTAR_TABLE_INTERVALS; ++i)
+        {
+            const double y = static_cast<double>(i) / static_cast<double>(LSTAR_TABLE_INTERVALS);
+            lstar_[i] = xyz_to_lab(Vector(0.0, y, 0.0))[0];
+        }
+    }
+
+    template <class RGBType>
+    double operator()(const RGBType& x) const
+    {
+        const double y = red_[x.red()] + green_[x.green()] + blue_[x.blue()];
+        const double s = std::max(0.0, y) * static_cast<double>(LSTAR_TABLE_INTERVALS);
+        const int i = std::min(static_cast<int>(s), LSTAR_TABLE_INTERVALS - 1);
+
+        return lstar_[i] + (s - static_cast<double>(i)) * (lstar_[i + 1] - lstar_[i]);
+    }
+
+    // Answer the table of unprimed (primed == false) or primed RGB.
+    // We build each table once per run.
+    static std::shared_ptr<const LStarTable> table(bool primed)
+    {
+        static std::shared_ptr<const LStarTable> tables[2];
+        const double max = static_cast<double>(vigra::NumericTraits<ValueType>::max());
+
+        if (!tables[primed])
+        {
+            if (primed)
+            {
+                tables[primed] = std::make_shared<LStarTable>(vigra::RGBPrime2XYZFunctor<double>(max));
+            }
+            else
+            {
+                tables[primed] = std::make_shared<LStarTable>(vigra::RGB2XYZFunctor<double>(max));
+            }
+        }
+
+        return tables[primed];
+    }
+
+private:
+    std::vector<double> red_;
+    std::vector<double> green_;
+    std::vector<double> blue_;
+    std::vector<double> lstar_;
+};
+
+
 template <typename InputType, typename ResultType>
 class MultiGrayscaleAccessor
 {
@@ -44,6 +141,7 @@ public:
         typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
         initializeTypeSpecific(srcIsScalar());
         initialize(accessorName);
+        initializeLStarTable(HasLStarTable());
     }
 
     ResultType operator()(const InputType& x) const {
@@ -63,6 +161,14 @@ public:
         return f(i, d, srcIsScalar());
     }
 
+    // Project the n pixels at x.  We select the projector once per
+    // call instead of once per pixel, so that the compiler inlines it
+    // into the loop.
+    void operator()(const InputType* x, ResultType* result, size_t n) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        projectRow(x, result, n, srcIsScalar());
+    }
+
     static const std::string defaultGrayscaleAccessorName() {
         return "average";       //< default-grayscale-accessor average
     }
@@ -74,24 +180,30 @@ private:
     typedef std::map<std::string, AccKindType> NameMapType;
     typedef typename NameMapType::const_iterator NameMapConstIterType;
 
+    template <AccKindType K> struct Projector {};
+
 #define CHANNEL_MIXER "channel-mixer"
 
-    void initializeAccessorNameMap() {
-        nameMap["average"] = AVERAGE;
-        nameMap["l-star"] = LSTAR;
-        nameMap["pl-star"] = PRIMED_LSTAR;
-        nameMap["lightness"] = LIGHTNESS;
-        nameMap["value"] = VALUE;
-        nameMap["anti-value"] = ANTI_VALUE;
-        nameMap["luminance"] = LUMINANCE;
-        nameMap[CHANNEL_MIXER] = MIXER;
+    static const NameMapType& accessorNameMap() {
+        static const NameMapType nameMap {
+            {"average", AVERAGE},
+            {"l-star", LSTAR},
+            {"pl-star", PRIMED_LSTAR},
+            {"lightness", LIGHTNESS},
+            {"value", VALUE},
+            {"anti-value", ANTI_VALUE},
+            {"luminance", LUMINANCE},
+            {CHANNEL_MIXER, MIXER}
+        };
+
+        return nameMap;
     }
 
     void initialize(const std::string& accessorName) {
-        initializeAccessorNameMap();
+        const NameMapType& nameMap = accessorNameMap();
         if (accessorName.empty())
         {
-            kind = nameMap[defaultGrayscaleAccessorName()];
+            kind = nameMap.find(defaultGrayscaleAccessorName())->second;
         }
         else
         {
@@ -181,50 +293,120 @@ private:
         rgb_prime_to_lab_fun = vigra::RGBPrime2LabFunctor<double>(vigra::NumericTraits<ValueType>::max());
     }
 
-    ResultType project(const InputType& x) const {
+    void initializeLStarTable(std::true_type) {
+        if ((kind == LSTAR || kind == PRIMED_LSTAR) && parameter::as_boolean("lstar-table", false))
+        {
+            lstar_table = LStarTableType::table(kind == PRIMED_LSTAR);
+        }
+    }
+
+    void initializeLStarTable(std::false_type) {}
+
+    ResultType project(const InputType& x, Projector<AVERAGE>) const {
         typedef typename InputType::value_type ValueType;
-        switch (kind)
+        return vigra::NumericTraits<ResultType>::fromRealPromote
+            ((vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
+              vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
+              vigra::NumericTraits<ValueType>::toRealPromote(x.blue())) /
+             3.0);
+    }
+
+    ResultType project(const InputType& x, Projector<LSTAR>) const {
+        typedef typename InputType::value_type ValueType;
+        if (lstar_table)
         {
-        case AVERAGE:
             return vigra::NumericTraits<ResultType>::fromRealPromote
-                ((vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
-                  vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
-                  vigra::NumericTraits<ValueType>::toRealPromote(x.blue())) /
-                 3.0);
-        case LSTAR:
-        {
-            typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
-            const LABResultType y = rgb_to_lab_fun.operator()(x) / 100.0;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
+                (vigra::NumericTraits<ValueType>::max() * ((*lstar_table)(x) / 100.0));
         }
-        case PRIMED_LSTAR:
+        typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
+        const LABResultType y = rgb_to_lab_fun.operator()(x) / 100.0;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
+    }
+
+    ResultType project(const InputType& x, Projector<PRIMED_LSTAR>) const {
+        typedef typename InputType::value_type ValueType;
+        if (lstar_table)
         {
-            typedef typename vigra::RGBPrime2LabFunctor<double>::result_type LABResultType;
-            const LABResultType y = rgb_prime_to_lab_fun.operator()(x) / 100.0;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
-        }
-        case LIGHTNESS:
             return vigra::NumericTraits<ResultType>::fromRealPromote
-                ((std::min(x.red(), std::min(x.green(), x.blue())) +
-                  std::max(x.red(), std::max(x.green(), x.blue()))) /
-                 2.0);
-        case VALUE:
-            return std::max(x.red(), std::max(x.green(), x.blue()));
-        case ANTI_VALUE:
-            return std::min(x.red(), std::min(x.green(), x.blue()));
-        case LUMINANCE:
-            return vigra::NumericTraits<ResultType>::fromRealPromote(x.luminance());
-        case MIXER:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                (redWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
-                 greenWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
-                 blueWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.blue()));
+                (vigra::NumericTraits<ValueType>::max() * ((*lstar_table)(x) / 100.0));
+        }
+        typedef typename vigra::RGBPrime2LabFunctor<double>::result_type LABResultType;
+        const LABResultType y = rgb_prime_to_lab_fun.operator()(x) / 100.0;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
+    }
+
+    ResultType project(const InputType& x, Projector<LIGHTNESS>) const {
+        return vigra::NumericTraits<ResultType>::fromRealPromote
+            ((std::min(x.red(), std::min(x.green(), x.blue())) +
+              std::max(x.red(), std::max(x.green(), x.blue()))) /
+             2.0);
+    }
+
+    ResultType project(const InputType& x, Projector<VALUE>) const {
+        return std::max(x.red(), std::max(x.green(), x.blue()));
+    }
+
+    ResultType project(const InputType& x, Projector<ANTI_VALUE>) const {
+        return std::min(x.red(), std::min(x.green(), x.blue()));
+    }
+
+    ResultType project(const InputType& x, Projector<LUMINANCE>) const {
+        return vigra::NumericTraits<ResultType>::fromRealPromote(x.luminance());
+    }
+
+    ResultType project(const InputType& x, Projector<MIXER>) const {
+        typedef typename InputType::value_type ValueType;
+        return vigra::NumericTraits<ResultType>::fromRealPromote
+            (redWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
+             greenWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
+             blueWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.blue()));
+    }
+
+    ResultType project(const InputType& x) const {
+        switch (kind)
+        {
+        case AVERAGE: return project(x, Projector<AVERAGE>());
+        case LSTAR: return project(x, Projector<LSTAR>());
+        case PRIMED_LSTAR: return project(x, Projector<PRIMED_LSTAR>());
+        case LIGHTNESS: return project(x, Projector<LIGHTNESS>());
+        case VALUE: return project(x, Projector<VALUE>());
+        case ANTI_VALUE: return project(x, Projector<ANTI_VALUE>());
+        case LUMINANCE: return project(x, Projector<LUMINANCE>());
+        case MIXER: return project(x, Projector<MIXER>());
         }
 
         // never reached
         return ResultType();
     }
 
+    template <AccKindType K>
+    void projectRow(const InputType* x, ResultType* result, size_t n) const {
+        for (size_t i = 0U; i != n; ++i)
+        {
+            result[i] = project(x[i], Projector<K>());
+        }
+    }
+
+    // RGB
+    void projectRow(const InputType* x, ResultType* result, size_t n, vigra::VigraFalseType) const {
+        switch (kind)
+        {
+        case AVERAGE: projectRow<AVERAGE>(x, result, n); break;
+        case LSTAR: projectRow<LSTAR>(x, result, n); break;
+        case PRIMED_LSTAR: projectRow<PRIMED_LSTAR>(x, result, n); break;
+        case LIGHTNESS: projectRow<LIGHTNESS>(x, result, n); break;
+        case VALUE: projectRow<VALUE>(x, result, n); break;
+        case ANTI_VALUE: projectRow<ANTI_VALUE>(x, result, n); break;
+        case LUMINANCE: projectRow<LUMINANCE>(x, result, n); break;
+        case MIXER: projectRow<MIXER>(x, result, n); break;
+        }
+    }
+
+    // grayscale
+    void projectRow(const InputType* x, ResultType* result, size_t n, vigra::VigraTrueType) const {
+        std::copy(x, x + n, result);
+    }
+
     // RGB
     ResultType f(const InputType& x, vigra::VigraFalseType) const {
         return project(x);
@@ -249,11 +431,16 @@ private:
     template <class Iterator, class Difference>
     ResultType f(const Iterator& i, Difference d, vigra::VigraTrueType) const {return i[d];}
 
-    NameMapType nameMap;
+    typedef LStarTable<typename vigra::NumericTraits<InputType>::ValueType> LStarTableType;
+    typedef std::integral_constant<bool,
+                                   !vigra::NumericTraits<InputType>::isScalar::asBool &&
+                                   LStarTableType::is_applicable> HasLStarTable;
+
     AccKindType kind;
     double redWeight, greenWeight, blueWeight;
     vigra::RGB2LabFunctor<double> rgb_to_lab_fun;
     vigra::RGBPrime2LabFunctor<double> rgb_prime_to_lab_fun;
+    std::shared_ptr<const LStarTableType> lstar_table;
 };
 
 } // namespace enblend
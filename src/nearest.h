@@ -133,6 +133,9 @@ namespace vigra
 
 namespace enblend {
 
+// Defined in enblend.cc.
+extern parameter::handle<bool> nativePeriodicDistanceTransform;
+
 template <class SrcImageIterator, class SrcAccessor,
           class DestImageIterator, class DestAccessor>
 void
@@ -301,6 +304,26 @@ periodicDistanceTransform(SrcImageIterator src_upperleft, SrcImageIterator src_l
     typedef typename SrcImageIterator::value_type SrcValueType;
     typedef typename DestImageIterator::value_type DestValueType;
 
+    // The CPU transform handles periodic boundaries line by line,
+    // whereas the GPU kernel needs the doubled or quadrupled image.
+    bool native_periodic = boundary != OpenBoundaries && nativePeriodicDistanceTransform();
+#ifdef OPENCL
+    if (GPUContext && GPU::DistanceTransform && parameter::as_boolean("gpu-kernel-dt", true))
+    {
+        native_periodic = false;
+    }
+#endif
+
+    if (native_periodic)
+    {
+        vigra::omp::periodicDistanceTransform(src_upperleft, src_lowerright, sa,
+                                              dest_upperleft, da,
+                                              background, norm,
+                                              boundary == HorizontalStrip || boundary == DoubleStrip,
+                                              boundary == VerticalStrip || boundary == DoubleStrip);
+        return;
+    }
+
     const vigra::Diff2D size(src_lowerright.x - src_upperleft.x,
                              src_lowerright.y - src_upperleft.y);
     int size_x;
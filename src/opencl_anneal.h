@@ -25,6 +25,7 @@
 #include <config.h>
 #endif
 
+#include "parameter.h"
 #include "timer.h"
 
 #include "opencl.h"
@@ -33,6 +34,10 @@
 namespace ocl
 {
 #ifdef OPENCL
+    // Defined in enblend.cc.
+    extern parameter::handle<bool> forceOpenCLAnnealFloat;
+    extern parameter::handle<bool> profileStateProbabilities;
+
 
     template <typename floating_point_t>
     inline static void
@@ -103,7 +108,7 @@ namespace ocl
         {
             query_device_extensions(f_.device(), std::back_inserter(extensions_));
             has_extension_fp64_ =
-                !parameter::as_boolean("force-opencl-anneal-float", false) &&
+                !forceOpenCLAnnealFloat() &&
                 std::find(extensions_.begin(), extensions_.end(), "cl_khr_fp64") != extensions_.end();
 
             if (has_extension_fp64_)
@@ -168,7 +173,7 @@ namespace ocl
 #endif
         }
 
-        void run(int local_k, std::vector<double>* state_probabilities, int k_max, float* e, float* pi)
+        void run(int local_k, double* state_probabilities, int k_max, float* e, float* pi)
         {
             if (EXPECT_RESULT(!immediately_fallback_, true))
             {
@@ -198,11 +203,11 @@ namespace ocl
                 }
             }
 
-            let_host_calculate_state_probabilities<double>(local_k, &(*state_probabilities)[0], e, pi);
+            let_host_calculate_state_probabilities<double>(local_k, state_probabilities, e, pi);
         }
 
         // In setup() the parameter `size' is the maximum number of
-        // elements of any of the `state_probabilities' vectors.
+        // elements of any of the `state_probabilities' arrays.
         void setup(size_t size, size_t k_max, float*& e, float*& pi)
         {
             const size_t scratch_size = ::ocl::round_up_to_next_multiple<size_t>(size, 64UL);
@@ -245,22 +250,20 @@ namespace ocl
         }
 
     private:
-        void write_out_state_probabilities(const std::vector<double>* state_probabilities)
+        void write_out_state_probabilities(const double* state_probabilities, size_t size)
         {
             if (has_extension_fp64_)
             {
                 f_.queue().enqueueWriteBuffer(state_probabilities_buffer_, CL_FALSE,
-                                              0U, state_probabilities->size() * sizeof(double),
-                                              &(*state_probabilities)[0],
+                                              0U, size * sizeof(double),
+                                              state_probabilities,
                                               nullptr, // no prerequisite
                                               &kernel_prereq_[STATE_PROBABILITIES_BUFFER_WRITTEN]);
             }
             else
             {
-                const size_t size = state_probabilities->size();
                 cast_buffer_.resize(size);
-                const double* state_probabilities_begin =
-                    ASSUME_ALIGNED(&(*state_probabilities)[0], sizeof(double));
+                const double* state_probabilities_begin = ASSUME_ALIGNED(state_probabilities, sizeof(double));
 
                 for (size_t i = 0U; i != size; ++i)
                 {
@@ -275,21 +278,20 @@ namespace ocl
             }
         }
 
-        void read_in_state_probabilities(std::vector<double>* state_probabilities)
+        void read_in_state_probabilities(double* state_probabilities, size_t size)
         {
             if (has_extension_fp64_)
             {
                 f_.queue().enqueueReadBuffer(state_probabilities_buffer_, CL_FALSE,
-                                             0U, state_probabilities->size() * sizeof(double),
-                                             &(*state_probabilities)[0],
+                                             0U, size * sizeof(double),
+                                             state_probabilities,
                                              &read_buffer_prereq_,
                                              &unmap_buffer_prereq_[STATE_PROBABILITIES_BUFFER_UPDATED]);
             }
             else
             {
-                const size_t size = state_probabilities->size();
                 cast_buffer_.resize(size);
-                double* state_probabilities_begin = ASSUME_ALIGNED(&(*state_probabilities)[0], sizeof(double));
+                double* state_probabilities_begin = ASSUME_ALIGNED(state_probabilities, sizeof(double));
 
                 f_.queue().enqueueReadBuffer(state_probabilities_buffer_, CL_FALSE,
                                              0U, size * sizeof(float),
@@ -304,11 +306,11 @@ namespace ocl
             }
         }
 
-        void run0(int local_k, std::vector<double>* state_probabilities, int k_max, float* e, float* pi)
+        void run0(int local_k, double* state_probabilities, int k_max, float* e, float* pi)
         {
             state_probabilities_kernel_.setArg(0U, static_cast<cl_int>(local_k));
 
-            write_out_state_probabilities(state_probabilities);
+            write_out_state_probabilities(state_probabilities, static_cast<size_t>(local_k));
             f_.queue().enqueueWriteBuffer(e_buffer_, CL_FALSE,
                                           0U, local_k * sizeof(float),
                                           e_begin_,
@@ -328,7 +330,7 @@ namespace ocl
                                             &read_buffer_prereq_[0]);
             DEBUG_CHECK_OPENCL_EVENT(read_buffer_prereq_[0]);
 
-            read_in_state_probabilities(state_probabilities);
+            read_in_state_probabilities(state_probabilities, static_cast<size_t>(local_k));
             f_.queue().enqueueReadBuffer(pi_buffer_, CL_FALSE,
                                          0U, local_k * sizeof(float),
                                          pi_begin_,
@@ -337,9 +339,9 @@ namespace ocl
 
             cl::Event::waitForEvents(unmap_buffer_prereq_);
 
-            if (parameter::as_boolean("profile-state-probabilities", false))
+            if (profileStateProbabilities())
             {
-                show_profile_data(state_probabilities->size(), local_k);
+                show_profile_data(static_cast<size_t>(local_k), local_k);
             }
         }
 
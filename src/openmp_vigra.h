@@ -24,6 +24,9 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <vector>
+
 #include <vigra/diff2d.hxx>
 #include <vigra/initimage.hxx>
 #include <vigra/inspectimage.hxx>
@@ -32,13 +35,18 @@
 #include <vigra/convolution.hxx>
 #include <vigra/distancetransform.hxx>
 
+#include "muopt.h"
 #include "openmp_def.h"
+#include "parameter.h"
 
 
 namespace vigra
 {
     namespace omp
     {
+        // Defined in enblend.cc and enfuse.cc.
+        extern parameter::handle<bool> tiledDistanceTransform;
+
 #ifdef OPENMP
         template <class SrcImageIterator1, class SrcAccessor1,
                   class SrcImageIterator2, class SrcAccessor2,
@@ -242,6 +250,234 @@ namespace vigra
         }
 
 
+        // Row-wise transforms hand complete rows to the functor, which
+        // must provide
+        //     transform_row(src_row, src_row_end, src_acc, dest_row, dest_acc)
+        // and, for the masked variant,
+        //     transform_row_if(src_row, src_row_end, src_acc, mask_row, mask_acc, dest_row, dest_acc).
+        // Each thread works with its own copy of the functor, which
+        // thus can keep per-thread row buffers.
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageRows(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                           DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                           const Functor& functor)
+        {
+#pragma omp parallel
+            {
+                const vigra::Size2D size(src_lowerright - src_upperleft);
+                Functor f(functor);
+
+#pragma omp for schedule(guided) nowait
+                for (int y = 0; y < size.y; ++y)
+                {
+                    const vigra::Diff2D begin(0, y);
+                    typename SrcImageIterator::row_iterator src_row((src_upperleft + begin).rowIterator());
+
+                    f.transform_row(src_row, src_row + size.x, src_acc,
+                                    (dest_upperleft + begin).rowIterator(), dest_acc);
+                }
+            } // omp parallel
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class MaskImageIterator, class MaskAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageRowsIf(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                             MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
+                             DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                             const Functor& functor)
+        {
+#pragma omp parallel
+            {
+                const vigra::Size2D size(src_lowerright - src_upperleft);
+                Functor f(functor);
+
+#pragma omp for schedule(guided) nowait
+                for (int y = 0; y < size.y; ++y)
+                {
+                    const vigra::Diff2D begin(0, y);
+                    typename SrcImageIterator::row_iterator src_row((src_upperleft + begin).rowIterator());
+
+                    f.transform_row_if(src_row, src_row + size.x, src_acc,
+                                       (mask_upperleft + begin).rowIterator(), mask_acc,
+                                       (dest_upperleft + begin).rowIterator(), dest_acc);
+                }
+            } // omp parallel
+        }
+
+
+#else
+
+
+        template <class SrcImageIterator1, class SrcAccessor1,
+                  class SrcImageIterator2, class SrcAccessor2,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        combineTwoImages(SrcImageIterator1 src1_upperleft,
+                         SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
+                         SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
+                         DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                         const Functor& func)
+        {
+            vigra::combineTwoImages(src1_upperleft, src1_lowerright, src1_acc,
+                                    src2_upperleft, src2_acc,
+                                    dest_upperleft, dest_acc,
+                                    func);
+        }
+
+
+        template <class SrcImageIterator1, class SrcAccessor1,
+                  class SrcImageIterator2, class SrcAccessor2,
+                  class MaskImageIterator, class MaskAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        combineTwoImagesIf(SrcImageIterator1 src1_upperleft, SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
+                           SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
+                           MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
+                           DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                           const Functor& func)
+        {
+            vigra::combineTwoImagesIf(src1_upperleft, src1_lowerright, src1_acc,
+                                      src2_upperleft, src2_acc,
+                                      mask_upperleft, mask_acc,
+                                      dest_upperleft, dest_acc,
+                                      func);
+        }
+
+
+        template <class SrcImageIterator1, class SrcAccessor1,
+                  class SrcImageIterator2, class SrcAccessor2,
+                  class SrcImageIterator3, class SrcAccessor3,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        combineThreeImages(SrcImageIterator1 src1_upperleft, SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
+                           SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
+                           SrcImageIterator3 src3_upperleft, SrcAccessor3 src3_acc,
+                           DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                           const Functor& func)
+        {
+            vigra::combineThreeImages(src1_upperleft, src1_lowerright, src1_acc,
+                                      src2_upperleft, src2_acc,
+                                      src3_upperleft, src3_acc,
+                                      dest_upperleft, dest_acc,
+                                      func);
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class DestImageIterator, class DestAccessor>
+        inline void
+        copyImage(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                  DestImageIterator dest_upperleft, DestAccessor dest_acc)
+        {
+            vigra::copyImage(src_upperleft, src_lowerright, src_acc, dest_upperleft, dest_acc);
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class MaskImageIterator, class MaskAccessor,
+                  class DestImageIterator, class DestAccessor>
+        inline void
+        copyImageIf(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                    MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
+                    DestImageIterator dest_upperleft, DestAccessor dest_acc)
+        {
+            vigra::copyImageIf(src_upperleft, src_lowerright, src_acc,
+                               mask_upperleft, mask_acc,
+                               dest_upperleft, dest_acc);
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImage(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                       DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                       const Functor& func)
+        {
+            vigra::transformImage(src_upperleft, src_lowerright, src_acc,
+                                  dest_upperleft, dest_acc,
+                                  func);
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class MaskImageIterator, class MaskAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageIf(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                         MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
+                         DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                         const Functor& func)
+        {
+            vigra::transformImageIf(src_upperleft, src_lowerright, src_acc,
+                                    mask_upperleft, mask_acc,
+                                    dest_upperleft, dest_acc,
+                                    func);
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageRows(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                           DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                           const Functor& functor)
+        {
+            const vigra::Size2D size(src_lowerright - src_upperleft);
+            Functor f(functor);
+
+            for (int y = 0; y < size.y; ++y)
+            {
+                const vigra::Diff2D begin(0, y);
+                typename SrcImageIterator::row_iterator src_row((src_upperleft + begin).rowIterator());
+
+                f.transform_row(src_row, src_row + size.x, src_acc,
+                                (dest_upperleft + begin).rowIterator(), dest_acc);
+            }
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class MaskImageIterator, class MaskAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageRowsIf(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
+                             MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
+                             DestImageIterator dest_upperleft, DestAccessor dest_acc,
+                             const Functor& functor)
+        {
+            const vigra::Size2D size(src_lowerright - src_upperleft);
+            Functor f(functor);
+
+            for (int y = 0; y < size.y; ++y)
+            {
+                const vigra::Diff2D begin(0, y);
+                typename SrcImageIterator::row_iterator src_row((src_upperleft + begin).rowIterator());
+
+                f.transform_row_if(src_row, src_row + size.x, src_acc,
+                                   (mask_upperleft + begin).rowIterator(), mask_acc,
+                                   (dest_upperleft + begin).rowIterator(), dest_acc);
+            }
+        }
+
+#endif // OPENMP
+
+
         namespace fh
         {
             namespace detail
@@ -269,6 +505,12 @@ namespace vigra
                     {
                         vigra_fail("fh::detail::ChessboardTransform1D: not implemented");
                     }
+
+                    void operator()(ValueType* RESTRICT d, const ValueType* RESTRICT f, int n,
+                                    int* /* RESTRICT v */, float* /* RESTRICT z */) const
+                    {
+                        (*this)(d, f, n);
+                    }
                 };
 
 
@@ -293,6 +535,12 @@ namespace vigra
                             d[q] = std::min<ValueType>(d[q], d[q + 1] + one);
                         }
                     }
+
+                    void operator()(ValueType* RESTRICT d, const ValueType* RESTRICT f, int n,
+                                    int* /* RESTRICT v */, float* /* RESTRICT z */) const
+                    {
+                        (*this)(d, f, n);
+                    }
                 };
 
 
@@ -300,17 +548,27 @@ namespace vigra
                 struct EuclideanTransform1D
                 {
                     typedef ValueType value_type;
+                    typedef float math_t;
 
                     int id() const {return 2;}
 
                     void operator()(ValueType* RESTRICT d, const ValueType* RESTRICT f, int n) const
                     {
-                        typedef float math_t;
-
-                        const math_t infinity = std::numeric_limits<math_t>::infinity();
-
                         int* v = static_cast<int*>(::omp::malloc(n * sizeof(int)));
                         math_t* z = static_cast<math_t*>(::omp::malloc((n + 1) * sizeof(math_t)));
+
+                        (*this)(d, f, n, v, z);
+
+                        ::omp::free(z);
+                        ::omp::free(v);
+                    }
+
+                    // Same as above, but work in the caller's scratch arrays: v
+                    // holds at least n and z at least n + 1 elements.
+                    void operator()(ValueType* RESTRICT d, const ValueType* RESTRICT f, int n,
+                                    int* RESTRICT v, math_t* RESTRICT z) const
+                    {
+                        const math_t infinity = std::numeric_limits<math_t>::infinity();
                         int k = 0;
 
                         v[0] = 0;
@@ -347,20 +605,122 @@ namespace vigra
                             }
                             d[q] = square(q - v[k]) + f[v[k]];
                         }
+                    }
+                };
 
-                        ::omp::free(z);
-                        ::omp::free(v);
+
+                // Scratch memory of one thread for fhTiledDistanceTransform()
+                // and for the periodic lines of fhDistanceTransform().  The
+                // buffers outlive the transform, thus the many distance
+                // transforms of a run only allocate memory when an image
+                // exceeds all previous ones.
+                template <class ValueType>
+                class Workspace
+                {
+                public:
+                    void reserve(int a_length, int a_tile_size)
+                    {
+                        if (static_cast<size_t>(a_length) > d_.size())
+                        {
+                            d_.resize(a_length);
+                            v_.resize(a_length);
+                            z_.resize(a_length + 1);
+                        }
+                        if (static_cast<size_t>(a_tile_size) > tile_.size())
+                        {
+                            tile_.resize(a_tile_size);
+                        }
+                    }
+
+                    // Periodic lines need two extra buffers, which hold the line
+                    // extended by its wrapped-around ends.
+                    void reserve_periodic(int a_length)
+                    {
+                        const size_t extended_length = periodic_extension(a_length);
+                        if (extended_length > extended_f_.size())
+                        {
+                            extended_f_.resize(extended_length);
+                            extended_d_.resize(extended_length);
+                        }
+                        reserve(static_cast<int>(extended_length), 0);
                     }
+
+                    static int periodic_padding(int a_length) {return a_length / 2 + 1;}
+                    static int periodic_extension(int a_length) {return a_length + 2 * periodic_padding(a_length);}
+
+                    ValueType* d() {return d_.data();}
+                    int* v() {return v_.data();}
+                    float* z() {return z_.data();}
+                    ValueType* tile() {return tile_.data();}
+                    ValueType* extended_f() {return extended_f_.data();}
+                    ValueType* extended_d() {return extended_d_.data();}
+
+                private:
+                    std::vector<ValueType> d_;
+                    std::vector<int> v_;
+                    std::vector<float> z_;
+                    std::vector<ValueType> tile_;
+                    std::vector<ValueType> extended_f_;
+                    std::vector<ValueType> extended_d_;
                 };
 
 
+                template <class ValueType>
+                inline static Workspace<ValueType>&
+                thread_workspace()
+                {
+                    static thread_local Workspace<ValueType> workspace;
+                    return workspace;
+                }
+
+
+                const size_t cache_line_size = 64U;
+                const size_t tile_size_limit = 256U * 1024U; // conservative size of an L2 cache
+
+
+                // Transform the line f of length n into d.  If the line is
+                // periodic, the distance between samples q and q' is
+                //     min_k |q - q' + k * n|,
+                // i.e. the nearest copy of any sample lies at most n/2 samples
+                // away.  Transforming the line padded with more than n/2
+                // wrapped-around samples at either end thus yields the exact
+                // periodic result for the n central samples.
+                template <class Transform1dFunctor, class ValueType>
+                inline static void
+                transform_line(const Transform1dFunctor& transform1d,
+                               ValueType* RESTRICT d, const ValueType* RESTRICT f, int n,
+                               bool periodic, Workspace<ValueType>& workspace)
+                {
+                    if (periodic)
+                    {
+                        const int padding = Workspace<ValueType>::periodic_padding(n); // padding <= n
+                        ValueType* const extended_f = workspace.extended_f();
+                        ValueType* const extended_d = workspace.extended_d();
+
+                        std::copy(f + n - padding, f + n, extended_f);
+                        std::copy(f, f + n, extended_f + padding);
+                        std::copy(f, f + padding, extended_f + padding + n);
+
+                        transform1d(extended_d, extended_f, n + 2 * padding, workspace.v(), workspace.z());
+                        std::copy(extended_d + padding, extended_d + padding + n, d);
+                    }
+                    else
+                    {
+                        transform1d(d, f, n, workspace.v(), workspace.z());
+                    }
+                }
+
+
+                // If periodic_x (periodic_y) is true, the image wraps around
+                // horizontally (vertically); see fhTiledDistanceTransform().
                 template <class SrcImageIterator, class SrcAccessor,
                           class DestImageIterator, class DestAccessor,
                           class ValueType, class Transform1dFunctor>
                 void
                 fhDistanceTransform(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
                                     DestImageIterator dest_upperleft, DestAccessor da,
-                                    ValueType background, Transform1dFunctor transform1d)
+                                    ValueType background, Transform1dFunctor transform1d,
+                                    bool periodic_x = false, bool periodic_y = false)
                 {
                     typedef typename Transform1dFunctor::value_type DistanceType;
                     typedef typename vigra::NumericTraits<DistanceType> DistanceTraits;
@@ -370,7 +730,9 @@ namespace vigra
                     const int greatest_length = std::max(size.x, size.y);
                     DistanceImageType intermediate(size, vigra::SkipInitialization);
 
+#ifdef OPENMP
 #pragma omp parallel
+#endif
                     {
                         DistanceType* const f = new DistanceType[greatest_length];
                         DistanceType* const d = new DistanceType[greatest_length];
@@ -378,11 +740,20 @@ namespace vigra
                         DistanceType* const pf_end = f + size.y;
                         const DistanceType* const pd_end = d + size.y;
 
+                        Workspace<DistanceType>* workspace = nullptr;
+                        if (periodic_x || periodic_y)
+                        {
+                            workspace = &thread_workspace<DistanceType>();
+                            workspace->reserve_periodic(greatest_length);
+                        }
+
                         // IMPLEMENTATION NOTE
                         //     We need "guided" schedule to reduce the waiting time at the
                         //     (implicit) barriers.  This holds true for the next OpenMP
                         //     parallelized "for" loop, too.
+#ifdef OPENMP
 #pragma omp for schedule(guided)
+#endif
                         for (int x = 0; x < size.x; ++x)
                         {
                             SrcImageIterator si(src_upperleft + vigra::Diff2D(x, 0));
@@ -392,7 +763,14 @@ namespace vigra
                                 ++si.y;
                             }
 
-                            transform1d(d, f, size.y);
+                            if (periodic_y)
+                            {
+                                transform_line(transform1d, d, f, size.y, true, *workspace);
+                            }
+                            else
+                            {
+                                transform1d(d, f, size.y);
+                            }
 
                             typename DistanceImageType::column_iterator ci(intermediate.columnBegin(x));
                             for (const DistanceType* pd = d; pd != pd_end; ++pd)
@@ -405,10 +783,19 @@ namespace vigra
                             }
                         }
 
+#ifdef OPENMP
 #pragma omp for nowait schedule(guided)
+#endif
                         for (int y = 0; y < size.y; ++y)
                         {
-                            transform1d(d, &intermediate(0, y), size.x);
+                            if (periodic_x)
+                            {
+                                transform_line(transform1d, d, &intermediate(0, y), size.x, true, *workspace);
+                            }
+                            else
+                            {
+                                transform1d(d, &intermediate(0, y), size.x);
+                            }
                             DestImageIterator i(dest_upperleft + vigra::Diff2D(0, y));
 
                             if (transform1d.id() == 2)
@@ -431,10 +818,190 @@ namespace vigra
                         delete [] f;
                     } // omp parallel
                 }
+
+                // Answer the number of columns the column pass of
+                // fhTiledDistanceTransform() works on at once.  A tile spans at
+                // least one cache line of a row and, if the tile still fits into
+                // the L2 cache, up to four lines.
+                template <class ValueType>
+                inline static int
+                column_tile_width(int a_height)
+                {
+                    const int line = std::max(1, static_cast<int>(cache_line_size / sizeof(ValueType)));
+                    const int fit =
+                        static_cast<int>(tile_size_limit / (std::max(a_height, 1) * sizeof(ValueType)));
+
+                    return line * std::max(1, std::min(4, fit / line));
+                }
+
+
+                // Cache-blocked variant of fhDistanceTransform().
+                //
+                // The column pass of fhDistanceTransform() reads the source and
+                // writes the intermediate image in column order, touching a new
+                // cache line for every pixel.  Here, the column pass works on
+                // tiles of a few cache lines width.  It gathers a tile row by row
+                // into a transposed, contiguous buffer, transforms the buffer's
+                // rows, and scatters them back row by row.  The Manhattan norm
+                // needs no lower envelope, so its column pass simply sweeps down
+                // and up the rows of a tile, which vectorizes along x, and skips
+                // the transposition altogether.
+                //
+                // All scratch memory comes from the calling thread's Workspace.
+                //
+                // If periodic_x (periodic_y) is true, the image wraps around
+                // horizontally (vertically) and distances are measured on the
+                // cylinder or torus.
+                template <class SrcImageIterator, class SrcAccessor,
+                          class DestImageIterator, class DestAccessor,
+                          class ValueType, class Transform1dFunctor>
+                void
+                fhTiledDistanceTransform(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+                                         DestImageIterator dest_upperleft, DestAccessor da,
+                                         ValueType background, Transform1dFunctor transform1d,
+                                         bool periodic_x = false, bool periodic_y = false)
+                {
+                    typedef typename Transform1dFunctor::value_type DistanceType;
+                    typedef typename vigra::NumericTraits<DistanceType> DistanceTraits;
+                    typedef vigra::BasicImage<DistanceType> DistanceImageType;
+
+                    const vigra::Size2D size(src_lowerright - src_upperleft);
+                    const int greatest_length = std::max(size.x, size.y);
+                    const int tile_width = column_tile_width<DistanceType>(size.y);
+                    const int number_of_tiles = (size.x + tile_width - 1) / tile_width;
+                    const bool sweep_columns = transform1d.id() == 1 && !periodic_y;
+                    DistanceImageType intermediate(size, vigra::SkipInitialization);
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+                    {
+                        Workspace<DistanceType>& workspace(thread_workspace<DistanceType>());
+                        workspace.reserve(greatest_length, sweep_columns ? 0 : tile_width * size.y);
+                        if (periodic_x || periodic_y)
+                        {
+                            workspace.reserve_periodic(greatest_length);
+                        }
+
+                        DistanceType* const d = workspace.d();
+
+                        if (sweep_columns)
+                        {
+                            const DistanceType one = DistanceTraits::one();
+
+#ifdef OPENMP
+#pragma omp for schedule(guided)
+#endif
+                            for (int t = 0; t < number_of_tiles; ++t)
+                            {
+                                const int x_begin = t * tile_width;
+                                const int n = std::min(tile_width, size.x - x_begin);
+
+                                for (int y = 0; y < size.y; ++y)
+                                {
+                                    SrcImageIterator si(src_upperleft + vigra::Diff2D(x_begin, y));
+                                    DistanceType* RESTRICT row = &intermediate(x_begin, y);
+
+                                    for (int j = 0; j < n; ++j, ++si.x)
+                                    {
+                                        row[j] = EXPECT_RESULT(sa(si) == background, false) ? DistanceTraits::max() : DistanceTraits::zero();
+                                    }
+                                    if (y != 0)
+                                    {
+                                        const DistanceType* RESTRICT previous = &intermediate(x_begin, y - 1);
+                                        for (int j = 0; j < n; ++j)
+                                        {
+                                            row[j] = std::min<DistanceType>(row[j], previous[j] + one);
+                                        }
+                                    }
+                                }
+
+                                for (int y = size.y - 2; y >= 0; --y)
+                                {
+                                    DistanceType* RESTRICT row = &intermediate(x_begin, y);
+                                    const DistanceType* RESTRICT next = &intermediate(x_begin, y + 1);
+
+                                    for (int j = 0; j < n; ++j)
+                                    {
+                                        row[j] = std::min<DistanceType>(row[j], next[j] + one);
+                                    }
+                                }
+                            }
+                        }
+                        else
+                        {
+                            DistanceType* const tile = workspace.tile();
+
+#ifdef OPENMP
+#pragma omp for schedule(guided)
+#endif
+                            for (int t = 0; t < number_of_tiles; ++t)
+                            {
+                                const int x_begin = t * tile_width;
+                                const int n = std::min(tile_width, size.x - x_begin);
+
+                                // Column j of the tile becomes the contiguous row j of `tile'.
+                                for (int y = 0; y < size.y; ++y)
+                                {
+                                    SrcImageIterator si(src_upperleft + vigra::Diff2D(x_begin, y));
+                                    DistanceType* column = tile + y;
+
+                                    for (int j = 0; j < n; ++j, ++si.x, column += size.y)
+                                    {
+                                        *column = EXPECT_RESULT(sa(si) == background, false) ? DistanceTraits::max() : DistanceTraits::zero();
+                                    }
+                                }
+
+                                for (int j = 0; j < n; ++j)
+                                {
+                                    DistanceType* const column = tile + j * size.y;
+                                    transform_line(transform1d, d, column, size.y, periodic_y, workspace);
+                                    std::copy(d, d + size.y, column);
+                                }
+
+                                for (int y = 0; y < size.y; ++y)
+                                {
+                                    DistanceType* RESTRICT row = &intermediate(x_begin, y);
+                                    const DistanceType* column = tile + y;
+
+                                    for (int j = 0; j < n; ++j, column += size.y)
+                                    {
+                                        row[j] = *column;
+                                    }
+                                }
+                            }
+                        }
+
+#ifdef OPENMP
+#pragma omp for nowait schedule(guided)
+#endif
+                        for (int y = 0; y < size.y; ++y)
+                        {
+                            transform_line(transform1d, d, &intermediate(0, y), size.x, periodic_x, workspace);
+                            DestImageIterator i(dest_upperleft + vigra::Diff2D(0, y));
+
+                            if (transform1d.id() == 2)
+                            {
+                                for (DistanceType* pd = d; pd != d + size.x; ++pd, ++i.x)
+                                {
+                                    da.set(sqrt(*pd), i);
+                                }
+                            }
+                            else
+                            {
+                                for (DistanceType* pd = d; pd != d + size.x; ++pd, ++i.x)
+                                {
+                                    da.set(*pd, i);
+                                }
+                            }
+                        }
+                    } // omp parallel
+                }
             } // namespace detail
         } // namespace fh
 
 
+#ifdef OPENMP
         template <class SrcImageIterator, class SrcAccessor,
                   class DestImageIterator, class DestAccessor,
                   class ValueType>
@@ -443,6 +1010,8 @@ namespace vigra
                           DestImageIterator dest_upperleft, DestAccessor da,
                           ValueType background, int norm)
         {
+            const bool tiled = tiledDistanceTransform();
+
             switch (norm)
             {
             case 0:
@@ -453,138 +1022,43 @@ namespace vigra
                 break;
 
             case 1:
-                fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
-                                                dest_upperleft, da,
-                                                background,
-                                                fh::detail::ManhattanTransform1D<float>());
+                if (tiled)
+                {
+                    fh::detail::fhTiledDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                         dest_upperleft, da,
+                                                         background,
+                                                         fh::detail::ManhattanTransform1D<float>());
+                }
+                else
+                {
+                    fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                    dest_upperleft, da,
+                                                    background,
+                                                    fh::detail::ManhattanTransform1D<float>());
+                }
                 break;
 
             case 2: // FALLTHROUGH
             default:
-                fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
-                                                dest_upperleft, da,
-                                                background,
-                                                fh::detail::EuclideanTransform1D<float>());
+                if (tiled)
+                {
+                    fh::detail::fhTiledDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                         dest_upperleft, da,
+                                                         background,
+                                                         fh::detail::EuclideanTransform1D<float>());
+                }
+                else
+                {
+                    fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                    dest_upperleft, da,
+                                                    background,
+                                                    fh::detail::EuclideanTransform1D<float>());
+                }
             }
         }
 
-
 #else
 
-
-        template <class SrcImageIterator1, class SrcAccessor1,
-                  class SrcImageIterator2, class SrcAccessor2,
-                  class DestImageIterator, class DestAccessor,
-                  class Functor>
-        inline void
-        combineTwoImages(SrcImageIterator1 src1_upperleft,
-                         SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
-                         SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
-                         DestImageIterator dest_upperleft, DestAccessor dest_acc,
-                         const Functor& func)
-        {
-            vigra::combineTwoImages(src1_upperleft, src1_lowerright, src1_acc,
-                                    src2_upperleft, src2_acc,
-                                    dest_upperleft, dest_acc,
-                                    func);
-        }
-
-
-        template <class SrcImageIterator1, class SrcAccessor1,
-                  class SrcImageIterator2, class SrcAccessor2,
-                  class MaskImageIterator, class MaskAccessor,
-                  class DestImageIterator, class DestAccessor,
-                  class Functor>
-        inline void
-        combineTwoImagesIf(SrcImageIterator1 src1_upperleft, SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
-                           SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
-                           MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
-                           DestImageIterator dest_upperleft, DestAccessor dest_acc,
-                           const Functor& func)
-        {
-            vigra::combineTwoImagesIf(src1_upperleft, src1_lowerright, src1_acc,
-                                      src2_upperleft, src2_acc,
-                                      mask_upperleft, mask_acc,
-                                      dest_upperleft, dest_acc,
-                                      func);
-        }
-
-
-        template <class SrcImageIterator1, class SrcAccessor1,
-                  class SrcImageIterator2, class SrcAccessor2,
-                  class SrcImageIterator3, class SrcAccessor3,
-                  class DestImageIterator, class DestAccessor,
-                  class Functor>
-        inline void
-        combineThreeImages(SrcImageIterator1 src1_upperleft, SrcImageIterator1 src1_lowerright, SrcAccessor1 src1_acc,
-                           SrcImageIterator2 src2_upperleft, SrcAccessor2 src2_acc,
-                           SrcImageIterator3 src3_upperleft, SrcAccessor3 src3_acc,
-                           DestImageIterator dest_upperleft, DestAccessor dest_acc,
-                           const Functor& func)
-        {
-            vigra::combineThreeImages(src1_upperleft, src1_lowerright, src1_acc,
-                                      src2_upperleft, src2_acc,
-                                      src3_upperleft, src3_acc,
-                                      dest_upperleft, dest_acc,
-                                      func);
-        }
-
-
-        template <class SrcImageIterator, class SrcAccessor,
-                  class DestImageIterator, class DestAccessor>
-        inline void
-        copyImage(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
-                  DestImageIterator dest_upperleft, DestAccessor dest_acc)
-        {
-            vigra::copyImage(src_upperleft, src_lowerright, src_acc, dest_upperleft, dest_acc);
-        }
-
-
-        template <class SrcImageIterator, class SrcAccessor,
-                  class MaskImageIterator, class MaskAccessor,
-                  class DestImageIterator, class DestAccessor>
-        inline void
-        copyImageIf(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
-                    MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
-                    DestImageIterator dest_upperleft, DestAccessor dest_acc)
-        {
-            vigra::copyImageIf(src_upperleft, src_lowerright, src_acc,
-                               mask_upperleft, mask_acc,
-                               dest_upperleft, dest_acc);
-        }
-
-
-        template <class SrcImageIterator, class SrcAccessor,
-                  class DestImageIterator, class DestAccessor,
-                  class Functor>
-        inline void
-        transformImage(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
-                       DestImageIterator dest_upperleft, DestAccessor dest_acc,
-                       const Functor& func)
-        {
-            vigra::transformImage(src_upperleft, src_lowerright, src_acc,
-                                  dest_upperleft, dest_acc,
-                                  func);
-        }
-
-
-        template <class SrcImageIterator, class SrcAccessor,
-                  class MaskImageIterator, class MaskAccessor,
-                  class DestImageIterator, class DestAccessor,
-                  class Functor>
-        inline void
-        transformImageIf(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor src_acc,
-                         MaskImageIterator mask_upperleft, MaskAccessor mask_acc,
-                         DestImageIterator dest_upperleft, DestAccessor dest_acc,
-                         const Functor& func)
-        {
-            vigra::transformImageIf(src_upperleft, src_lowerright, src_acc,
-                                    mask_upperleft, mask_acc,
-                                    dest_upperleft, dest_acc,
-                                    func);
-        }
-
-
         template <class SrcImageIterator, class SrcAccessor,
                   class DestImageIterator, class DestAccessor,
                   class ValueType>
@@ -601,6 +1075,71 @@ namespace vigra
 #endif // OPENMP
 
 
+        // Distance transform of an image that wraps around horizontally
+        // (periodic_x), vertically (periodic_y), or both.  Unlike
+        // distanceTransform() it does not depend on OpenMP, which only
+        // parallelizes the transform.
+        template <class SrcImageIterator, class SrcAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class ValueType>
+        void
+        periodicDistanceTransform(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+                                  DestImageIterator dest_upperleft, DestAccessor da,
+                                  ValueType background, int norm, bool periodic_x, bool periodic_y)
+        {
+            const bool tiled = tiledDistanceTransform();
+
+            switch (norm)
+            {
+            case 0:
+                fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                dest_upperleft, da,
+                                                background,
+                                                fh::detail::ChessboardTransform1D<float>(),
+                                                periodic_x, periodic_y);
+                break;
+
+            case 1:
+                if (tiled)
+                {
+                    fh::detail::fhTiledDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                         dest_upperleft, da,
+                                                         background,
+                                                         fh::detail::ManhattanTransform1D<float>(),
+                                                         periodic_x, periodic_y);
+                }
+                else
+                {
+                    fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                    dest_upperleft, da,
+                                                    background,
+                                                    fh::detail::ManhattanTransform1D<float>(),
+                                                    periodic_x, periodic_y);
+                }
+                break;
+
+            case 2: // FALLTHROUGH
+            default:
+                if (tiled)
+                {
+                    fh::detail::fhTiledDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                         dest_upperleft, da,
+                                                         background,
+                                                         fh::detail::EuclideanTransform1D<float>(),
+                                                         periodic_x, periodic_y);
+                }
+                else
+                {
+                    fh::detail::fhDistanceTransform(src_upperleft, src_lowerright, sa,
+                                                    dest_upperleft, da,
+                                                    background,
+                                                    fh::detail::EuclideanTransform1D<float>(),
+                                                    periodic_x, periodic_y);
+                }
+            }
+        }
+
+
         //
         // Argument Object Factory versions
         //
@@ -718,6 +1257,37 @@ namespace vigra
         }
 
 
+        template <class SrcImageIterator, class SrcAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageRows(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                           vigra::pair<DestImageIterator, DestAccessor> dest,
+                           const Functor& functor)
+        {
+            vigra::omp::transformImageRows(src.first, src.second, src.third,
+                                           dest.first, dest.second,
+                                           functor);
+        }
+
+
+        template <class SrcImageIterator, class SrcAccessor,
+                  class MaskImageIterator, class MaskAccessor,
+                  class DestImageIterator, class DestAccessor,
+                  class Functor>
+        inline void
+        transformImageRowsIf(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                             vigra::pair<MaskImageIterator, MaskAccessor> mask,
+                             vigra::pair<DestImageIterator, DestAccessor> dest,
+                             const Functor& functor)
+        {
+            vigra::omp::transformImageRowsIf(src.first, src.second, src.third,
+                                             mask.first, mask.second,
+                                             dest.first, dest.second,
+                                             functor);
+        }
+
+
         template <class SrcImageIterator, class SrcAccessor,
                   class DestImageIterator, class DestAccessor,
                   class ValueType>
@@ -21,9 +21,13 @@
 #include <config.h>
 #endif
 
+#include <algorithm>    // std::find()
 #include <cctype>       // isalnum(), isalpha()
 #include <cerrno>       // errno
 #include <cstdlib>      // strtod(), strtol(), strtoul()
+#include <iostream>
+#include <sstream>
+#include <vector>
 
 #ifdef HAVE_UNORDERED_MAP
 #include <unordered_map>
@@ -332,6 +336,7 @@ namespace parameter
     insert(const std::string& a_key, const std::string& a_value)
     {
         map.insert(parameter_map_t::value_type(a_key, ParameterValue(a_value)));
+        resolve_handles();
     }
 
 
@@ -339,6 +344,7 @@ namespace parameter
     erase(const std::string& a_key)
     {
         map.erase(a_key);
+        resolve_handles();
     }
 
 
@@ -346,6 +352,7 @@ namespace parameter
     erase_all()
     {
         map.clear();
+        resolve_handles();
     }
 
 
@@ -506,4 +513,110 @@ namespace parameter
             return x->second.as_boolean();
         }
     }
+
+
+    //
+    // Parameter Handles
+    //
+
+    typedef std::vector<handle_base*> handle_list_t;
+
+
+    // Construct the list on first use, because handles at namespace
+    // scope of other translation units may be constructed before
+    // anything in this translation unit.
+    static handle_list_t&
+    handles()
+    {
+        static handle_list_t list;
+        return list;
+    }
+
+
+    handle_base::handle_base(const char* a_key) : key_(a_key)
+    {
+        handles().push_back(this);
+    }
+
+
+    handle_base::~handle_base()
+    {
+        handle_list_t& list(handles());
+        handle_list_t::iterator self = std::find(list.begin(), list.end(), this);
+        if (self != list.end())
+        {
+            list.erase(self);
+        }
+    }
+
+
+    void
+    resolve_handles()
+    {
+        handle_list_t& list(handles());
+        for (handle_list_t::iterator h = list.begin(); h != list.end(); ++h)
+        {
+            (*h)->resolve();
+        }
+    }
+
+
+    void
+    dump_handles(std::ostream& a_stream)
+    {
+        const handle_list_t& list(handles());
+        for (handle_list_t::const_iterator h = list.begin(); h != list.end(); ++h)
+        {
+            a_stream << "+     " << (*h)->key() << " = <" << (*h)->value_as_string() << ">";
+            if (exists((*h)->key()))
+            {
+                a_stream << ", default <" << (*h)->default_value_as_string() << ">\n";
+            }
+            else
+            {
+                a_stream << " (default)\n";
+            }
+        }
+    }
+
+
+    std::string
+    to_string(const std::string& a_value)
+    {
+        return a_value;
+    }
+
+
+    std::string
+    to_string(int a_value)
+    {
+        std::ostringstream s;
+        s << a_value;
+        return s.str();
+    }
+
+
+    std::string
+    to_string(unsigned a_value)
+    {
+        std::ostringstream s;
+        s << a_value;
+        return s.str();
+    }
+
+
+    std::string
+    to_string(double a_value)
+    {
+        std::ostringstream s;
+        s << a_value;
+        return s.str();
+    }
+
+
+    std::string
+    to_string(bool a_value)
+    {
+        return a_value ? "true" : "false";
+    }
 } // end namespace parameter
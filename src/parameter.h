@@ -21,6 +21,7 @@
 #define PARAMETER_H_INCLUDED
 
 
+#include <iosfwd>
 #include <stdexcept>
 #include <string>
 
@@ -107,6 +108,120 @@ namespace parameter
 
     bool as_boolean(const std::string& a_key);
     bool as_boolean(const std::string& a_key, bool a_default_value);
+
+
+    // Parameter Handles
+    //
+    // A handle binds a key and a default value to a typed slot that
+    // holds the parameter's value.  The slot starts out with the
+    // default value and is refilled whenever the parameter map
+    // changes, so reading a handle neither hashes the key nor
+    // allocates memory.  Use handles for parameters queried in
+    // time-critical parts of the code.
+    //
+    // Handles register themselves in a global list; define them at
+    // namespace scope, where they are constructed before main() runs
+    // and any other thread exists.  Define each handle in exactly one
+    // translation unit and declare it extern in headers, so that
+    // every key has a single entry in the list.
+    //
+    //     extern parameter::handle<bool> debug_foobar;    // foo.h
+    //     parameter::handle<bool> debug_foobar("debug-foobar", false);    // foo.cc
+    //     ...
+    //     if (debug_foobar()) {...}
+    //
+    // Like the corresponding as_* function, reading a handle throws
+    // conversion_error if the parameter's value cannot be represented
+    // as the handle's type.
+
+    class handle_base
+    {
+    public:
+        handle_base() = delete;
+        handle_base(const handle_base&) = delete;
+        handle_base& operator=(const handle_base&) = delete;
+        virtual ~handle_base();
+
+        const char* key() const {return key_;}
+        virtual std::string value_as_string() const = 0;
+        virtual std::string default_value_as_string() const = 0;
+
+        // Re-read the value from the parameter map.
+        virtual void resolve() = 0;
+
+    protected:
+        explicit handle_base(const char* a_key);
+
+    private:
+        const char* const key_;
+    }; // class handle_base
+
+
+    inline static std::string lookup(const std::string& a_key, const std::string& a_default_value) {return as_string(a_key, a_default_value);}
+    inline static int lookup(const std::string& a_key, int a_default_value) {return as_integer(a_key, a_default_value);}
+    inline static unsigned lookup(const std::string& a_key, unsigned a_default_value) {return as_unsigned(a_key, a_default_value);}
+    inline static double lookup(const std::string& a_key, double a_default_value) {return as_double(a_key, a_default_value);}
+    inline static bool lookup(const std::string& a_key, bool a_default_value) {return as_boolean(a_key, a_default_value);}
+
+    std::string to_string(const std::string& a_value);
+    std::string to_string(int a_value);
+    std::string to_string(unsigned a_value);
+    std::string to_string(double a_value);
+    std::string to_string(bool a_value);
+
+
+    template <typename T>
+    class handle : public handle_base
+    {
+    public:
+        handle(const char* a_key, const T& a_default_value) :
+            handle_base(a_key), default_value_(a_default_value), value_(a_default_value), error_(false)
+        {
+            // The parameter map is empty before main() runs, and it may
+            // not even be constructed yet, so we must not look up the key
+            // here.  Any later change of the map resolves the handle.
+        }
+
+        const T& operator()() const
+        {
+            if (error_)
+            {
+                lookup(key(), default_value_); // throws the original conversion_error
+            }
+            return value_;
+        }
+
+        std::string value_as_string() const {return error_ ? as_string(key()) : to_string(value_);}
+        std::string default_value_as_string() const {return to_string(default_value_);}
+
+        void resolve()
+        {
+            try
+            {
+                value_ = lookup(key(), default_value_);
+                error_ = false;
+            }
+            catch (conversion_error&)
+            {
+                value_ = default_value_;
+                error_ = true;
+            }
+        }
+
+    private:
+        const T default_value_;
+        T value_;
+        bool error_;
+    }; // class handle
+
+
+    // Re-read the values of all handles.  The modifying functions
+    // insert(), erase(), and erase_all() call this function.
+    void resolve_handles();
+
+    // Write the keys, values, and default values of all handles to
+    // a_stream, one handle per line and each key only once.
+    void dump_handles(std::ostream& a_stream);
 } // namespace parameter
 
 
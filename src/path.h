@@ -26,22 +26,33 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <array>
+#include <functional>
 #include <iostream>
 #include <queue>
+#include <utility>
 #include <vector>
 
+#include "parameter.h"
+
 
 namespace enblend
 {
+    // Defined in enblend.cc.
+    extern parameter::handle<bool> debugPath;
+    extern parameter::handle<bool> debugPathCompare;
+
+
     template <typename Point, typename Image>
     class PathCompareFunctor : public std::binary_function<Point, Point, bool>
     {
     public:
-        explicit PathCompareFunctor(const Image* an_image) : image_(an_image) {}
+        explicit PathCompareFunctor(const Image* an_image) :
+            image_(an_image), debug_(debugPathCompare()) {}
 
         bool operator()(const Point& a_point, const Point& another_point) const {
-            if (parameter::as_boolean("debug-path-compare", false)) {
+            if (debug_) {
                 std::cout << "+ PathCompareFunctor::operator(): comparing "
                           << "cost(p1 = " << a_point << ") = " << (*image_)[a_point] << " and "
                           << "cost(p2 = " << another_point << ") = " << (*image_)[another_point]
@@ -53,6 +64,7 @@ namespace enblend
 
     private:
         const Image* const image_;
+        const bool debug_;
     }; // class PathCompareFunctor
 
 
@@ -87,7 +99,7 @@ namespace enblend
         PriorityQueue pq((PathCompareFunctor<vigra::Point2D, WorkingImageType>(&costSoFar)));
         std::vector<vigra::Point2D>* result = new std::vector<vigra::Point2D>;
 
-        if (parameter::as_boolean("debug-path", false)) {
+        if (debugPath()) {
             std::cout << "+ minCostPath: size = " << size << "\n"
                       << "+ minCostPath: startingPoint = " << startingPoint
                       << (valid_region.contains(startingPoint) ? "" : " (invalid)")
@@ -106,13 +118,13 @@ namespace enblend
         while (!pq.empty()) {
             vigra::Point2D top = pq.top();
             pq.pop();
-            if (parameter::as_boolean("debug-path", false)) {
+            if (debugPath()) {
                 std::cout << "+ minCostPath: visiting point = " << top << std::endl;
             }
 
             if (top != startingPoint) {
                 WorkingPixelType costToTop = costSoFar[top];
-                if (parameter::as_boolean("debug-path", false)) {
+                if (debugPath()) {
                     std::cout << "+ minCostPath: costToTop = " << costToTop << std::endl;
                 }
 
@@ -130,7 +142,7 @@ namespace enblend
                     if (!valid_region.contains(neighborPoint)) {
                         continue;
                     }
-                    if (parameter::as_boolean("debug-path", false)) {
+                    if (debugPath()) {
                         std::cout << "+ minCostPath: neighbor = " << neighborPoint << std::endl;
                     }
 
@@ -138,7 +150,7 @@ namespace enblend
                     // If neighbor has maximal cost, it has not been visited.
                     // If so skip it.
                     WorkingPixelType neighborPreviousCost = costSoFar[neighborPoint];
-                    if (parameter::as_boolean("debug-path", false)) {
+                    if (debugPath()) {
                         std::cout <<
                             "+ minCostPath: neighborPreviousCost = " << neighborPreviousCost << std::endl;
                     }
@@ -149,7 +161,7 @@ namespace enblend
                     WorkingPixelType neighborCost =
                         std::max(vigra::NumericTraits<WorkingPixelType>::one(),
                                  vigra::NumericTraits<WorkingPixelType>::toPromote(cost_accessor(cost_upperleft + neighborPoint)));
-                    if (parameter::as_boolean("debug-path", false)) {
+                    if (debugPath()) {
                         std::cout << "+ minCostPath: neighborCost = " << neighborCost << std::endl;
                     }
                     if (neighborCost == vigra::NumericTraits<CostPixelType>::max()) {
@@ -201,6 +213,445 @@ namespace enblend
     {
         return minCostPath(cost.first, cost.second, cost.third, startingPoint, endingPoint);
     }
+
+    // 4-bit direction encoding {up, down, left, right} of minCostPath()
+    // A  8  9
+    // 2  0  1
+    // 6  4  5
+    static const std::array<vigra::UInt8, 8> pathNeighborArray = {{0xA, 1, 6, 8, 5, 2, 9, 4}};
+    static const std::array<vigra::UInt8, 8> pathNeighborArrayInverse = {{5, 2, 9, 4, 0xA, 1, 6, 8}};
+
+
+    inline static vigra::Point2D
+    pathStep(vigra::Point2D aPoint, vigra::UInt8 aDirection)
+    {
+        if (aDirection & 0x8) {--aPoint.y;}
+        if (aDirection & 0x4) {++aPoint.y;}
+        if (aDirection & 0x2) {--aPoint.x;}
+        if (aDirection & 0x1) {++aPoint.x;}
+        return aPoint;
+    }
+
+
+    /** Persistent state of minCostPath() and minCostPathBidirectional()
+     *  queries.
+     *
+     *  A workspace keeps its arrays and heaps between queries; they
+     *  only grow to the largest region seen so far.  Instead of
+     *  resetting the labels of all pixels before a query, each label
+     *  carries the generation of the query that wrote it; labels of
+     *  other generations count as unvisited.  Thus, a query costs
+     *  time proportional to the pixels it visits, and it does not
+     *  allocate memory once the workspace has grown large enough.
+     *
+     *  A workspace must not be shared among threads.
+     */
+    template <typename WorkingPixelType>
+    class PathWorkspace
+    {
+    public:
+        typedef std::pair<WorkingPixelType, size_t> heap_entry;
+
+        PathWorkspace() : width_(0), generation_(0U) {}
+
+        PathWorkspace(const PathWorkspace&) = delete;
+        PathWorkspace& operator=(const PathWorkspace&) = delete;
+
+        // Start a new query on a region of aSize.
+        void start(const vigra::Size2D& aSize) {
+            const size_t n = static_cast<size_t>(aSize.x) * static_cast<size_t>(aSize.y);
+
+            width_ = aSize.x;
+            for (int i = 0; i < 2; ++i) {
+                fronts_[i].resize(n);
+                fronts_[i].heap.clear();
+                fronts_[i].entries.clear();
+            }
+            path_.clear();
+
+            ++generation_;
+            if (generation_ == 0U) {
+                // wrap-around: forget all labels for good
+                for (int i = 0; i < 2; ++i) {
+                    std::fill(fronts_[i].stamp.begin(), fronts_[i].stamp.end(), 0U);
+                }
+                generation_ = 1U;
+            }
+        }
+
+        size_t index(const vigra::Point2D& aPoint) const {
+            return static_cast<size_t>(aPoint.y) * static_cast<size_t>(width_) + static_cast<size_t>(aPoint.x);
+        }
+
+        vigra::Point2D point(size_t anIndex) const {
+            return vigra::Point2D(static_cast<int>(anIndex % static_cast<size_t>(width_)),
+                                  static_cast<int>(anIndex / static_cast<size_t>(width_)));
+        }
+
+        // Front 0 searches from the ending point, front 1 from the
+        // starting point.
+        bool isLabeled(int aFront, size_t anIndex) const {return fronts_[aFront].stamp[anIndex] == generation_;}
+
+        WorkingPixelType cost(int aFront, size_t anIndex) const {
+            return isLabeled(aFront, anIndex) ? fronts_[aFront].cost[anIndex] : vigra::NumericTraits<WorkingPixelType>::max();
+        }
+
+        vigra::UInt8 nextHop(int aFront, size_t anIndex) const {
+            return isLabeled(aFront, anIndex) ? fronts_[aFront].hop[anIndex] : vigra::UInt8(0);
+        }
+
+        void label(int aFront, size_t anIndex, WorkingPixelType aCost, vigra::UInt8 aNextHop) {
+            Front& front = fronts_[aFront];
+            front.stamp[anIndex] = generation_;
+            front.cost[anIndex] = aCost;
+            front.hop[anIndex] = aNextHop;
+        }
+
+        // Min-heap of pixel indices ordered by their current cost, for
+        // searches that never lower a label.  The heap operations are
+        // the same that std::priority_queue uses, so that equal costs
+        // are resolved in the same order.
+        void pushIndex(size_t anIndex) {
+            std::vector<size_t>& heap = fronts_[0].heap;
+            heap.push_back(anIndex);
+            std::push_heap(heap.begin(), heap.end(), IndexCompare(this));
+        }
+
+        size_t popIndex() {
+            std::vector<size_t>& heap = fronts_[0].heap;
+            std::pop_heap(heap.begin(), heap.end(), IndexCompare(this));
+            const size_t result = heap.back();
+            heap.pop_back();
+            return result;
+        }
+
+        bool noIndices() const {return fronts_[0].heap.empty();}
+
+        // Min-heap of (cost, index) entries per front for searches
+        // that lower labels; outdated entries stay in the heap until
+        // they are popped.
+        void pushEntry(int aFront, WorkingPixelType aCost, size_t anIndex) {
+            std::vector<heap_entry>& entries = fronts_[aFront].entries;
+            entries.push_back(heap_entry(aCost, anIndex));
+            std::push_heap(entries.begin(), entries.end(), std::greater<heap_entry>());
+        }
+
+        // Drop outdated entries from the top of the heap of aFront and
+        // answer whether a valid entry is left.
+        bool hasEntry(int aFront) {
+            std::vector<heap_entry>& entries = fronts_[aFront].entries;
+            while (!entries.empty() && entries.front().first != cost(aFront, entries.front().second)) {
+                std::pop_heap(entries.begin(), entries.end(), std::greater<heap_entry>());
+                entries.pop_back();
+            }
+            return !entries.empty();
+        }
+
+        const heap_entry& topEntry(int aFront) const {return fronts_[aFront].entries.front();}
+
+        heap_entry popEntry(int aFront) {
+            std::vector<heap_entry>& entries = fronts_[aFront].entries;
+            std::pop_heap(entries.begin(), entries.end(), std::greater<heap_entry>());
+            const heap_entry result = entries.back();
+            entries.pop_back();
+            return result;
+        }
+
+        // Answer the buffer for the path found by the last query.
+        std::vector<vigra::Point2D>& path() {return path_;}
+
+    private:
+        struct Front
+        {
+            void resize(size_t n) {
+                if (n > stamp.size()) {
+                    stamp.resize(n, 0U);
+                    cost.resize(n);
+                    hop.resize(n);
+                }
+            }
+
+            std::vector<unsigned> stamp;
+            std::vector<WorkingPixelType> cost;
+            std::vector<vigra::UInt8> hop;
+            std::vector<size_t> heap;
+            std::vector<heap_entry> entries;
+        };
+
+        class IndexCompare
+        {
+        public:
+            explicit IndexCompare(const PathWorkspace* aWorkspace) : workspace_(aWorkspace) {}
+
+            bool operator()(size_t anIndex, size_t anotherIndex) const {
+                return workspace_->fronts_[0].cost[anIndex] > workspace_->fronts_[0].cost[anotherIndex];
+            }
+
+        private:
+            const PathWorkspace* const workspace_;
+        };
+
+        int width_;
+        unsigned generation_;
+        std::array<Front, 2> fronts_;
+        std::vector<vigra::Point2D> path_;
+    }; // class PathWorkspace
+
+
+    // Answer the cost of stepping onto aPoint exactly as minCostPath()
+    // computes it.
+    template <class CostImageIterator, class CostAccessor, typename WorkingPixelType>
+    inline static WorkingPixelType
+    pathStepCost(CostImageIterator cost_upperleft, CostAccessor cost_accessor,
+                 const vigra::Point2D& aPoint, bool isDiagonal)
+    {
+        typedef typename CostAccessor::value_type CostPixelType;
+
+        WorkingPixelType neighborCost =
+            std::max(vigra::NumericTraits<WorkingPixelType>::one(),
+                     vigra::NumericTraits<WorkingPixelType>::toPromote(cost_accessor(cost_upperleft + aPoint)));
+        if (neighborCost == vigra::NumericTraits<CostPixelType>::max()) {
+            neighborCost *= 65536; // Can't use << since neighborCost may be floating-point
+        }
+        if (isDiagonal) {
+            neighborCost = WorkingPixelType(static_cast<double>(neighborCost) * 1.4);
+        }
+
+        return neighborCost;
+    }
+
+
+    template <typename WorkingPixelType>
+    inline static WorkingPixelType
+    pathAddCost(WorkingPixelType aCost, WorkingPixelType anotherCost)
+    {
+        return vigra::NumericTraits<WorkingPixelType>::fromRealPromote(static_cast<double>(aCost) +
+                                                                       static_cast<double>(anotherCost));
+    }
+
+
+    /** Find the same path as the allocating minCostPath() does, but
+     *  run in the persistent workspace aWorkspace.  Answer the path,
+     *  which lives in aWorkspace until the next query.
+     */
+    template <class CostImageIterator, class CostAccessor, typename WorkingPixelType>
+    const std::vector<vigra::Point2D>&
+    minCostPath(CostImageIterator cost_upperleft, CostImageIterator cost_lowerright, CostAccessor cost_accessor,
+                const vigra::Point2D& startingPoint, const vigra::Point2D& endingPoint,
+                PathWorkspace<WorkingPixelType>& aWorkspace)
+    {
+        const vigra::Size2D size(cost_lowerright - cost_upperleft);
+        const vigra::Rect2D valid_region(size);
+
+        aWorkspace.start(size);
+        std::vector<vigra::Point2D>& result = aWorkspace.path();
+
+        if (valid_region.contains(endingPoint)) {
+            const size_t endingIndex = aWorkspace.index(endingPoint);
+            aWorkspace.label(0, endingIndex,
+                             std::max(vigra::NumericTraits<WorkingPixelType>::one(),
+                                      vigra::NumericTraits<WorkingPixelType>::toPromote(cost_accessor(cost_upperleft + endingPoint))),
+                             0);
+            aWorkspace.pushIndex(endingIndex);
+        }
+
+        while (!aWorkspace.noIndices()) {
+            const size_t topIndex = aWorkspace.popIndex();
+            vigra::Point2D top = aWorkspace.point(topIndex);
+
+            if (top != startingPoint) {
+                const WorkingPixelType costToTop = aWorkspace.cost(0, topIndex);
+
+                for (int i = 0; i < 8; i++) {
+                    const vigra::Point2D neighborPoint = pathStep(top, pathNeighborArray[i]);
+                    if (!valid_region.contains(neighborPoint)) {
+                        continue;
+                    }
+
+                    // Neighbors are final once they have been labeled.
+                    const size_t neighborIndex = aWorkspace.index(neighborPoint);
+                    if (aWorkspace.isLabeled(0, neighborIndex)) {
+                        continue;
+                    }
+
+                    const WorkingPixelType neighborCost =
+                        pathStepCost<CostImageIterator, CostAccessor, WorkingPixelType>
+                        (cost_upperleft, cost_accessor, neighborPoint, (i & 1) == 0);
+                    const WorkingPixelType newNeighborCost = pathAddCost(neighborCost, costToTop);
+
+                    if (newNeighborCost < vigra::NumericTraits<WorkingPixelType>::max()) {
+                        aWorkspace.label(0, neighborIndex, newNeighborCost, pathNeighborArrayInverse[i]);
+                        aWorkspace.pushIndex(neighborIndex);
+                    }
+                }
+            } else {
+                // Follow back to the ending point, but include
+                // neither start nor end point in result.
+                vigra::UInt8 nextHop = aWorkspace.nextHop(0, topIndex);
+                while (nextHop != 0) {
+                    top = pathStep(top, nextHop);
+                    nextHop = aWorkspace.nextHop(0, aWorkspace.index(top));
+                    if (nextHop != 0) {
+                        result.push_back(top);
+                    }
+                }
+                break;
+            }
+        }
+
+        return result;
+    }
+
+
+    /** Find a minimum-cost path with a bidirectional Dijkstra search,
+     *  one front starting at endingPoint, the other at startingPoint.
+     *  The step costs are the same as in minCostPath(), but unlike
+     *  minCostPath(), which never revises the cost of a pixel once it
+     *  has seen it, the search lowers costs when it finds a cheaper
+     *  way.  Therefore, the path is optimal and may differ from the
+     *  path minCostPath() finds.  Both fronts meet roughly halfway,
+     *  which saves visiting most of the pixels far from the straight
+     *  line between the points.
+     *
+     *  Answer the path without its end points, ordered from
+     *  startingPoint to endingPoint.  It lives in aWorkspace until the
+     *  next query.
+     */
+    template <class CostImageIterator, class CostAccessor, typename WorkingPixelType>
+    const std::vector<vigra::Point2D>&
+    minCostPathBidirectional(CostImageIterator cost_upperleft, CostImageIterator cost_lowerright,
+                             CostAccessor cost_accessor,
+                             const vigra::Point2D& startingPoint, const vigra::Point2D& endingPoint,
+                             PathWorkspace<WorkingPixelType>& aWorkspace)
+    {
+        typedef typename PathWorkspace<WorkingPixelType>::heap_entry heap_entry;
+
+        const int FROM_END = 0;
+        const int FROM_START = 1;
+
+        const vigra::Size2D size(cost_lowerright - cost_upperleft);
+        const vigra::Rect2D valid_region(size);
+        const WorkingPixelType infinity = vigra::NumericTraits<WorkingPixelType>::max();
+
+        aWorkspace.start(size);
+        std::vector<vigra::Point2D>& result = aWorkspace.path();
+
+        if (!(valid_region.contains(startingPoint) && valid_region.contains(endingPoint)) ||
+            startingPoint == endingPoint) {
+            return result;
+        }
+
+        const size_t endingIndex = aWorkspace.index(endingPoint);
+        const size_t startingIndex = aWorkspace.index(startingPoint);
+        const WorkingPixelType endingCost =
+            std::max(vigra::NumericTraits<WorkingPixelType>::one(),
+                     vigra::NumericTraits<WorkingPixelType>::toPromote(cost_accessor(cost_upperleft + endingPoint)));
+        aWorkspace.label(FROM_END, endingIndex, endingCost, 0);
+        aWorkspace.pushEntry(FROM_END, endingCost, endingIndex);
+        aWorkspace.label(FROM_START, startingIndex, vigra::NumericTraits<WorkingPixelType>::zero(), 0);
+        aWorkspace.pushEntry(FROM_START, vigra::NumericTraits<WorkingPixelType>::zero(), startingIndex);
+
+        // Front FROM_END labels a pixel with the cost of the path from
+        // endingPoint to the pixel including the pixel itself.  Front
+        // FROM_START labels a pixel with the cost of the path from the
+        // pixel to startingPoint excluding the pixel itself.  Hence
+        // the sum of both labels is the cost of the best path known
+        // through a pixel.
+        WorkingPixelType bestCost = infinity;
+        size_t meetingIndex = 0;
+
+        while (aWorkspace.hasEntry(FROM_END) && aWorkspace.hasEntry(FROM_START)) {
+            const WorkingPixelType lowerBound =
+                pathAddCost(aWorkspace.topEntry(FROM_END).first, aWorkspace.topEntry(FROM_START).first);
+            if (lowerBound >= bestCost) {
+                break;
+            }
+
+            // Advance the front with the smaller heap.
+            const int front = aWorkspace.topEntry(FROM_END).first <= aWorkspace.topEntry(FROM_START).first ?
+                FROM_END : FROM_START;
+            const heap_entry top = aWorkspace.popEntry(front);
+            const vigra::Point2D topPoint = aWorkspace.point(top.second);
+
+            for (int i = 0; i < 8; i++) {
+                const vigra::Point2D neighborPoint = pathStep(topPoint, pathNeighborArray[i]);
+                if (!valid_region.contains(neighborPoint)) {
+                    continue;
+                }
+
+                const size_t neighborIndex = aWorkspace.index(neighborPoint);
+                const bool isDiagonal = (i & 1) == 0;
+                // Stepping from endingPoint's side onto the neighbor
+                // costs the neighbor; stepping from the neighbor onto
+                // startingPoint's side costs the top pixel.
+                const WorkingPixelType stepCost =
+                    pathStepCost<CostImageIterator, CostAccessor, WorkingPixelType>
+                    (cost_upperleft, cost_accessor, front == FROM_END ? neighborPoint : topPoint, isDiagonal);
+                const WorkingPixelType newCost = pathAddCost(top.first, stepCost);
+
+                if (newCost < aWorkspace.cost(front, neighborIndex)) {
+                    aWorkspace.label(front, neighborIndex, newCost, pathNeighborArrayInverse[i]);
+                    aWorkspace.pushEntry(front, newCost, neighborIndex);
+
+                    const int otherFront = 1 - front;
+                    if (aWorkspace.isLabeled(otherFront, neighborIndex)) {
+                        const WorkingPixelType throughCost =
+                            pathAddCost(newCost, aWorkspace.cost(otherFront, neighborIndex));
+                        if (throughCost < bestCost) {
+                            bestCost = throughCost;
+                            meetingIndex = neighborIndex;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (bestCost == infinity) {
+            return result;
+        }
+
+        // Collect the pixels from the meeting point back to
+        // startingPoint, reverse them, and continue with the pixels
+        // from the meeting point to endingPoint.
+        vigra::Point2D p = aWorkspace.point(meetingIndex);
+        while (p != startingPoint) {
+            if (p != endingPoint) {
+                result.push_back(p);
+            }
+            p = pathStep(p, aWorkspace.nextHop(FROM_START, aWorkspace.index(p)));
+        }
+        std::reverse(result.begin(), result.end());
+
+        p = aWorkspace.point(meetingIndex);
+        while (p != endingPoint) {
+            p = pathStep(p, aWorkspace.nextHop(FROM_END, aWorkspace.index(p)));
+            if (p != endingPoint) {
+                result.push_back(p);
+            }
+        }
+
+        return result;
+    }
+
+
+    template <class CostImageIterator, class CostAccessor, typename WorkingPixelType>
+    inline static const std::vector<vigra::Point2D>&
+    minCostPath(vigra::triple<CostImageIterator, CostImageIterator, CostAccessor> cost,
+                const vigra::Point2D& startingPoint, const vigra::Point2D& endingPoint,
+                PathWorkspace<WorkingPixelType>& aWorkspace)
+    {
+        return minCostPath(cost.first, cost.second, cost.third, startingPoint, endingPoint, aWorkspace);
+    }
+
+
+    template <class CostImageIterator, class CostAccessor, typename WorkingPixelType>
+    inline static const std::vector<vigra::Point2D>&
+    minCostPathBidirectional(vigra::triple<CostImageIterator, CostImageIterator, CostAccessor> cost,
+                             const vigra::Point2D& startingPoint, const vigra::Point2D& endingPoint,
+                             PathWorkspace<WorkingPixelType>& aWorkspace)
+    {
+        return minCostPathBidirectional(cost.first, cost.second, cost.third, startingPoint, endingPoint, aWorkspace);
+    }
 } // namespace enblend
 
 
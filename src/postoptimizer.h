@@ -20,6 +20,10 @@
 #ifndef __POSTOPTIMIZER_H__
 #define __POSTOPTIMIZER_H__
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "rect2d.hxx"
@@ -28,6 +32,9 @@
 #include "anneal.h"
 #include "masktypedefs.h"
 #include "mask.h"
+#include "openmp_def.h"
+#include "parameter.h"
+#include "path.h"
 
 using vigra::functor::Arg1;
 using vigra::functor::Arg2;
@@ -40,6 +47,65 @@ using vigra::functor::UnaryFunctor;
 namespace enblend
 {
 
+    // Stand-in for a visualization image that records all writes
+    // instead of performing them.  Concurrently optimized snakes each
+    // get their own recorder, which an ordered section replays and
+    // frees as soon as all snakes before it are done.  Thus the
+    // visualization image ends up exactly as if the snakes had been
+    // optimized one after the other, and at most about one recorder
+    // per thread is alive.  A recorder is write-only: operator[]
+    // answers a fresh pixel that must be assigned immediately.
+    template <typename VisualizeImageType>
+    class VisualizeRecorder
+    {
+    public:
+        typedef typename VisualizeImageType::value_type value_type;
+
+        VisualizeRecorder() = delete;
+
+        explicit VisualizeRecorder(const vigra::Size2D& aSize) : size_(aSize) {}
+
+        vigra::Size2D size() const {return size_;}
+
+        bool isInside(const vigra::Diff2D& aPoint) const {
+            return aPoint.x >= 0 && aPoint.y >= 0 && aPoint.x < size_.x && aPoint.y < size_.y;
+        }
+
+        value_type& operator[](const vigra::Diff2D& aPoint) {
+            writes_.push_back(std::make_pair(aPoint, value_type()));
+            return writes_.back().second;
+        }
+
+        void replay(VisualizeImageType* anImage) const {
+            for (typename write_list::const_iterator w = writes_.begin(); w != writes_.end(); ++w) {
+                (*anImage)[w->first] = w->second;
+            }
+        }
+
+    private:
+        typedef std::vector<std::pair<vigra::Diff2D, value_type> > write_list;
+
+        const vigra::Size2D size_;
+        write_list writes_;
+    };
+
+
+    // Answer whether an optimizer should handle the snakes in
+    // parallel rather than one after the other and leave the
+    // parallelization to the inner loops of the single snakes.  The
+    // inner loops run on one thread while the snakes are handled in
+    // parallel, so the caller requires at least
+    // aMinimumNumberOfSnakes to keep all threads busy.  The parameter
+    // aParameterName switches this on; it is off by default.
+    inline bool
+    optimizeSnakesConcurrently(const std::string& aParameterName, size_t aNumberOfSnakes, size_t aMinimumNumberOfSnakes)
+    {
+        return parameter::as_boolean(aParameterName, false) &&
+            omp_get_max_threads() > 1 &&
+            aNumberOfSnakes >= std::max(aMinimumNumberOfSnakes, static_cast<size_t>(2));
+    }
+
+
     // Base abstract class for optimizer plugins
     template <typename MismatchImageType, typename VisualizeImageType, typename AlphaType>
     class PostOptimizer
@@ -109,16 +175,36 @@ namespace enblend
         virtual void runOptimizer() {
             configureOptimizer();
 
-            int segmentNumber;
-
+            std::vector<Segment*> snakes;
+            std::vector<int> segmentNumbers;
             for (ContourVector::iterator currentContour = (*this->contours).begin();
                  currentContour != (*this->contours).end();
                  ++currentContour) {
-                segmentNumber = 0;
+                int segmentNumber = 0;
                 for (Contour::iterator currentSegment = (*currentContour)->begin();
                      currentSegment != (*currentContour)->end();
                      ++currentSegment, ++segmentNumber) {
-                    Segment* snake = *currentSegment;
+                    snakes.push_back(*currentSegment);
+                    segmentNumbers.push_back(segmentNumber);
+                }
+            }
+
+            bool concurrently =
+                optimizeSnakesConcurrently("anneal-parallel-snakes", snakes.size(),
+                                           static_cast<size_t>(omp_get_max_threads()));
+#ifdef OPENCL
+            // All snakes share the one state-probability kernel on the GPU.
+            if (GPUContext && gpuKernelAnneal()) {
+                concurrently = false;
+            }
+#endif
+
+            if (concurrently) {
+                runConcurrently(snakes, segmentNumbers);
+            } else {
+                for (size_t i = 0; i < snakes.size(); ++i) {
+                    Segment* snake = snakes[i];
+                    const int segmentNumber = segmentNumbers[i];
 
                     if (Verbose >= VERBOSE_MASK_MESSAGES) {
                         std::cerr << command
@@ -128,82 +214,18 @@ namespace enblend
                     }
 
                     if (snake->empty()) {
-                        std::cerr << std::endl
-                                  << command
-                                  << ": warning: seam s"
-                                  << segmentNumber - 1
-                                  << " is a tiny closed contour and was removed before optimization"
-                                  << std::endl;
+                        warnEmptyBeforeOptimization(segmentNumber);
                         continue;
                     }
 
-                    annealSnake(this->mismatchImage, OptimizerWeights,
-                                snake, this->visualizeImage);
-
-                    // Post-process annealed vertices
-                    Segment::iterator lastVertex = std::prev(snake->end());
-                    for (Segment::iterator vertexIterator = snake->begin();
-                         vertexIterator != snake->end();) {
-                        if (vertexIterator->first &&
-                            (*this->mismatchImage)[vertexIterator->second] == vigra::NumericTraits<MismatchImagePixelType>::max()) {
-                            // Vertex is still in max-cost region. Delete it.
-                            if (vertexIterator == snake->begin()) {
-                                snake->pop_front();
-                                vertexIterator = snake->begin();
-                            } else {
-                                vertexIterator = snake->erase(std::next(lastVertex));
-                            }
-
-                            bool needsBreak = false;
-                            if (vertexIterator == snake->end()) {
-                                vertexIterator = snake->begin();
-                                needsBreak = true;
-                            }
-
-                            // vertexIterator now points to next entry.
-
-                            // It is conceivable but very unlikely that every vertex in a closed contour
-                            // ended up in the max-cost region after annealing.
-                            if (snake->empty()) {
-                                break;
-                            }
-
-                            if (!(lastVertex->first || vertexIterator->first)) {
-                                // We deleted an entire range of moveable points between two nonmoveable points.
-                                // insert dummy point after lastVertex so dijkstra can work over this range.
-                                if (vertexIterator == snake->begin()) {
-                                    snake->push_front(std::make_pair(true, vertexIterator->second));
-                                    lastVertex = snake->begin();
-                                } else {
-                                    lastVertex = snake->insert(std::next(lastVertex),
-                                                               std::make_pair(true, vertexIterator->second));
-                                }
-                            }
-
-                            if (needsBreak) {
-                                break;
-                            }
-                        }
-                        else {
-                            lastVertex = vertexIterator;
-                            ++vertexIterator;
-                        }
-                    }
+                    optimizeSnake(snake, this->visualizeImage);
 
                     if (Verbose >= VERBOSE_MASK_MESSAGES) {
                         std::cerr << std::endl;
                     }
 
-                    // Print an explanation if every vertex in a closed contour ended up in the
-                    // max-cost region after annealing.
-                    // FIXME: explain how to fix this problem in the error message!
                     if (snake->empty()) {
-                        std::cerr << std::endl
-                                  << command
-                                  << ": seam s"
-                                  << segmentNumber - 1
-                                  << " is a tiny closed contour and was removed after optimization"
-                                  << std::endl;
+                        warnEmptyAfterOptimization(segmentNumber);
                     }
                 }
             }
@@ -212,6 +234,138 @@ namespace enblend
         virtual ~AnnealOptimizer() {}
 
     private:
+        typedef VisualizeRecorder<VisualizeImageType> recorder_t;
+
+        // Anneal the non-empty snakes in parallel.  Each snake
+        // records its visualization in a recorder of its own.
+        void runConcurrently(const std::vector<Segment*>& snakes, const std::vector<int>& segmentNumbers) {
+            std::vector<Segment*> work;
+            for (size_t i = 0; i < snakes.size(); ++i) {
+                if (snakes[i]->empty()) {
+                    warnEmptyBeforeOptimization(segmentNumbers[i]);
+                } else {
+                    work.push_back(snakes[i]);
+                }
+            }
+
+            if (Verbose >= VERBOSE_MASK_MESSAGES) {
+                std::cerr << command
+                          << ": info: Annealing Optimizer: " << work.size() << " seams in parallel:";
+                std::cerr.flush();
+            }
+
+            const int n = static_cast<int>(work.size());
+            const omp::scoped_nested no_nesting(false);
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) ordered
+#endif
+            for (int i = 0; i < n; ++i) {
+                recorder_t* recorder =
+                    this->visualizeImage ? new recorder_t(this->visualizeImage->size()) : nullptr;
+                optimizeSnake(work[i], recorder);
+
+#ifdef OPENMP
+#pragma omp ordered
+#endif
+                if (recorder) {
+                    recorder->replay(this->visualizeImage);
+                    delete recorder;
+                }
+            }
+
+            if (Verbose >= VERBOSE_MASK_MESSAGES) {
+                std::cerr << std::endl;
+            }
+
+            for (size_t i = 0; i < snakes.size(); ++i) {
+                if (snakes[i]->empty()) {
+                    warnEmptyAfterOptimization(segmentNumbers[i]);
+                }
+            }
+        }
+
+        // Anneal a single, non-empty snake and post-process the
+        // annealed vertices.  The snake's vertices, the snake itself,
+        // and aVisualizeImage are the only data modified, so that
+        // different snakes can be optimized concurrently.
+        template <typename VisualizeSinkType>
+        void optimizeSnake(Segment* snake, VisualizeSinkType* aVisualizeImage) const {
+            annealSnake(this->mismatchImage, OptimizerWeights,
+                        snake, aVisualizeImage);
+
+            // Post-process annealed vertices
+            Segment::iterator lastVertex = std::prev(snake->end());
+            for (Segment::iterator vertexIterator = snake->begin();
+                 vertexIterator != snake->end();) {
+                if (vertexIterator->first &&
+                    (*this->mismatchImage)[vertexIterator->second] == vigra::NumericTraits<MismatchImagePixelType>::max()) {
+                    // Vertex is still in max-cost region. Delete it.
+                    if (vertexIterator == snake->begin()) {
+                        snake->pop_front();
+                        vertexIterator = snake->begin();
+                    } else {
+                        vertexIterator = snake->erase(std::next(lastVertex));
+                    }
+
+                    bool needsBreak = false;
+                    if (vertexIterator == snake->end()) {
+                        vertexIterator = snake->begin();
+                        needsBreak = true;
+                    }
+
+                    // vertexIterator now points to next entry.
+
+                    // It is conceivable but very unlikely that every vertex in a closed contour
+                    // ended up in the max-cost region after annealing.
+                    if (snake->empty()) {
+                        break;
+                    }
+
+                    if (!(lastVertex->first || vertexIterator->first)) {
+                        // We deleted an entire range of moveable points between two nonmoveable points.
+                        // insert dummy point after lastVertex so dijkstra can work over this range.
+                        if (vertexIterator == snake->begin()) {
+                            snake->push_front(std::make_pair(true, vertexIterator->second));
+                            lastVertex = snake->begin();
+                        } else {
+                            lastVertex = snake->insert(std::next(lastVertex),
+                                                       std::make_pair(true, vertexIterator->second));
+                        }
+                    }
+
+                    if (needsBreak) {
+                        break;
+                    }
+                }
+                else {
+                    lastVertex = vertexIterator;
+                    ++vertexIterator;
+                }
+            }
+        }
+
+        void warnEmptyBeforeOptimization(int segmentNumber) const {
+            std::cerr << std::endl
+                      << command
+                      << ": warning: seam s"
+                      << segmentNumber - 1
+                      << " is a tiny closed contour and was removed before optimization"
+                      << std::endl;
+        }
+
+        // Print an explanation if every vertex in a closed contour ended up in the
+        // max-cost region after annealing.
+        // FIXME: explain how to fix this problem in the error message!
+        void warnEmptyAfterOptimization(int segmentNumber) const {
+            std::cerr << std::endl
+                      << command
+                      << ": seam s"
+                      << segmentNumber - 1
+                      << " is a tiny closed contour and was removed after optimization"
+                      << std::endl;
+        }
+
         void configureOptimizer() {
             // Areas other than intersection region have maximum cost.
             vigra::omp::combineThreeImages(vigra_ext::stride(*this->mismatchImageStride,
@@ -252,8 +406,21 @@ namespace enblend
         virtual void runOptimizer() {
             configureOptimizer();
 
-            vigra::Rect2D withinMismatchImage(*this->mismatchImageSize);
-            int segmentNumber;
+            std::vector<Segment*> snakes;
+            std::vector<std::pair<size_t, size_t> > snakeNumbers;
+            for (ContourVector::iterator currentContour = (*this->contours).begin();
+                 currentContour != (*this->contours).end();
+                 ++currentContour) {
+                for (Contour::iterator currentSegment = (*currentContour)->begin();
+                     currentSegment != (*currentContour)->end();
+                     ++currentSegment) {
+                    if (!(*currentSegment)->empty()) {
+                        snakes.push_back(*currentSegment);
+                        snakeNumbers.push_back(std::make_pair(currentContour - (*this->contours).begin(),
+                                                              currentSegment - (*currentContour)->begin()));
+                    }
+                }
+            }
 
             if (Verbose >= VERBOSE_MASK_MESSAGES) {
                 std::cerr << command
@@ -261,108 +428,59 @@ namespace enblend
                 std::cerr.flush();
             }
 
+            // Searching in a persistent workspace finds the same paths
+            // as the original minCostPath(), but neither copies the
+            // cost image nor allocates per query.
+            const bool useWorkspace = parameter::as_boolean("dijkstra-workspace", true);
+            const bool bidirectional = useWorkspace && parameter::as_boolean("dijkstra-bidirectional", false);
+
             // Use Dijkstra to route between moveable snake vertices over mismatchImage.
-            for (ContourVector::iterator currentContour = (*this->contours).begin();
-                 currentContour != (*this->contours).end();
-                 ++currentContour) {
-                segmentNumber = 0;
-                for (Contour::iterator currentSegment = (*currentContour)->begin();
-                     currentSegment != (*currentContour)->end();
-                     ++currentSegment, ++segmentNumber) {
-                    Segment* snake = *currentSegment;
+            if (optimizeSnakesConcurrently("dijkstra-parallel-snakes", snakes.size(), 2U)) {
+                // Each snake records its visualization in a recorder
+                // of its own, which we replay in the original order.
+                typedef VisualizeRecorder<VisualizeImageType> recorder_t;
+                const int n = static_cast<int>(snakes.size());
+
+                if (Verbose >= VERBOSE_MASK_MESSAGES) {
+                    std::cerr << " " << n << " seams in parallel";
+                    std::cerr.flush();
+                }
 
-                    if (snake->empty()) {
-                        continue;
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+                {
+                    path_workspace_t workspace;
+
+#ifdef OPENMP
+#pragma omp for schedule(dynamic) ordered
+#endif
+                    for (int i = 0; i < n; ++i) {
+                        recorder_t* recorder =
+                            this->visualizeImage ? new recorder_t(this->visualizeImage->size()) : nullptr;
+                        routeSnake(snakes[i], snakeNumbers[i].first, snakeNumbers[i].second, recorder,
+                                   useWorkspace ? &workspace : nullptr, bidirectional);
+
+#ifdef OPENMP
+#pragma omp ordered
+#endif
+                        if (recorder) {
+                            recorder->replay(this->visualizeImage);
+                            delete recorder;
+                        }
                     }
+                } // omp parallel
+            } else {
+                path_workspace_t workspace;
 
+                for (size_t i = 0; i < snakes.size(); ++i) {
                     if (Verbose >= VERBOSE_MASK_MESSAGES) {
-                        std::cerr << " s" << segmentNumber;
+                        std::cerr << " s" << snakeNumbers[i].second;
                         std::cerr.flush();
                     }
 
-                    for (Segment::iterator currentVertex = snake->begin(); ; ) {
-                        Segment::iterator nextVertex = currentVertex;
-                        ++nextVertex;
-                        if (nextVertex == snake->end()) {
-                            nextVertex = snake->begin();
-                        }
-
-                        if (currentVertex->first || nextVertex->first) {
-                            // Find shortest path between these points
-                            const vigra::Point2D currentPoint = currentVertex->second;
-                            const vigra::Point2D nextPoint = nextVertex->second;
-
-                            vigra::Rect2D pointSurround(currentPoint, vigra::Size2D(1, 1));
-                            pointSurround |= vigra::Rect2D(nextPoint, vigra::Size2D(1, 1));
-                            pointSurround.addBorder(DijkstraRadius);
-                            pointSurround &= withinMismatchImage;
-
-                            // Make BasicImage to hold pointSurround portion of mismatchImage.
-                            // min cost path needs inexpensive random access to cost image.
-                            vigra::BasicImage<MismatchImagePixelType> mismatchROIImage(pointSurround.size());
-                            vigra::copyImage(vigra_ext::apply(pointSurround, srcImageRange(*this->mismatchImage)),
-                                             destImage(mismatchROIImage));
-
-                            std::vector<vigra::Point2D>* shortPath =
-                                minCostPath(srcImageRange(mismatchROIImage),
-                                            vigra::Point2D(nextPoint - pointSurround.upperLeft()),
-                                            vigra::Point2D(currentPoint - pointSurround.upperLeft()));
-
-                            if (shortPath->empty()) {
-                                std::cerr << command << ": warning: unable to run Dijkstra optimizer\n"
-                                          << command << ": note: seam-line end point outside of cost-image\n"
-                                          << command << ": note: contour #"
-                                          << (currentContour - (*this->contours).begin()) + 1U
-                                          << " of " << (*this->contours).size()
-                                          << ", segment #"
-                                          << (currentSegment - (*currentContour)->begin()) + 1U
-                                          << " of " << (*currentContour)->size()
-                                          << ", vertex #"
-                                          << std::accumulate(snake->begin(), currentVertex, 1U,
-                                                             [](unsigned a, SegmentPoint) {return a + 1U;})
-                                          << " of " << snake->size() << std::endl;
-                            }
-
-                            for (std::vector<vigra::Point2D>::iterator shortPathPoint = shortPath->begin();
-                                 shortPathPoint != shortPath->end();
-                                 ++shortPathPoint) {
-                                snake->insert(std::next(currentVertex),
-                                              std::make_pair(false,
-                                                             *shortPathPoint + pointSurround.upperLeft()));
-
-                                if (this->visualizeImage) {
-                                    (*this->visualizeImage)[*shortPathPoint + pointSurround.upperLeft()] =
-                                        VISUALIZE_SHORT_PATH_VALUE;
-                                }
-                            }
-
-                            delete shortPath;
-
-                            if (this->visualizeImage) {
-                                const vigra::Size2D size(*this->visualizeImage->size());
-                                const vigra::Rect2D valid_region(size);
-
-                                if (valid_region.contains(currentPoint)) {
-                                    (*this->visualizeImage)[currentPoint] =
-                                        currentVertex->first ?
-                                        VISUALIZE_FIRST_VERTEX_VALUE :
-                                        VISUALIZE_NEXT_VERTEX_VALUE;
-                                }
-                                if (valid_region.contains(nextPoint)) {
-                                    (*this->visualizeImage)[nextPoint] =
-                                        nextVertex->first ?
-                                        VISUALIZE_FIRST_VERTEX_VALUE :
-                                        VISUALIZE_NEXT_VERTEX_VALUE;
-                                }
-                            }
-                        }
-
-                        currentVertex = nextVertex;
-                        if (nextVertex == snake->begin()) {
-                            break;
-                        }
-                    }
-
+                    routeSnake(snakes[i], snakeNumbers[i].first, snakeNumbers[i].second, this->visualizeImage,
+                               useWorkspace ? &workspace : nullptr, bidirectional);
                 }
             }
 
@@ -374,6 +492,119 @@ namespace enblend
         virtual ~DijkstraOptimizer() {}
 
     private:
+        typedef PathWorkspace<typename vigra::NumericTraits<MismatchImagePixelType>::Promote> path_workspace_t;
+
+        // Route between the vertices of a single, non-empty snake.
+        // Only the snake, aVisualizeImage, and aWorkspace are
+        // modified, so that different snakes can be routed
+        // concurrently with different workspaces.  Without a workspace
+        // we fall back to the allocating minCostPath().
+        template <typename VisualizeSinkType>
+        void routeSnake(Segment* snake, size_t contourNumber, size_t segmentNumber,
+                        VisualizeSinkType* aVisualizeImage,
+                        path_workspace_t* aWorkspace, bool bidirectional) const {
+            const vigra::Rect2D withinMismatchImage(*this->mismatchImageSize);
+
+            for (Segment::iterator currentVertex = snake->begin(); ; ) {
+                Segment::iterator nextVertex = currentVertex;
+                ++nextVertex;
+                if (nextVertex == snake->end()) {
+                    nextVertex = snake->begin();
+                }
+
+                if (currentVertex->first || nextVertex->first) {
+                    // Find shortest path between these points
+                    const vigra::Point2D currentPoint = currentVertex->second;
+                    const vigra::Point2D nextPoint = nextVertex->second;
+
+                    vigra::Rect2D pointSurround(currentPoint, vigra::Size2D(1, 1));
+                    pointSurround |= vigra::Rect2D(nextPoint, vigra::Size2D(1, 1));
+                    pointSurround.addBorder(DijkstraRadius);
+                    pointSurround &= withinMismatchImage;
+
+                    const std::vector<vigra::Point2D>* shortPath;
+                    std::unique_ptr<std::vector<vigra::Point2D> > allocatedShortPath;
+
+                    if (aWorkspace) {
+                        // mismatchImage is a BasicImage, which offers inexpensive random access.
+                        shortPath =
+                            bidirectional ?
+                            &minCostPathBidirectional(vigra_ext::apply(pointSurround, srcImageRange(*this->mismatchImage)),
+                                                      vigra::Point2D(nextPoint - pointSurround.upperLeft()),
+                                                      vigra::Point2D(currentPoint - pointSurround.upperLeft()),
+                                                      *aWorkspace) :
+                            &minCostPath(vigra_ext::apply(pointSurround, srcImageRange(*this->mismatchImage)),
+                                         vigra::Point2D(nextPoint - pointSurround.upperLeft()),
+                                         vigra::Point2D(currentPoint - pointSurround.upperLeft()),
+                                         *aWorkspace);
+                    } else {
+                        // Make BasicImage to hold pointSurround portion of mismatchImage.
+                        // min cost path needs inexpensive random access to cost image.
+                        vigra::BasicImage<MismatchImagePixelType> mismatchROIImage(pointSurround.size());
+                        vigra::copyImage(vigra_ext::apply(pointSurround, srcImageRange(*this->mismatchImage)),
+                                         destImage(mismatchROIImage));
+
+                        allocatedShortPath.reset(minCostPath(srcImageRange(mismatchROIImage),
+                                                             vigra::Point2D(nextPoint - pointSurround.upperLeft()),
+                                                             vigra::Point2D(currentPoint - pointSurround.upperLeft())));
+                        shortPath = allocatedShortPath.get();
+                    }
+
+                    if (shortPath->empty()) {
+                        omp::scoped_lock<omp::lock> _(snakeOutputLock());
+                        std::cerr << command << ": warning: unable to run Dijkstra optimizer\n"
+                                  << command << ": note: seam-line end point outside of cost-image\n"
+                                  << command << ": note: contour #"
+                                  << contourNumber + 1U
+                                  << " of " << (*this->contours).size()
+                                  << ", segment #"
+                                  << segmentNumber + 1U
+                                  << " of " << (*this->contours)[contourNumber]->size()
+                                  << ", vertex #"
+                                  << std::accumulate(snake->begin(), currentVertex, 1U,
+                                                     [](unsigned a, SegmentPoint) {return a + 1U;})
+                                  << " of " << snake->size() << std::endl;
+                    }
+
+                    for (std::vector<vigra::Point2D>::const_iterator shortPathPoint = shortPath->begin();
+                         shortPathPoint != shortPath->end();
+                         ++shortPathPoint) {
+                        snake->insert(std::next(currentVertex),
+                                      std::make_pair(false,
+                                                     *shortPathPoint + pointSurround.upperLeft()));
+
+                        if (aVisualizeImage) {
+                            (*aVisualizeImage)[*shortPathPoint + pointSurround.upperLeft()] =
+                                VISUALIZE_SHORT_PATH_VALUE;
+                        }
+                    }
+
+                    if (aVisualizeImage) {
+                        const vigra::Size2D size(aVisualizeImage->size());
+                        const vigra::Rect2D valid_region(size);
+
+                        if (valid_region.contains(currentPoint)) {
+                            (*aVisualizeImage)[currentPoint] =
+                                currentVertex->first ?
+                                VISUALIZE_FIRST_VERTEX_VALUE :
+                                VISUALIZE_NEXT_VERTEX_VALUE;
+                        }
+                        if (valid_region.contains(nextPoint)) {
+                            (*aVisualizeImage)[nextPoint] =
+                                nextVertex->first ?
+                                VISUALIZE_FIRST_VERTEX_VALUE :
+                                VISUALIZE_NEXT_VERTEX_VALUE;
+                        }
+                    }
+                }
+
+                currentVertex = nextVertex;
+                if (nextVertex == snake->begin()) {
+                    break;
+                }
+            }
+        }
+
         void configureOptimizer() {
             vigra::omp::combineThreeImages(vigra_ext::stride(*this->mismatchImageStride,
                                                              *this->mismatchImageStride,
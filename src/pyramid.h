@@ -25,10 +25,13 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <functional>
 #include <vector>
 
+#include <vigra/basicimage.hxx>
 #include <vigra/convolution.hxx>
+#include <vigra/copyimage.hxx>
 #include <vigra/error.hxx>
 #include <vigra/inspectimage.hxx>
 #include <vigra/numerictraits.hxx>
@@ -37,6 +40,8 @@
 #include <vigra/transformimage.hxx>
 
 #include "fixmath.h"
+#include "openmp_def.h"
+#include "skipsm_kernels.h"
 
 
 namespace enblend
@@ -1292,6 +1297,8 @@ expand(bool add, bool wraparound,
         } else {
             // No Second Column
             // dst_w, dst_h must be at least 2
+            // The state of the only source column lives in sc*[1].
+            srcx = 1;
             SKIPSM_EXPAND_ROW_COLUMN_END(36, 24, 6, 4);
         }
 
@@ -1408,6 +1415,8 @@ expand(bool add, bool wraparound,
         } else {
             // No Second Column
             // dst_w, dst_h must be at least 2
+            // The state of the only source column lives in sc*[1].
+            srcx = 1;
             SKIPSM_EXPAND_ROW_COLUMN_END(42, 28, 6, 4);
         }
     }
@@ -1457,6 +1466,794 @@ expand(bool add, bool wraparound,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Planar Reduce
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+/** Describe how reducePlanar() splits a SKIPSM pixel into its color
+ *  components.  We only support the SKIPSM types for which
+ *  skipsm_kernels.h provides row kernels; all other types take the
+ *  generic reduce().
+ */
+template <typename SKIPSMImagePixelType>
+struct PlanarSKIPSMTraits
+{
+    typedef vigra::VigraFalseType isSupported;
+};
+
+
+template <typename Component>
+struct PlanarSKIPSMScalarTraits
+{
+    typedef vigra::VigraTrueType isSupported;
+    typedef Component ComponentType;
+    enum {channels = 1};
+
+    static ComponentType get(const Component& pixel, int) {return pixel;}
+    static void set(Component& pixel, int, ComponentType value) {pixel = value;}
+};
+
+
+template <> struct PlanarSKIPSMTraits<vigra::Int32> : public PlanarSKIPSMScalarTraits<vigra::Int32> {};
+template <> struct PlanarSKIPSMTraits<double> : public PlanarSKIPSMScalarTraits<double> {};
+
+
+template <typename Component>
+struct PlanarSKIPSMTraits<vigra::RGBValue<Component, 0, 1, 2> >
+{
+    typedef typename PlanarSKIPSMTraits<Component>::isSupported isSupported;
+    typedef Component ComponentType;
+    enum {channels = 3};
+
+    static ComponentType get(const vigra::RGBValue<Component, 0, 1, 2>& pixel, int channel) {return pixel[channel];}
+    static void set(vigra::RGBValue<Component, 0, 1, 2>& pixel, int channel, ComponentType value) {pixel[channel] = value;}
+};
+
+
+/** Fill the two elements on either side of a planar row of width w,
+ *  whose first pixel lives at index 2.  The values match what the
+ *  SKIPSM state machine of reduce() sees beyond the row ends.
+ */
+template <typename T>
+inline static void
+padPlanarRow(T* row, int w, bool wraparound)
+{
+    if (wraparound) {
+        row[0] = row[w];
+        row[1] = row[w + 1];
+        row[w + 2] = row[2];
+        row[w + 3] = row[3];
+    } else {
+        row[0] = row[1] = row[w + 2] = row[w + 3] = T();
+    }
+}
+
+
+/** Row buffers of reducePlanar().  Each thread keeps one workspace
+ *  per component type, which grows to the widest row it has seen, so
+ *  that reducing the rows of a band does not allocate.
+ */
+template <typename ComponentType>
+class PlanarReduceWorkspace
+{
+public:
+    // Size all buffers for channels planes of dst_w destination
+    // pixels and clear the ones that must start out zero.
+    void prepare(int channels, int padded_w, int dst_w)
+    {
+        source.resize(channels * padded_w);
+        row.resize(channels * dst_w);
+        c0.resize(channels * dst_w);
+        c1.assign(channels * dst_w, ComponentType());
+        cp.resize(channels * dst_w);
+        sum.resize(channels * dst_w);
+        zero.assign(dst_w, ComponentType());
+
+        weight_source.resize(padded_w);
+        weight_row.resize(dst_w);
+        weight_c0.resize(dst_w);
+        weight_c1.assign(dst_w, 0);
+        weight_cp.resize(dst_w);
+        weight_sum.resize(dst_w);
+        weight_zero.assign(dst_w, 0);
+    }
+
+    std::vector<ComponentType> source;
+    std::vector<ComponentType> row;
+    std::vector<ComponentType> c0;
+    std::vector<ComponentType> c1;
+    std::vector<ComponentType> cp;
+    std::vector<ComponentType> sum;
+    std::vector<ComponentType> zero;
+
+    std::vector<vigra::Int32> weight_source;
+    std::vector<vigra::Int32> weight_row;
+    std::vector<vigra::Int32> weight_c0;
+    std::vector<vigra::Int32> weight_c1;
+    std::vector<vigra::Int32> weight_cp;
+    std::vector<vigra::Int32> weight_sum;
+    std::vector<vigra::Int32> weight_zero;
+};
+
+
+template <typename ComponentType>
+inline static PlanarReduceWorkspace<ComponentType>&
+planarReduceWorkspace()
+{
+    static thread_local PlanarReduceWorkspace<ComponentType> workspace;
+    return workspace;
+}
+
+
+/** The Burt & Adelson Reduce operation for images with alpha
+ *  channels, restructured for vectorization.
+ *
+ *  Instead of running the SKIPSM state machine pixel by pixel, we
+ *  convert each source row into one padded plane per color component
+ *  with the alpha channel folded in as 0/1 weights.  Then the row
+ *  kernels of skipsm_kernels.h filter the planes horizontally, advance
+ *  the column state, and normalize the sums without any per-pixel
+ *  branches.  The results are bit-identical to reduce().
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reducePlanar(bool wraparound,
+             SrcImageIterator src_upperleft,
+             SrcImageIterator src_lowerright,
+             SrcAccessor sa,
+             AlphaIterator alpha_upperleft,
+             AlphaAccessor aa,
+             DestImageIterator dest_upperleft,
+             DestImageIterator dest_lowerright,
+             DestAccessor da,
+             DestAlphaIterator dest_alpha_upperleft,
+             DestAlphaIterator dest_alpha_lowerright,
+             DestAlphaAccessor daa)
+{
+    typedef PlanarSKIPSMTraits<SKIPSMImagePixelType> Traits;
+    typedef typename Traits::ComponentType ComponentType;
+    typedef typename DestAccessor::value_type DestPixelType;
+    typedef typename DestAlphaAccessor::value_type DestAlphaPixelType;
+
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+
+    vigra_precondition(src_w > 1 && src_h > 1,
+                       "src image too small in reducePlanar");
+
+    if (dst_w != (src_w + 1) / 2) {
+        reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                           src_upperleft, src_lowerright, sa,
+                                                           alpha_upperleft, aa,
+                                                           dest_upperleft, dest_lowerright, da,
+                                                           dest_alpha_upperleft, dest_alpha_lowerright, daa);
+        return;
+    }
+
+    const int channels = Traits::channels;
+    const int padded_w = src_w + 4;
+
+    // Padded source rows, filtered rows, column state, and sums; one
+    // plane per color component followed by one plane for the alpha
+    // weights.
+    PlanarReduceWorkspace<ComponentType>& workspace = planarReduceWorkspace<ComponentType>();
+    workspace.prepare(channels, padded_w, dst_w);
+
+    std::vector<ComponentType>& source = workspace.source;
+    std::vector<ComponentType>& row = workspace.row;
+    std::vector<ComponentType>& c0 = workspace.c0;
+    std::vector<ComponentType>& c1 = workspace.c1;
+    std::vector<ComponentType>& cp = workspace.cp;
+    std::vector<ComponentType>& sum = workspace.sum;
+    const std::vector<ComponentType>& zero = workspace.zero;
+
+    std::vector<vigra::Int32>& weight_source = workspace.weight_source;
+    std::vector<vigra::Int32>& weight_row = workspace.weight_row;
+    std::vector<vigra::Int32>& weight_c0 = workspace.weight_c0;
+    std::vector<vigra::Int32>& weight_c1 = workspace.weight_c1;
+    std::vector<vigra::Int32>& weight_cp = workspace.weight_cp;
+    std::vector<vigra::Int32>& weight_sum = workspace.weight_sum;
+    const std::vector<vigra::Int32>& weight_zero = workspace.weight_zero;
+
+    const DestPixelType DestImageZero(vigra::NumericTraits<DestPixelType>::zero());
+    const DestAlphaPixelType DestAlphaZero(vigra::NumericTraits<DestAlphaPixelType>::zero());
+    const DestAlphaPixelType DestAlphaMax(vigra::NumericTraits<DestAlphaPixelType>::max());
+
+    SrcImageIterator sy = src_upperleft;
+    AlphaIterator ay = alpha_upperleft;
+    DestImageIterator dy = dest_upperleft;
+    DestAlphaIterator day = dest_alpha_upperleft;
+
+    for (int srcy = 0; srcy <= src_h; ++srcy, ++sy.y, ++ay.y) {
+        if (srcy < src_h) {
+            SrcImageIterator sx = sy;
+            AlphaIterator ax = ay;
+            for (int x = 2; x < src_w + 2; ++x, ++sx.x, ++ax.x) {
+                if (aa(ax)) {
+                    const SKIPSMImagePixelType pixel(sa(sx));
+                    for (int c = 0; c < channels; ++c) {
+                        source[c * padded_w + x] = Traits::get(pixel, c);
+                    }
+                    weight_source[x] = 1;
+                } else {
+                    for (int c = 0; c < channels; ++c) {
+                        source[c * padded_w + x] = ComponentType();
+                    }
+                    weight_source[x] = 0;
+                }
+            }
+
+            for (int c = 0; c < channels; ++c) {
+                padPlanarRow(&source[c * padded_w], src_w, wraparound);
+            }
+            padPlanarRow(&weight_source[0], src_w, wraparound);
+        }
+
+        if (srcy == 0) {
+            // First row initializes the column state.
+            for (int c = 0; c < channels; ++c) {
+                skipsm::reduce_row(&source[c * padded_w], &c0[c * dst_w], dst_w, ComponentType(1));
+            }
+            skipsm::reduce_row(&weight_source[0], &weight_c0[0], dst_w, 1);
+            continue;
+        } else if (srcy < src_h && srcy % 2 == 1) {
+            // Odd-numbered rows only contribute to the column state.
+            for (int c = 0; c < channels; ++c) {
+                skipsm::reduce_row(&source[c * padded_w], &cp[c * dst_w], dst_w, ComponentType(4));
+            }
+            skipsm::reduce_row(&weight_source[0], &weight_cp[0], dst_w, 4);
+            continue;
+        } else if (srcy < src_h) {
+            // Even-numbered row
+            for (int c = 0; c < channels; ++c) {
+                skipsm::reduce_row(&source[c * padded_w], &row[c * dst_w], dst_w, ComponentType(1));
+                skipsm::reduce_column(&c0[c * dst_w], &c1[c * dst_w], &cp[c * dst_w],
+                                      &row[c * dst_w], &sum[c * dst_w], dst_w);
+            }
+            skipsm::reduce_row(&weight_source[0], &weight_row[0], dst_w, 1);
+            skipsm::reduce_column(&weight_c0[0], &weight_c1[0], &weight_cp[0],
+                                  &weight_row[0], &weight_sum[0], dst_w);
+        } else {
+            // Last row: the virtual rows below the image are zero.  If
+            // the last source row was even, so is the odd row below it.
+            const bool last_row_was_even = src_h % 2 == 1;
+            for (int c = 0; c < channels; ++c) {
+                skipsm::reduce_column(&c0[c * dst_w], &c1[c * dst_w],
+                                      last_row_was_even ? &zero[0] : &cp[c * dst_w],
+                                      &zero[0], &sum[c * dst_w], dst_w);
+            }
+            skipsm::reduce_column(&weight_c0[0], &weight_c1[0],
+                                  last_row_was_even ? &weight_zero[0] : &weight_cp[0],
+                                  &weight_zero[0], &weight_sum[0], dst_w);
+        }
+
+        // Normalize and write one destination row.
+        for (int c = 0; c < channels; ++c) {
+            skipsm::normalize(&sum[c * dst_w], &weight_sum[0], &row[c * dst_w], dst_w);
+        }
+
+        DestImageIterator dx = dy;
+        DestAlphaIterator dax = day;
+        for (int x = 0; x < dst_w; ++x, ++dx.x, ++dax.x) {
+            if (weight_sum[x]) {
+                SKIPSMImagePixelType ip;
+                for (int c = 0; c < channels; ++c) {
+                    Traits::set(ip, c, row[c * dst_w + x]);
+                }
+                da.set(DestPixelType(ip), dx);
+                daa.set(DestAlphaMax, dax);
+            } else {
+                da.set(DestImageZero, dx);
+                daa.set(DestAlphaZero, dax);
+            }
+        }
+        ++dy.y;
+        ++day.y;
+    }
+}
+
+
+// Version using argument object factories.
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reducePlanar(bool wraparound,
+             vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+             vigra::pair<AlphaIterator, AlphaAccessor> mask,
+             vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+             vigra::triple<DestAlphaIterator, DestAlphaIterator, DestAlphaAccessor> destMask)
+{
+    reducePlanar<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                             src.first, src.second, src.third,
+                                                             mask.first, mask.second,
+                                                             dest.first, dest.second, dest.third,
+                                                             destMask.first, destMask.second, destMask.third);
+}
+
+
+/** Reduce an image with alpha channel with the planar kernels if
+ *  they support SKIPSMImagePixelType and with the generic SKIPSM
+ *  state machine otherwise.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduceWithKernels(bool wraparound,
+                  SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+                  AlphaIterator alpha_upperleft, AlphaAccessor aa,
+                  DestImageIterator dest_upperleft, DestImageIterator dest_lowerright, DestAccessor da,
+                  DestAlphaIterator dest_alpha_upperleft, DestAlphaIterator dest_alpha_lowerright,
+                  DestAlphaAccessor daa,
+                  vigra::VigraTrueType)
+{
+    reducePlanar<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                             src_upperleft, src_lowerright, sa,
+                                                             alpha_upperleft, aa,
+                                                             dest_upperleft, dest_lowerright, da,
+                                                             dest_alpha_upperleft, dest_alpha_lowerright, daa);
+}
+
+
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduceWithKernels(bool wraparound,
+                  SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+                  AlphaIterator alpha_upperleft, AlphaAccessor aa,
+                  DestImageIterator dest_upperleft, DestImageIterator dest_lowerright, DestAccessor da,
+                  DestAlphaIterator dest_alpha_upperleft, DestAlphaIterator dest_alpha_lowerright,
+                  DestAlphaAccessor daa,
+                  vigra::VigraFalseType)
+{
+    reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                       src_upperleft, src_lowerright, sa,
+                                                       alpha_upperleft, aa,
+                                                       dest_upperleft, dest_lowerright, da,
+                                                       dest_alpha_upperleft, dest_alpha_lowerright, daa);
+}
+
+
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduceWithKernels(bool wraparound,
+                  SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+                  AlphaIterator alpha_upperleft, AlphaAccessor aa,
+                  DestImageIterator dest_upperleft, DestImageIterator dest_lowerright, DestAccessor da,
+                  DestAlphaIterator dest_alpha_upperleft, DestAlphaIterator dest_alpha_lowerright,
+                  DestAlphaAccessor daa)
+{
+    typedef typename PlanarSKIPSMTraits<SKIPSMImagePixelType>::isSupported isSupported;
+
+    reduceWithKernels<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                                  src_upperleft, src_lowerright, sa,
+                                                                  alpha_upperleft, aa,
+                                                                  dest_upperleft, dest_lowerright, da,
+                                                                  dest_alpha_upperleft, dest_alpha_lowerright, daa,
+                                                                  isSupported());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Parallel Reduce and Expand
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+// Each band recomputes a few halo rows, so we never make bands
+// thinner than this.
+const int minimumPyramidBandHeight = 32;
+
+
+// Number of bytes of the rows of both levels that laplacianStep()
+// touches for one strip of next-level rows; see there.
+#define LAPLACIAN_STRIP_BYTES (4U * 1024U * 1024U)
+
+
+/** Answer the number of horizontal bands into which we split a
+ *  reduce or expand operation that writes rows destination rows.
+ */
+inline static int
+numberOfPyramidBands(int rows)
+{
+#ifdef OPENMP
+    return std::max(1, std::min(omp_get_max_threads(), rows / minimumPyramidBandHeight));
+#else
+    return rows > 0 ? 1 : 0;
+#endif
+}
+
+
+/** Compute the destination rows first_row to last_row - 1 of the
+ *  Burt & Adelson Reduce operation for images with alpha channels.
+ *
+ *  We run a separate SKIPSM state machine on the source rows
+ *  2*first_row - 2 through 2*last_row, i.e. it warms up on the two
+ *  source rows above the band.  The machine treats the first and the
+ *  last source row of a band as image boundaries, which spoils
+ *  exactly one destination row at each inner band edge.  Therefore,
+ *  the band goes into its own buffer, one row taller at each inner
+ *  edge, and we copy back the rows in between.  The results are
+ *  bit-identical to the serial reduce() as long as the destination
+ *  is (src_h + 1) / 2 rows high.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduceRows(bool wraparound,
+           SrcImageIterator src_upperleft,
+           SrcImageIterator src_lowerright,
+           SrcAccessor sa,
+           AlphaIterator alpha_upperleft,
+           AlphaAccessor aa,
+           DestImageIterator dest_upperleft,
+           DestImageIterator dest_lowerright,
+           DestAccessor da,
+           DestAlphaIterator dest_alpha_upperleft,
+           DestAlphaAccessor daa,
+           int first_row, int last_row)
+{
+    typedef typename DestAccessor::value_type DestPixelType;
+    typedef typename DestAlphaAccessor::value_type DestAlphaPixelType;
+
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+
+    const int head = first_row == 0 ? 0 : 1;
+    const int tail = last_row == dst_h ? 0 : 1;
+    const int src_first = 2 * (first_row - head);
+    const int src_last = tail == 0 ? src_h : 2 * last_row + 1;
+    const int band_h = last_row - first_row;
+
+    if (head == 0 && tail == 0) {
+        // The band covers the whole destination, so it has no inner
+        // edges and needs no buffer.
+        reduceWithKernels<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                                      src_upperleft, src_lowerright, sa,
+                                                                      alpha_upperleft, aa,
+                                                                      dest_upperleft, dest_lowerright, da,
+                                                                      dest_alpha_upperleft,
+                                                                      dest_alpha_upperleft + vigra::Diff2D(dst_w, dst_h),
+                                                                      daa);
+        return;
+    }
+
+    vigra::BasicImage<DestPixelType> band_image(dst_w, head + band_h + tail);
+    vigra::BasicImage<DestAlphaPixelType> band_alpha(dst_w, head + band_h + tail);
+
+    reduceWithKernels<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                                  src_upperleft + vigra::Diff2D(0, src_first),
+                                                                  src_upperleft + vigra::Diff2D(src_w, src_last),
+                                                                  sa,
+                                                                  alpha_upperleft + vigra::Diff2D(0, src_first),
+                                                                  aa,
+                                                                  band_image.upperLeft(), band_image.lowerRight(),
+                                                                  band_image.accessor(),
+                                                                  band_alpha.upperLeft(), band_alpha.lowerRight(),
+                                                                  band_alpha.accessor());
+
+    vigra::copyImage(band_image.upperLeft() + vigra::Diff2D(0, head),
+                     band_image.upperLeft() + vigra::Diff2D(dst_w, head + band_h),
+                     band_image.accessor(),
+                     dest_upperleft + vigra::Diff2D(0, first_row), da);
+    vigra::copyImage(band_alpha.upperLeft() + vigra::Diff2D(0, head),
+                     band_alpha.upperLeft() + vigra::Diff2D(dst_w, head + band_h),
+                     band_alpha.accessor(),
+                     dest_alpha_upperleft + vigra::Diff2D(0, first_row), daa);
+}
+
+
+/** The Burt & Adelson Reduce operation for images with alpha
+ *  channels, parallelized over horizontal bands of the destination.
+ *  See reduceRows() for how the bands are computed.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduceInBands(bool wraparound,
+              SrcImageIterator src_upperleft,
+              SrcImageIterator src_lowerright,
+              SrcAccessor sa,
+              AlphaIterator alpha_upperleft,
+              AlphaAccessor aa,
+              DestImageIterator dest_upperleft,
+              DestImageIterator dest_lowerright,
+              DestAccessor da,
+              DestAlphaIterator dest_alpha_upperleft,
+              DestAlphaIterator dest_alpha_lowerright,
+              DestAlphaAccessor daa)
+{
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int number_of_bands = numberOfPyramidBands(dst_h);
+
+    if (number_of_bands <= 1 || dst_h != (src_h + 1) / 2) {
+        reduceWithKernels<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                                      src_upperleft, src_lowerright, sa,
+                                                                      alpha_upperleft, aa,
+                                                                      dest_upperleft, dest_lowerright, da,
+                                                                      dest_alpha_upperleft, dest_alpha_lowerright, daa);
+        return;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < number_of_bands; ++band) {
+        reduceRows<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                               src_upperleft, src_lowerright, sa,
+                                                               alpha_upperleft, aa,
+                                                               dest_upperleft, dest_lowerright, da,
+                                                               dest_alpha_upperleft, daa,
+                                                               band * dst_h / number_of_bands,
+                                                               (band + 1) * dst_h / number_of_bands);
+    }
+}
+
+
+// Version using argument object factories.
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduceInBands(bool wraparound,
+              vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+              vigra::pair<AlphaIterator, AlphaAccessor> mask,
+              vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+              vigra::triple<DestAlphaIterator, DestAlphaIterator, DestAlphaAccessor> destMask)
+{
+    reduceInBands<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                              src.first, src.second, src.third,
+                                                              mask.first, mask.second,
+                                                              dest.first, dest.second, dest.third,
+                                                              destMask.first, destMask.second, destMask.third);
+}
+
+
+/** The Burt & Adelson Reduce operation for images without alpha
+ *  channels, parallelized over horizontal bands of the destination.
+ *  See the alpha-channel version for the details.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor>
+inline void
+reduceInBands(bool wraparound,
+              SrcImageIterator src_upperleft,
+              SrcImageIterator src_lowerright,
+              SrcAccessor sa,
+              DestImageIterator dest_upperleft,
+              DestImageIterator dest_lowerright,
+              DestAccessor da)
+{
+    typedef typename DestAccessor::value_type DestPixelType;
+
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int number_of_bands = numberOfPyramidBands(dst_h);
+
+    if (number_of_bands <= 1 || dst_h != (src_h + 1) / 2) {
+        reduce<SKIPSMImagePixelType>(wraparound,
+                                     src_upperleft, src_lowerright, sa,
+                                     dest_upperleft, dest_lowerright, da);
+        return;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < number_of_bands; ++band) {
+        const int first_row = band * dst_h / number_of_bands;
+        const int last_row = (band + 1) * dst_h / number_of_bands;
+        const int head = first_row == 0 ? 0 : 1;
+        const int tail = last_row == dst_h ? 0 : 1;
+        const int src_first = 2 * (first_row - head);
+        const int src_last = tail == 0 ? src_h : 2 * last_row + 1;
+        const int band_h = last_row - first_row;
+
+        vigra::BasicImage<DestPixelType> band_image(dst_w, head + band_h + tail);
+
+        reduce<SKIPSMImagePixelType>(wraparound,
+                                     src_upperleft + vigra::Diff2D(0, src_first),
+                                     src_upperleft + vigra::Diff2D(src_w, src_last),
+                                     sa,
+                                     band_image.upperLeft(), band_image.lowerRight(),
+                                     band_image.accessor());
+
+        vigra::copyImage(band_image.upperLeft() + vigra::Diff2D(0, head),
+                         band_image.upperLeft() + vigra::Diff2D(dst_w, head + band_h),
+                         band_image.accessor(),
+                         dest_upperleft + vigra::Diff2D(0, first_row), da);
+    }
+}
+
+
+// Version using argument object factories.
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor>
+inline static void
+reduceInBands(bool wraparound,
+              vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+              vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest)
+{
+    reduceInBands<SKIPSMImagePixelType>(wraparound,
+                                        src.first, src.second, src.third,
+                                        dest.first, dest.second, dest.third);
+}
+
+
+/** Expand the source rows first_row to last_row - 1 into the
+ *  destination rows 2*first_row to 2*last_row - 1, or to the last
+ *  destination row if last_row is the last source row.
+ *
+ *  The SKIPSM machine starts one source row early and runs one
+ *  source row late; the two destination rows at each inner band edge
+ *  come out wrong, because the machine takes the band's ends for
+ *  image boundaries.  As expand() combines its output with the
+ *  existing destination pixels, we copy the destination rows into a
+ *  private buffer, expand there, and copy back only the rows the
+ *  band owns.  The results are bit-identical to the serial expand()
+ *  as long as src_w >= 2 and the source is (dst_h + 1) / 2 rows high.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename CombineFunctor>
+void
+expandRows(bool add, bool wraparound,
+           SrcImageIterator src_upperleft,
+           SrcImageIterator src_lowerright,
+           SrcAccessor sa,
+           DestImageIterator dest_upperleft,
+           DestImageIterator dest_lowerright,
+           DestAccessor da,
+           CombineFunctor cf,
+           int first_row, int last_row)
+{
+    typedef typename DestAccessor::value_type DestPixelType;
+
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+
+    const int head = first_row == 0 ? 0 : 1;
+    const int tail = last_row == src_h ? 0 : 1;
+    const int dst_first = 2 * first_row;
+    const int dst_last = tail == 0 ? dst_h : 2 * last_row;
+    const int band_h = dst_last - dst_first;
+
+    if (head == 0 && tail == 0) {
+        // The band covers the whole source, so expand() can combine
+        // right into the destination.
+        expand<SKIPSMImagePixelType>(add, wraparound,
+                                     src_upperleft, src_lowerright, sa,
+                                     dest_upperleft, dest_lowerright, da,
+                                     cf);
+        return;
+    }
+
+    vigra::BasicImage<DestPixelType> band_image(dst_w, 2 * head + band_h + 2 * tail);
+
+    vigra::copyImage(dest_upperleft + vigra::Diff2D(0, dst_first),
+                     dest_upperleft + vigra::Diff2D(dst_w, dst_last),
+                     da,
+                     band_image.upperLeft() + vigra::Diff2D(0, 2 * head), band_image.accessor());
+
+    expand<SKIPSMImagePixelType>(add, wraparound,
+                                 src_upperleft + vigra::Diff2D(0, first_row - head),
+                                 src_upperleft + vigra::Diff2D(src_w, last_row + tail),
+                                 sa,
+                                 band_image.upperLeft(), band_image.lowerRight(), band_image.accessor(),
+                                 cf);
+
+    vigra::copyImage(band_image.upperLeft() + vigra::Diff2D(0, 2 * head),
+                     band_image.upperLeft() + vigra::Diff2D(dst_w, 2 * head + band_h),
+                     band_image.accessor(),
+                     dest_upperleft + vigra::Diff2D(0, dst_first), da);
+}
+
+
+/** The Burt & Adelson Expand operation, parallelized over horizontal
+ *  bands of the source.  See expandRows() for how the bands are
+ *  computed.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename CombineFunctor>
+void
+expandInBands(bool add, bool wraparound,
+              SrcImageIterator src_upperleft,
+              SrcImageIterator src_lowerright,
+              SrcAccessor sa,
+              DestImageIterator dest_upperleft,
+              DestImageIterator dest_lowerright,
+              DestAccessor da,
+              CombineFunctor cf)
+{
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int number_of_bands = numberOfPyramidBands(dst_h);
+
+    // A single source column is special-cased all over expand(),
+    // including its first row, so there we stay serial.
+    if (number_of_bands <= 1 || src_w < 2 || (dst_h + 1) / 2 != src_h) {
+        expand<SKIPSMImagePixelType>(add, wraparound,
+                                     src_upperleft, src_lowerright, sa,
+                                     dest_upperleft, dest_lowerright, da,
+                                     cf);
+        return;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < number_of_bands; ++band) {
+        expandRows<SKIPSMImagePixelType>(add, wraparound,
+                                         src_upperleft, src_lowerright, sa,
+                                         dest_upperleft, dest_lowerright, da,
+                                         cf,
+                                         band * src_h / number_of_bands,
+                                         (band + 1) * src_h / number_of_bands);
+    }
+}
+
+
+// Version using argument object factories.
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor>
+inline static void
+expandInBands(bool add, bool wraparound,
+              vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+              vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest)
+{
+    typedef typename DestAccessor::value_type DestPixelType;
+
+    if (add) {
+        expandInBands<SKIPSMImagePixelType>(add, wraparound,
+                                            src.first, src.second, src.third,
+                                            dest.first, dest.second, dest.third,
+                                            FromPromotePlusFunctorWrapper<DestPixelType, SKIPSMImagePixelType, DestPixelType>());
+    } else {
+        expandInBands<SKIPSMImagePixelType>(add, wraparound,
+                                            src.first, src.second, src.third,
+                                            dest.first, dest.second, dest.third,
+                                            std::minus<SKIPSMImagePixelType>());
+    }
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Gaussian Pyramid
@@ -1514,12 +2311,12 @@ gaussianPyramid(unsigned int numLevels,
         AlphaImageType* nextA = new AlphaImageType(w, h);
 
         if (lastA == nullptr) {
-            reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+            reduceInBands<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
                 (wraparound,
                  srcImageRange(*lastGP), maskIter(alpha_upperleft, aa),
                  destImageRange(*gpn), destImageRange(*nextA));
         } else {
-            reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+            reduceInBands<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
                 (wraparound,
                  srcImageRange(*lastGP), maskImage(*lastA),
                  destImageRange(*gpn), destImageRange(*nextA));
@@ -1605,7 +2402,7 @@ gaussianPyramid(unsigned int numLevels,
         // Next pyramid level
         PyramidImageType *gpn = new PyramidImageType(w, h);
 
-        reduce<SKIPSMImagePixelType>(wraparound, srcImageRange(*lastGP), destImageRange(*gpn));
+        reduceInBands<SKIPSMImagePixelType>(wraparound, srcImageRange(*lastGP), destImageRange(*gpn));
 
         gp->push_back(gpn);
         lastGP = gpn;
@@ -1643,6 +2440,126 @@ gaussianPyramid(unsigned int numLevels,
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+/** Reduce Gaussian level l into level l+1 and, in the same sweep,
+ *  subtract the expansion of level l+1 from level l, which turns the
+ *  latter into Laplacian level l.
+ *
+ *  We work through the next level in strips.  Right after reducing a
+ *  strip, we subtract the expansion from all rows of level l that no
+ *  later strip reads, i.e. up to one next-level row short of the end
+ *  of the strip.  Thus every row of level l is reduced and turned
+ *  into a Laplacian row while it still sits in the cache, instead of
+ *  the whole level passing through memory twice.  The results are
+ *  bit-identical to a reduce() followed by an expand().
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename ImageIterator, typename ImageAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename NextImageIterator, typename NextImageAccessor,
+          typename NextAlphaIterator, typename NextAlphaAccessor>
+void
+laplacianStep(bool wraparound,
+              ImageIterator image_upperleft,
+              ImageIterator image_lowerright,
+              ImageAccessor ia,
+              AlphaIterator alpha_upperleft,
+              AlphaAccessor aa,
+              NextImageIterator next_upperleft,
+              NextImageIterator next_lowerright,
+              NextImageAccessor na,
+              NextAlphaIterator next_alpha_upperleft,
+              NextAlphaIterator next_alpha_lowerright,
+              NextAlphaAccessor naa)
+{
+    const int h = image_lowerright.y - image_upperleft.y;
+    const int next_w = next_lowerright.x - next_upperleft.x;
+    const int next_h = next_lowerright.y - next_upperleft.y;
+    const std::minus<SKIPSMImagePixelType> subtract;
+
+    if (next_w < 2 || next_h != (h + 1) / 2) {
+        reduceInBands<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                                  image_upperleft, image_lowerright, ia,
+                                                                  alpha_upperleft, aa,
+                                                                  next_upperleft, next_lowerright, na,
+                                                                  next_alpha_upperleft, next_alpha_lowerright, naa);
+        expandInBands<SKIPSMImagePixelType>(false, wraparound,
+                                            next_upperleft, next_lowerright, na,
+                                            image_upperleft, image_lowerright, ia,
+                                            subtract);
+        return;
+    }
+
+    // A next-level row comes with two rows of level l, each twice as
+    // wide.  We make the strips as tall as LAPLACIAN_STRIP_BYTES
+    // allows, but not thinner than a single band.
+    const size_t row_bytes =
+        static_cast<size_t>(next_w) *
+        (sizeof(typename NextImageAccessor::value_type) + sizeof(typename NextAlphaAccessor::value_type) +
+         4U * (sizeof(typename ImageAccessor::value_type) + sizeof(typename AlphaAccessor::value_type)));
+    const int strip_height =
+        std::max(minimumPyramidBandHeight,
+                 static_cast<int>(std::min(static_cast<size_t>(next_h), LAPLACIAN_STRIP_BYTES / row_bytes)));
+    int expanded_rows = 0;
+
+    for (int first_row = 0; first_row < next_h; first_row += strip_height) {
+        const int last_row = std::min(first_row + strip_height, next_h);
+        const int reduce_bands = numberOfPyramidBands(last_row - first_row);
+
+#pragma omp parallel for schedule(dynamic)
+        for (int band = 0; band < reduce_bands; ++band) {
+            reduceRows<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                                   image_upperleft, image_lowerright, ia,
+                                                                   alpha_upperleft, aa,
+                                                                   next_upperleft, next_lowerright, na,
+                                                                   next_alpha_upperleft, naa,
+                                                                   first_row + band * (last_row - first_row) / reduce_bands,
+                                                                   first_row + (band + 1) * (last_row - first_row) / reduce_bands);
+        }
+
+        // Expanding next-level row r reads row r + 1, and reducing the
+        // next strip reads the rows of level l from 2 * last_row - 2 on.
+        const int expandable_rows = last_row == next_h ? next_h : last_row - 1;
+        if (expandable_rows > expanded_rows) {
+            const int expand_rows = expandable_rows - expanded_rows;
+            const int expand_bands = numberOfPyramidBands(expand_rows);
+
+#pragma omp parallel for schedule(dynamic)
+            for (int band = 0; band < expand_bands; ++band) {
+                expandRows<SKIPSMImagePixelType>(false, wraparound,
+                                                 next_upperleft, next_lowerright, na,
+                                                 image_upperleft, image_lowerright, ia,
+                                                 subtract,
+                                                 expanded_rows + band * expand_rows / expand_bands,
+                                                 expanded_rows + (band + 1) * expand_rows / expand_bands);
+            }
+
+            expanded_rows = expandable_rows;
+        }
+    }
+}
+
+
+// Version using argument object factories.
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename ImageIterator, typename ImageAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename NextImageIterator, typename NextImageAccessor,
+          typename NextAlphaIterator, typename NextAlphaAccessor>
+inline void
+laplacianStep(bool wraparound,
+              vigra::triple<ImageIterator, ImageIterator, ImageAccessor> image,
+              vigra::pair<AlphaIterator, AlphaAccessor> alpha,
+              vigra::triple<NextImageIterator, NextImageIterator, NextImageAccessor> next,
+              vigra::triple<NextAlphaIterator, NextAlphaIterator, NextAlphaAccessor> nextAlpha)
+{
+    laplacianStep<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                              image.first, image.second, image.third,
+                                                              alpha.first, alpha.second,
+                                                              next.first, next.second, next.third,
+                                                              nextAlpha.first, nextAlpha.second, nextAlpha.third);
+}
+
+
 /** Calculate the Laplacian pyramid of the given SrcImage/AlphaImage pair. */
 template <typename SrcImageType, typename AlphaImageType, typename PyramidImageType,
           int PyramidIntegerBits, int PyramidFractionBits,
@@ -1656,69 +2573,64 @@ laplacianPyramid(const char* exportName, unsigned int numLevels,
                  typename AlphaImageType::const_traverser alpha_upperleft,
                  typename AlphaImageType::ConstAccessor aa)
 {
-    // First create a Gaussian pyramid.
-    std::vector <PyramidImageType*>* gp =
-        gaussianPyramid<SrcImageType, AlphaImageType, PyramidImageType,
-                        PyramidIntegerBits, PyramidFractionBits,
-                        SKIPSMImagePixelType, SKIPSMAlphaPixelType>(numLevels, wraparound,
-                                                                    src_upperleft, src_lowerright, sa,
-                                                                    alpha_upperleft, aa);
+    std::vector<PyramidImageType*>* gp = new std::vector<PyramidImageType*>();
 
-    //exportPyramid(gp, exportName);
+    // Size of pyramid level 0
+    int w = src_lowerright.x - src_upperleft.x;
+    int h = src_lowerright.y - src_upperleft.y;
+
+    // Pyramid level 0
+    PyramidImageType* gp0 = new PyramidImageType(w, h);
+
+    // Copy src image into gp0, using fixed-point conversions.
+    copyToPyramidImage<SrcImageType, PyramidImageType, PyramidIntegerBits, PyramidFractionBits>
+        (src_upperleft, src_lowerright, sa, gp0->upperLeft(), gp0->accessor());
+
+    gp->push_back(gp0);
 
     if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
         std::cerr << command << ": info: generating Laplacian pyramid:";
         std::cerr.flush();
     }
 
-    // For each level, subtract the expansion of the next level.
-    // Stop if there is no next level.
-    for (unsigned int l = 0; l < (numLevels-1); l++) {
+    // Reduce each level into the next one and at the same time turn
+    // it into a Laplacian level.  The last level remains Gaussian.
+    PyramidImageType* lastGP = gp0;
+    AlphaImageType* lastA = nullptr;
+    for (unsigned int l = 1; l < numLevels; l++) {
         if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
-            std::cerr << " l" << l;
+            std::cerr << " l" << (l - 1);
             std::cerr.flush();
         }
 
-        //if (l == 4) {
-        //    int dst_w = (*((*gp)[l])).width();
-        //    cout << "dst_w=" << dst_w << std::endl;
-        //    cout << std::endl << "pre-expand l4 gp:" << std::endl;
-        //    for (int y = 30; y < 35; y++) {
-        //        cout << "y=" << y << std::endl;
-        //        for (int x = -4; x < 4; ++x) {
-        //            int modX = (x < 0) ? x+dst_w : x;
-        //            cout << (*((*gp)[l]))(modX,y) << std::endl;
-        //        }
-        //    }
-        //    int src_w = (*((*gp)[l+1])).width();
-        //    cout << "src_w=" << src_w << std::endl;
-        //    cout << std::endl << "l5 gp:" << std::endl;
-        //    for (int y = 15; y < 18; y++) {
-        //        cout << "y=" << y << std::endl;
-        //        for (int x = -2; x < 2; ++x) {
-        //            int modX = (x < 0) ? x+src_w : x;
-        //            cout << (*((*gp)[l+1]))(modX,y) << std::endl;
-        //        }
-        //    }
-        //}
-
-        expand<SKIPSMImagePixelType>(false, wraparound,
-                                     srcImageRange(*((*gp)[l+1])),
-                                     destImageRange(*((*gp)[l])));
-
-        //if (l == 4) {
-        //    int dst_w = (*((*gp)[l])).width();
-        //    cout << std::endl << "post-expand l4 gp:" << std::endl;
-        //    for (int y = 30; y < 35; y++) {
-        //        cout << "y=" << y << std::endl;
-        //        for (int x = -4; x < 4; ++x) {
-        //            int modX = (x < 0) ? x+dst_w : x;
-        //            cout << (*((*gp)[l]))(modX,y) << std::endl;
-        //        }
-        //    }
-        //}
+        // Size of next level
+        w = (w + 1) >> 1;
+        h = (h + 1) >> 1;
+
+        // Next pyramid level
+        PyramidImageType* gpn = new PyramidImageType(w, h);
+        AlphaImageType* nextA = new AlphaImageType(w, h);
+
+        if (lastA == nullptr) {
+            laplacianStep<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                (wraparound,
+                 destImageRange(*lastGP), maskIter(alpha_upperleft, aa),
+                 destImageRange(*gpn), destImageRange(*nextA));
+        } else {
+            laplacianStep<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                (wraparound,
+                 destImageRange(*lastGP), maskImage(*lastA),
+                 destImageRange(*gpn), destImageRange(*nextA));
+        }
+
+        gp->push_back(gpn);
+        lastGP = gpn;
+        delete lastA;
+        lastA = nextA;
     }
 
+    delete lastA;
+
     if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
         std::cerr << " l" << (numLevels-1) << std::endl;
     }
@@ -1773,9 +2685,9 @@ collapsePyramid(bool wraparound, std::vector<PyramidImageType*>* p)
             std::cerr.flush();
         }
 
-        expand<SKIPSMImagePixelType>(true, wraparound,
-                                     srcImageRange(*((*p)[l + 1])),
-                                     destImageRange(*((*p)[l])));
+        expandInBands<SKIPSMImagePixelType>(true, wraparound,
+                                            srcImageRange(*((*p)[l + 1])),
+                                            destImageRange(*((*p)[l])));
     }
 
     if (Verbose >= VERBOSE_PYRAMID_MESSAGES) {
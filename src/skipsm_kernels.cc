@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2009-2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "skipsm_kernels.h"
+
+
+#ifndef RESTRICT
+#define RESTRICT
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SKIPSM_HAVE_AVX2_KERNELS
+#define SKIPSM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+namespace skipsm
+{
+    // Generic loop bodies.  Each is instantiated once per instruction
+    // set; the compiler vectorizes them for the target of the caller.
+
+    template <typename T>
+    inline static void
+    reduce_row_body(const T* RESTRICT p, T* RESTRICT result, int n, T factor)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            const T* RESTRICT q = p + 2 * j;
+            result[j] = factor * (q[0] + 4 * q[1] + 6 * q[2] + 4 * q[3] + q[4]);
+        }
+    }
+
+
+    template <typename T>
+    inline static void
+    reduce_column_body(T* RESTRICT c0, T* RESTRICT c1, const T* RESTRICT cp,
+                       const T* RESTRICT row, T* RESTRICT result, int n)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            result[j] = c1[j] + 6 * c0[j] + cp[j] + row[j];
+            c1[j] = c0[j] + cp[j];
+            c0[j] = row[j];
+        }
+    }
+
+
+    // A 32-bit integer quotient is exact when computed in double
+    // precision and truncated, because the distance of a non-integral
+    // quotient to the next integer exceeds the rounding error.  In
+    // contrast to integer division, the double-precision version
+    // vectorizes.
+    inline static void
+    normalize_body(const std::int32_t* RESTRICT sum, const std::int32_t* RESTRICT weight,
+                   std::int32_t* RESTRICT quotient, int n)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            const double w = weight[j] != 0 ? static_cast<double>(weight[j]) : 1.0;
+            const std::int32_t q = static_cast<std::int32_t>(static_cast<double>(sum[j]) / w);
+            quotient[j] = weight[j] != 0 ? q : 0;
+        }
+    }
+
+
+    inline static void
+    normalize_body(const double* RESTRICT sum, const std::int32_t* RESTRICT weight,
+                   double* RESTRICT quotient, int n)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            const double w = weight[j] != 0 ? static_cast<double>(weight[j]) : 1.0;
+            quotient[j] = weight[j] != 0 ? sum[j] / w : 0.0;
+        }
+    }
+
+
+    struct KernelTable
+    {
+        void (*reduce_row_int32)(const std::int32_t*, std::int32_t*, int, std::int32_t);
+        void (*reduce_row_double)(const double*, double*, int, double);
+        void (*reduce_column_int32)(std::int32_t*, std::int32_t*, const std::int32_t*,
+                                    const std::int32_t*, std::int32_t*, int);
+        void (*reduce_column_double)(double*, double*, const double*, const double*, double*, int);
+        void (*normalize_int32)(const std::int32_t*, const std::int32_t*, std::int32_t*, int);
+        void (*normalize_double)(const double*, const std::int32_t*, double*, int);
+        const char* name;
+    };
+
+
+#define SKIPSM_DEFINE_KERNELS(m_suffix, m_attribute)                    \
+    m_attribute static void                                             \
+    reduce_row_int32_##m_suffix(const std::int32_t* p, std::int32_t* result, int n, std::int32_t factor) \
+    {                                                                   \
+        reduce_row_body(p, result, n, factor);                          \
+    }                                                                   \
+                                                                        \
+    m_attribute static void                                             \
+    reduce_row_double_##m_suffix(const double* p, double* result, int n, double factor) \
+    {                                                                   \
+        reduce_row_body(p, result, n, factor);                          \
+    }                                                                   \
+                                                                        \
+    m_attribute static void                                             \
+    reduce_column_int32_##m_suffix(std::int32_t* c0, std::int32_t* c1, const std::int32_t* cp, \
+                                   const std::int32_t* row, std::int32_t* result, int n) \
+    {                                                                   \
+        reduce_column_body(c0, c1, cp, row, result, n);                 \
+    }                                                                   \
+                                                                        \
+    m_attribute static void                                             \
+    reduce_column_double_##m_suffix(double* c0, double* c1, const double* cp, \
+                                    const double* row, double* result, int n) \
+    {                                                                   \
+        reduce_column_body(c0, c1, cp, row, result, n);                 \
+    }                                                                   \
+                                                                        \
+    m_attribute static void                                             \
+    normalize_int32_##m_suffix(const std::int32_t* sum, const std::int32_t* weight, \
+                               std::int32_t* quotient, int n)           \
+    {                                                                   \
+        normalize_body(sum, weight, quotient, n);                       \
+    }                                                                   \
+                                                                        \
+    m_attribute static void                                             \
+    normalize_double_##m_suffix(const double* sum, const std::int32_t* weight, \
+                                double* quotient, int n)                \
+    {                                                                   \
+        normalize_body(sum, weight, quotient, n);                       \
+    }                                                                   \
+                                                                        \
+    static const KernelTable kernels_##m_suffix = {                     \
+        reduce_row_int32_##m_suffix,                                    \
+        reduce_row_double_##m_suffix,                                   \
+        reduce_column_int32_##m_suffix,                                 \
+        reduce_column_double_##m_suffix,                                \
+        normalize_int32_##m_suffix,                                     \
+        normalize_double_##m_suffix,                                    \
+        #m_suffix                                                       \
+    };
+
+
+    SKIPSM_DEFINE_KERNELS(generic, )
+
+#ifdef SKIPSM_HAVE_AVX2_KERNELS
+    SKIPSM_DEFINE_KERNELS(avx2, SKIPSM_TARGET_AVX2)
+#endif
+
+#undef SKIPSM_DEFINE_KERNELS
+
+
+    inline static const KernelTable*
+    select_kernels()
+    {
+#ifdef SKIPSM_HAVE_AVX2_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return &kernels_avx2;
+        }
+#endif
+
+        return &kernels_generic;
+    }
+
+
+    inline static const KernelTable&
+    kernels()
+    {
+        static const KernelTable* const table = select_kernels();
+        return *table;
+    }
+
+
+    void
+    reduce_row(const std::int32_t* padded_row, std::int32_t* result, int n, std::int32_t factor)
+    {
+        kernels().reduce_row_int32(padded_row, result, n, factor);
+    }
+
+
+    void
+    reduce_row(const double* padded_row, double* result, int n, double factor)
+    {
+        kernels().reduce_row_double(padded_row, result, n, factor);
+    }
+
+
+    void
+    reduce_column(std::int32_t* c0, std::int32_t* c1, const std::int32_t* cp,
+                  const std::int32_t* row, std::int32_t* result, int n)
+    {
+        kernels().reduce_column_int32(c0, c1, cp, row, result, n);
+    }
+
+
+    void
+    reduce_column(double* c0, double* c1, const double* cp,
+                  const double* row, double* result, int n)
+    {
+        kernels().reduce_column_double(c0, c1, cp, row, result, n);
+    }
+
+
+    void
+    normalize(const std::int32_t* sum, const std::int32_t* weight, std::int32_t* quotient, int n)
+    {
+        kernels().normalize_int32(sum, weight, quotient, n);
+    }
+
+
+    void
+    normalize(const double* sum, const std::int32_t* weight, double* quotient, int n)
+    {
+        kernels().normalize_double(sum, weight, quotient, n);
+    }
+
+
+    const char*
+    instruction_set()
+    {
+        return kernels().name;
+    }
+} // namespace skipsm
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2009-2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef SKIPSM_KERNELS_H_INCLUDED
+#define SKIPSM_KERNELS_H_INCLUDED
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cstdint>
+
+
+// Row kernels for the planar variant of the SKIPSM reduce in
+// pyramid.h.  All kernels work on plain, contiguous arrays of one
+// color component, so that the compiler can vectorize them.  On x86
+// processors we select an AVX2 variant at runtime if the CPU supports
+// it; otherwise we fall back to the variant that only uses the
+// instructions of the baseline architecture.
+//
+// Integer kernels compute with the same 32-bit wrap-around
+// arithmetic as the generic SKIPSM code and thus yield bit-identical
+// results.
+
+namespace skipsm
+{
+    // Filter one padded source row horizontally with the 1-4-6-4-1
+    // kernel and decimate it by two:
+    //     result[j] = factor * (p[2j] + 4 p[2j+1] + 6 p[2j+2] + 4 p[2j+3] + p[2j+4])
+    // for 0 <= j < n.  The caller pads the row with two elements at
+    // either end.
+    void reduce_row(const std::int32_t* padded_row, std::int32_t* result, int n, std::int32_t factor);
+    void reduce_row(const double* padded_row, double* result, int n, double factor);
+
+    // Advance the vertical state by one even-numbered source row
+    // and answer the unnormalized sum of the five contributing
+    // source rows:
+    //     result[j] = c1[j] + 6 c0[j] + cp[j] + row[j]
+    //     c1[j] <= c0[j] + cp[j]
+    //     c0[j] <= row[j]
+    void reduce_column(std::int32_t* c0, std::int32_t* c1, const std::int32_t* cp,
+                       const std::int32_t* row, std::int32_t* result, int n);
+    void reduce_column(double* c0, double* c1, const double* cp,
+                       const double* row, double* result, int n);
+
+    // Normalize the sums by the alpha weights:
+    //     quotient[j] = weight[j] != 0 ? sum[j] / weight[j] : 0
+    // Integer quotients truncate towards zero.
+    void normalize(const std::int32_t* sum, const std::int32_t* weight, std::int32_t* quotient, int n);
+    void normalize(const double* sum, const std::int32_t* weight, double* quotient, int n);
+
+    // Answer the name of the instruction set the kernels use.
+    const char* instruction_set();
+} // namespace skipsm
+
+
+#endif // SKIPSM_KERNELS_H_INCLUDED
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// File names of the seam visualizations when blending along a merge
+// tree after pre-assembly.
+//
+// Images A and B do not overlap, and C overlaps both.  Pre-assembly
+// combines A and B into one node, so the merge tree blends a single
+// pair, whose white node starts with C.  Without pre-assembly the
+// sequential loop blends C in its second step and names that step
+// after B with number 1.  The merge tree must use the same name and
+// must not number its step after the nodes.
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "fixture.h"
+
+
+static const int width = 120;
+static const int height = 60;
+
+
+static std::string
+input(const std::string& name, int left, int right)
+{
+    fixture::Image image(width, height);
+    fixture::Alpha alpha(width, height, vigra::UInt8(0));
+
+    fixture::render(image, 1.0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = left; x < right; ++x) {
+            alpha(x, y) = 255;
+        }
+    }
+
+    const std::string filename("blend_tree_names-" + name + ".tif");
+    fixture::write(filename, image, alpha);
+    return filename;
+}
+
+
+static bool
+expect(const std::string& filename, bool shouldExist)
+{
+    if (fixture::exists(filename) != shouldExist) {
+        std::cerr << "\"" << filename << "\" " << (shouldExist ? "is missing" : "should not exist") << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " ENBLEND" << std::endl;
+        return 2;
+    }
+
+    const std::string enblend(fixture::quote(argv[1]));
+    const std::string inputs(" " + input("A", 0, 40) + " " + input("B", 80, 120) + " " + input("C", 30, 90));
+
+    const char* const stale[] = {
+        "tree-vis-0-blend_tree_names-A.tif", "tree-vis-1-blend_tree_names-B.tif",
+        "sequential-vis-0-blend_tree_names-A.tif", "sequential-vis-1-blend_tree_names-B.tif"
+    };
+    for (const char* filename : stale) {
+        std::remove(filename);
+    }
+
+    if (!fixture::run(enblend + " --pre-assemble --parameter=blend-tree" +
+                      " --visualize=tree-vis-%i-%f.tif --output=blend_tree_names-tree.tif" + inputs) ||
+        !fixture::run(enblend +
+                      " --visualize=sequential-vis-%i-%f.tif --output=blend_tree_names-sequential.tif" + inputs)) {
+        return 1;
+    }
+
+    bool ok = true;
+    ok = expect("sequential-vis-0-blend_tree_names-A.tif", true) && ok;
+    ok = expect("sequential-vis-1-blend_tree_names-B.tif", true) && ok;
+    ok = expect("tree-vis-1-blend_tree_names-B.tif", true) && ok;
+    ok = expect("tree-vis-0-blend_tree_names-A.tif", false) && ok;
+
+    return ok ? 0 : 1;
+}
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Switches that select between two implementations in enblend.
+//
+// Image A covers the left part of the canvas.  Image B, tinted red,
+// consists of three blocks on the right, which overlap A in three
+// separate regions, so that the seam has three snakes.  Every switch
+// is flipped against the default run of the same mode:
+//   - Switches of exact alternatives must produce the same image.
+//   - The scanline fill of the graph-cut and the fast exp() of the
+//     annealer may move the seam.  They must still produce a blend of
+//     the two inputs.
+
+#include <iostream>
+#include <string>
+
+#include "fixture.h"
+
+
+static const int width = 120;
+static const int height = 60;
+static const double tint = 0.08;
+
+
+static void
+makeInputs(fixture::Image& a, fixture::Alpha& aAlpha, fixture::Image& b, fixture::Alpha& bAlpha)
+{
+    fixture::render(a, 1.0);
+    fixture::render(b, 1.0, tint);
+    for (int y = 0; y < height; ++y) {
+        const bool inBlock = (y / 10) % 2 == 0;
+        for (int x = 0; x < width; ++x) {
+            aAlpha(x, y) = x < 70 ? 255 : 0;
+            bAlpha(x, y) = x >= 50 && inBlock ? 255 : 0;
+        }
+    }
+
+    fixture::write("enblend_switches-A.tif", a, aAlpha);
+    fixture::write("enblend_switches-B.tif", b, bAlpha);
+}
+
+
+static bool
+blend(const std::string& enblend, const std::string& options, const std::string& output,
+      fixture::Image& image, fixture::Alpha& alpha)
+{
+    return fixture::run(enblend + options + " --output=" + output +
+                        " enblend_switches-A.tif enblend_switches-B.tif") &&
+        fixture::read(output, image, alpha);
+}
+
+
+// Answer whether every opaque pixel of image lies between the inputs
+// that cover it, give or take tolerance.
+static bool
+isBlendOfInputs(const fixture::Image& image, const fixture::Alpha& alpha,
+                const fixture::Image& a, const fixture::Alpha& aAlpha,
+                const fixture::Image& b, const fixture::Alpha& bAlpha,
+                int tolerance)
+{
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if ((alpha(x, y) != 0) != (aAlpha(x, y) != 0 || bAlpha(x, y) != 0)) {
+                std::cerr << "pixel (" << x << ", " << y << ") has the wrong alpha" << std::endl;
+                return false;
+            }
+            if (alpha(x, y) == 0) {
+                continue;
+            }
+
+            for (int c = 0; c < 3; ++c) {
+                const int av = aAlpha(x, y) != 0 ? a(x, y)[c] : b(x, y)[c];
+                const int bv = bAlpha(x, y) != 0 ? b(x, y)[c] : a(x, y)[c];
+                const int v = image(x, y)[c];
+                if (v < std::min(av, bv) - tolerance || v > std::max(av, bv) + tolerance) {
+                    std::cerr << "pixel (" << x << ", " << y << "), channel " << c << ": " << v <<
+                        " is not between " << av << " and " << bv << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+
+struct Switch
+{
+    const char* parameter;
+    bool exact;
+};
+
+
+int
+main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " ENBLEND" << std::endl;
+        return 2;
+    }
+
+    const std::string enblend(fixture::quote(argv[1]));
+    fixture::Image a(width, height), b(width, height);
+    fixture::Alpha aAlpha(width, height), bAlpha(width, height);
+    makeInputs(a, aAlpha, b, bAlpha);
+
+    const char* const modes[] = {
+        "",
+        " --primary-seam-generator=nearest-feature-transform",
+        " --primary-seam-generator=nearest-feature-transform --wrap=horizontal"
+    };
+    const Switch switches[] = {
+        {"tiled-distance-transform=false", true},
+        {"anneal-parallel-snakes=true", true},
+        {"dijkstra-parallel-snakes=true", true},
+        {"graphcut-scanline-fill=true", false},
+        {"anneal-fast-exp=true", false}
+    };
+
+    // Rounding in the pyramids may leave the blend one code value
+    // outside of the inputs' range.
+    const int tolerance = 1;
+    int failures = 0;
+
+    for (const char* mode : modes) {
+        fixture::Image reference;
+        fixture::Alpha referenceAlpha;
+        if (!blend(enblend, mode, "enblend_switches-default.tif", reference, referenceAlpha)) {
+            return 1;
+        }
+
+        for (const Switch& s : switches) {
+            fixture::Image image;
+            fixture::Alpha alpha;
+            if (!blend(enblend, std::string(mode) + " --parameter=" + s.parameter,
+                       "enblend_switches-switched.tif", image, alpha)) {
+                return 1;
+            }
+
+            if (s.exact) {
+                const int difference = fixture::maximumDifference(reference, referenceAlpha, image, alpha);
+                if (difference != 0) {
+                    std::cerr << s.parameter << (*mode ? " with" : "") << mode <<
+                        " changes the result, maximum difference " << difference << std::endl;
+                    ++failures;
+                }
+            } else if (!isBlendOfInputs(image, alpha, a, aAlpha, b, bAlpha, tolerance)) {
+                std::cerr << s.parameter << (*mode ? " with" : "") << mode <<
+                    " does not blend the inputs" << std::endl;
+                ++failures;
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Switches that select between two exact implementations in enfuse.
+//
+// Fuse three exposures with all four criteria, once with the
+// defaults and once with each switch flipped.  Both runs must
+// produce the same image.
+
+#include <iostream>
+#include <string>
+
+#include "fixture.h"
+
+
+static const int width = 96;
+static const int height = 64;
+
+
+static std::string
+makeInputs()
+{
+    const double gain[] = {0.6, 1.0, 1.4};
+
+    std::string inputs;
+    for (int i = 0; i < 3; ++i) {
+        fixture::Image image(width, height);
+        fixture::Alpha alpha(width, height, vigra::UInt8(255));
+
+        fixture::render(image, gain[i], 0.05 * i, 0.0, -0.05 * i);
+
+        const std::string filename("enfuse_switches-in" + std::to_string(i) + ".tif");
+        fixture::write(filename, image, alpha);
+        inputs += " " + filename;
+    }
+
+    return inputs;
+}
+
+
+static bool
+fuse(const std::string& enfuse, const std::string& options, const std::string& inputs,
+     const std::string& output, fixture::Image& image, fixture::Alpha& alpha)
+{
+    return fixture::run(enfuse +
+                        " --exposure-weight=1 --saturation-weight=0.2 --contrast-weight=0.5 --entropy-weight=0.3" +
+                        options + " --output=" + output + inputs) &&
+        fixture::read(output, image, alpha);
+}
+
+
+int
+main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " ENFUSE" << std::endl;
+        return 2;
+    }
+
+    const std::string enfuse(fixture::quote(argv[1]));
+    const std::string inputs(makeInputs());
+
+    const char* const modes[] = {
+        "",
+        " --hard-mask",
+        " --hard-mask --parameter=streaming-fusion"
+    };
+    const char* const switches[] = {
+        "fused-weights=false",
+        "exposure-weight-table=false",
+        "hard-mask-labels=false"
+    };
+
+    int failures = 0;
+
+    for (const char* mode : modes) {
+        fixture::Image reference;
+        fixture::Alpha referenceAlpha;
+        if (!fuse(enfuse, mode, inputs, "enfuse_switches-default.tif", reference, referenceAlpha)) {
+            return 1;
+        }
+
+        for (const char* parameter : switches) {
+            fixture::Image image;
+            fixture::Alpha alpha;
+            if (!fuse(enfuse, std::string(mode) + " --parameter=" + parameter, inputs,
+                      "enfuse_switches-switched.tif", image, alpha)) {
+                return 1;
+            }
+
+            const int difference = fixture::maximumDifference(reference, referenceAlpha, image, alpha);
+            if (difference != 0) {
+                std::cerr << parameter << (*mode ? " with" : "") << mode <<
+                    " changes the result, maximum difference " << difference << std::endl;
+                ++failures;
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef TEST_FIXTURE_H_INCLUDED_
+#define TEST_FIXTURE_H_INCLUDED_
+
+// Helpers for the regression tests, which run the enblend and enfuse
+// binaries on small synthetic images and inspect what they write.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <vigra/impex.hxx>
+#include <vigra/impexalpha.hxx>
+#include <vigra/stdimage.hxx>
+
+
+namespace fixture
+{
+    typedef vigra::BRGBImage Image;
+    typedef vigra::BImage Alpha;
+
+
+    // Answer a smooth, textured gray level in [0, 1] at (x, y).  The
+    // same scene is used for all inputs of a test, so that the
+    // inputs really overlap.
+    inline double
+    scene(int x, int y)
+    {
+        return 0.5 + 0.25 * std::sin(0.21 * x + 0.05 * y) * std::cos(0.13 * y) + 0.15 * std::sin(0.031 * (x + 2 * y));
+    }
+
+
+    inline vigra::UInt8
+    clamp(double x)
+    {
+        return static_cast<vigra::UInt8>(std::max(0.0, std::min(255.0, std::floor(255.0 * x + 0.5))));
+    }
+
+
+    // Render scene(), multiplied by gain and tinted by the channel
+    // offsets, into image.
+    inline void
+    render(Image& image, double gain, double red = 0.0, double green = 0.0, double blue = 0.0)
+    {
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                const double v = gain * scene(x, y);
+                image(x, y) = vigra::RGBValue<vigra::UInt8>(clamp(v + red), clamp(v + green), clamp(v + blue));
+            }
+        }
+    }
+
+
+    inline void
+    write(const std::string& filename, const Image& image, const Alpha& alpha)
+    {
+        vigra::exportImageAlpha(srcImageRange(image), srcImage(alpha), vigra::ImageExportInfo(filename.c_str()));
+    }
+
+
+    inline bool
+    read(const std::string& filename, Image& image, Alpha& alpha)
+    {
+        try {
+            vigra::ImageImportInfo info(filename.c_str());
+            image.resize(info.size());
+            alpha.resize(info.size());
+            if (info.numExtraBands() >= 1) {
+                vigra::importImageAlpha(info, destImage(image), destImage(alpha));
+            } else {
+                vigra::importImage(info, destImage(image));
+                alpha.init(255);
+            }
+            return true;
+        } catch (vigra::StdException& e) {
+            std::cerr << "cannot read \"" << filename << "\": " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+
+    inline bool
+    exists(const std::string& filename)
+    {
+        FILE* file = std::fopen(filename.c_str(), "rb");
+        if (file) {
+            std::fclose(file);
+            return true;
+        }
+        return false;
+    }
+
+
+    // Run aCommandLine and answer whether it succeeded.
+    inline bool
+    run(const std::string& aCommandLine)
+    {
+        std::cout << "+ " << aCommandLine << std::endl;
+        return std::system(aCommandLine.c_str()) == 0;
+    }
+
+
+    inline std::string
+    quote(const std::string& s)
+    {
+        return "\"" + s + "\"";
+    }
+
+
+    // Answer the largest difference of any channel of any pixel that
+    // is opaque in either image, or -1 if the images differ in size or
+    // in their alpha channels.
+    inline int
+    maximumDifference(const Image& a, const Alpha& a_alpha, const Image& b, const Alpha& b_alpha)
+    {
+        if (a.size() != b.size()) {
+            return -1;
+        }
+
+        int result = 0;
+        for (int y = 0; y < a.height(); ++y) {
+            for (int x = 0; x < a.width(); ++x) {
+                if ((a_alpha(x, y) != 0) != (b_alpha(x, y) != 0)) {
+                    return -1;
+                }
+                if (a_alpha(x, y) != 0) {
+                    for (int c = 0; c < 3; ++c) {
+                        result = std::max(result, std::abs(static_cast<int>(a(x, y)[c]) - static_cast<int>(b(x, y)[c])));
+                    }
+                }
+            }
+        }
+
+        return result;
+    }
+} // namespace fixture
+
+
+#endif // TEST_FIXTURE_H_INCLUDED_
+
+// Local Variables:
+// mode: c++
+// End:
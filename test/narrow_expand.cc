@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2017 Christoph L. Spiel
+ *
+ * This file is part of Enblend.
+ *
+ * Enblend is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Enblend is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Enblend; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Expanding a pyramid level that is only one column wide.
+//
+// Fuse two exposures whose rows are constant, once two and once
+// sixteen pixels wide, with exactly two pyramid levels.  In the
+// narrow case the coarse level has a single column, which takes the
+// "No Second Column" branch of expand().  All columns of the wide
+// result are equal, so the narrow result must match its left
+// columns, including the bottom row that expand() adds at the end.
+
+#include <iostream>
+#include <string>
+
+#include "fixture.h"
+
+
+static const int height = 24;
+
+
+static std::string
+fuse(const std::string& enfuse, int width)
+{
+    const std::string prefix("narrow_expand-" + std::to_string(width));
+    const double gain[] = {0.7, 1.3};
+
+    std::string inputs;
+    for (int i = 0; i < 2; ++i) {
+        fixture::Image image(width, height);
+        fixture::Alpha alpha(width, height, vigra::UInt8(255));
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const vigra::UInt8 v = fixture::clamp(gain[i] * fixture::scene(0, 5 * y));
+                image(x, y) = vigra::RGBValue<vigra::UInt8>(v, v, v);
+            }
+        }
+
+        const std::string filename(prefix + "-in" + std::to_string(i) + ".tif");
+        fixture::write(filename, image, alpha);
+        inputs += " " + filename;
+    }
+
+    const std::string output(prefix + "-out.tif");
+    const bool ok =
+        fixture::run(fixture::quote(enfuse) +
+                     " --levels=2 --parameter=minimum-pyramid-levels=2" +
+                     " --exposure-weight=1 --saturation-weight=0 --contrast-weight=0 --entropy-weight=0" +
+                     " --output=" + output + inputs);
+
+    return ok ? output : std::string();
+}
+
+
+int
+main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " ENFUSE" << std::endl;
+        return 2;
+    }
+
+    const std::string narrow(fuse(argv[1], 2));
+    const std::string wide(fuse(argv[1], 16));
+    if (narrow.empty() || wide.empty()) {
+        return 1;
+    }
+
+    fixture::Image narrowImage, wideImage;
+    fixture::Alpha narrowAlpha, wideAlpha;
+    if (!fixture::read(narrow, narrowImage, narrowAlpha) || !fixture::read(wide, wideImage, wideAlpha)) {
+        return 1;
+    }
+
+    // The wide and the narrow fusion round at different image edges,
+    // so allow one code value of difference.
+    const int tolerance = 1;
+    int failures = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                const int difference =
+                    std::abs(static_cast<int>(narrowImage(x, y)[c]) - static_cast<int>(wideImage(x, y)[c]));
+                if (difference > tolerance) {
+                    std::cerr << "pixel (" << x << ", " << y << "), channel " << c << ": narrow "
+                              << static_cast<int>(narrowImage(x, y)[c]) << " != wide "
+                              << static_cast<int>(wideImage(x, y)[c]) << std::endl;
+                    ++failures;
+                }
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
+// Local Variables:
+// mode: c++
+// End: